@@ -6,9 +6,6 @@
 
 void do_oam_dma(uint8_t addr);
 
-//* Invalidates the cached signal level as outlined in set_audio_signal_level()
-void begin_audio_frame();
-
 //* 'n' is 0 for the first pulse channel and 1 for the second.
 
 void write_pulse_reg_0(unsigned n, uint8_t val); //* $4000/$4004
@@ -29,11 +26,14 @@ void write_dmc_reg_1(uint8_t val); //* $4011
 void write_dmc_reg_2(uint8_t val); //* $4012
 void write_dmc_reg_3(uint8_t val); //* $4013
 //* IRQ line from DMC
-extern bool dmc_irq;
+extern CONSOLE_LOCAL bool dmc_irq;
 
 void write_frame_counter(uint8_t val); //* $4017
+//* Runs the frame counter. Called from the event scheduler on the cycles on
+//* which it does something.
+void clock_frame_counter();
 //* IRQ line from frame counter
-extern bool frame_irq;
+extern CONSOLE_LOCAL bool frame_irq;
 
 //* $4015
 uint8_t read_apu_status();
@@ -41,11 +41,33 @@ void write_apu_status(uint8_t val);
 
 void init_apu();
 void init_apu_for_rom();
+//* Waits for the synthesis to finish (see apu_synth.h)
+void deinit_apu_for_rom();
 
 void reset_apu();
 void set_apu_cold_boot_state();
 
-void tick_apu();
+//* Runs the DMC timer up to the current cycle. Needs to be called before
+//* anything that depends on it from outside the APU (register writes, resets,
+//* state loads). Reading $4015 doesn't need it, as the length counters and the
+//* DMC byte count only change on frame counter steps, register writes and
+//* sample byte fetches, which all happen on time. The channels themselves run
+//* from a log (see apu_synth.h).
+void sync_apu();
+//* Runs the APU up to a DMC sample byte fetch, which stalls the CPU. Called
+//* from the event scheduler.
+void do_dmc_fetch();
+
+//* Generates the audio for the current frame, up to the current cycle
+void end_apu_frame();
+//* Same, for the last frame before the ROM is unloaded, which emulation might
+//* have left partway through
+void end_last_apu_frame();
+
+//* Stops producing audio, for frames that will be thrown away by loading a
+//* state (run-ahead). unmute_apu() must be followed by a state load.
+void mute_apu();
+void unmute_apu();
 
 template<bool calculating_size, bool is_save>
 void transfer_apu_state(uint8_t *&buf);
@@ -0,0 +1,1115 @@
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "apu_synth.h"
+#include "audio.h"
+#include "backend.h"
+#include "benchmark.h"
+#include "mapper.h"
+#include "rom.h"
+
+//* Set when the output level of any channel changes. Lets us skip the mixing
+//* step most of the time.
+static CONSOLE_LOCAL bool channel_updated;
+
+//* The channels aren't clocked on every cycle. Instead, they're run in bulk up
+//* to the cycle of each log entry before it is applied. In between, we jump
+//* straight from one output change to the next (see run_channels()).
+//*
+//* The cycle the channels have been run up to, inclusive
+static CONSOLE_LOCAL uint64_t synced_cycle;
+
+//* Our copy of the cycle on which apu_clk1 was last low (see apu.cpp). The
+//* pulse channels are clocked when it goes low.
+static CONSOLE_LOCAL uint64_t clk1_low_cycle;
+
+//* Cycle the current video frame started on. Output changes are timestamped
+//* relative to it.
+static CONSOLE_LOCAL uint64_t frame_start_cycle;
+
+//* Last cycle of the CPU stall for a DMC sample fetch started by the DMC clock.
+//* The output for the stalled cycles is timestamped one cycle early. Audibly
+//* irrelevant, but kept so that the output stays the same as when the APU was
+//* ticked from within the stalled cycle.
+static CONSOLE_LOCAL uint64_t dmc_stall_end_cycle;
+
+//*
+//* Pulse channels
+//*
+
+static CONSOLE_LOCAL struct Pulse {
+    //* Range 0-15
+    //* (Potentially) affected by
+    //*   - volume updates,
+    //*   - length counter updates,
+    //*   - period updates,
+    //*   - and waveform position updates
+    unsigned output_level;
+
+    bool     enabled;
+
+    bool     const_vol;
+    unsigned duty;
+    unsigned waveform_pos;
+    unsigned len_cnt;
+    unsigned period;
+    unsigned period_cnt;
+    bool     sweep_enabled;
+    bool     sweep_negate;
+    unsigned sweep_period;
+    unsigned sweep_period_cnt;
+    unsigned sweep_shift;
+    bool     sweep_reload_flag;
+    unsigned vol;
+
+    unsigned env_div_cnt;
+    unsigned env_vol;
+    bool     halt_len_loop_env;
+    bool     env_start_flag;
+
+    //* Recalculated whenever anything happens that might affect the sweep
+    //* target period. Not sure if this optimization is still worthwhile.
+    int sweep_target_period;
+} pulse[2];
+
+static void update_sweep_target_period(unsigned n) {
+    int addition = pulse[n].period >> pulse[n].sweep_shift;
+    //* The adder on the first pulse channel is missing the carry in to the
+    //* first bit for some unknown reason
+    if (pulse[n].sweep_negate) addition = (n == 0) ? ~addition : -addition;
+    pulse[n].sweep_target_period = (int)pulse[n].period + addition;
+}
+
+static void update_pulse_output_level(unsigned n) {
+    static uint8_t const pulse_duties[4][8] =
+      { { 0, 1, 0, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 0, 0, 0, 0, 0 },
+        { 0, 1, 1, 1, 1, 0, 0, 0 },
+        { 1, 0, 0, 1, 1, 1, 1, 1 } };
+
+    unsigned const prev_output_level = pulse[n].output_level;
+
+    if (pulse[n].len_cnt == 0                               ||
+        pulse[n].period < 8                                 ||
+        !pulse_duties[pulse[n].duty][pulse[n].waveform_pos] ||
+        pulse[n].sweep_target_period > 0x7FF) {
+
+        pulse[n].output_level = 0;
+    }
+    else
+        pulse[n].output_level =
+          pulse[n].const_vol ? pulse[n].vol : pulse[n].env_vol;
+
+    if (pulse[n].output_level != prev_output_level)
+        channel_updated = true;
+}
+
+//* True if the waveform position could affect the output level. Otherwise, the
+//* channel can be clocked in bulk.
+static bool pulse_is_audible(unsigned n) {
+    return pulse[n].len_cnt != 0                       &&
+           pulse[n].period >= 8                         &&
+           pulse[n].sweep_target_period <= 0x7FF        &&
+           (pulse[n].const_vol ? pulse[n].vol : pulse[n].env_vol) != 0;
+}
+
+static void write_pulse_reg_0(unsigned n, uint8_t val) {
+    pulse[n].duty              = val >> 6;
+    pulse[n].halt_len_loop_env = val & 0x20;
+    pulse[n].const_vol         = val & 0x10;
+    pulse[n].vol               = val & 0xF;
+
+    update_pulse_output_level(n);
+}
+
+static void write_pulse_reg_1(unsigned n, uint8_t val) {
+    pulse[n].sweep_enabled = val & 0x80;
+    pulse[n].sweep_period  = (val >> 4) & 7;
+    pulse[n].sweep_negate  = val & 8;
+    pulse[n].sweep_shift   = val & 7;
+
+    pulse[n].sweep_reload_flag = true;
+
+    update_sweep_target_period(n);
+    update_pulse_output_level(n);
+}
+
+static void write_pulse_reg_2(unsigned n, uint8_t val) {
+    pulse[n].period = (pulse[n].period & ~0x0FF) | val;
+
+    update_sweep_target_period(n);
+    update_pulse_output_level(n);
+}
+
+static void write_pulse_reg_3(unsigned n, uint8_t val) {
+    if (pulse[n].enabled)
+        pulse[n].len_cnt = len_table[val >> 3];
+    pulse[n].period = (pulse[n].period & ~0x700) | ((val & 7) << 8);
+
+    //* Side effects
+    pulse[n].waveform_pos   = 0;
+    pulse[n].env_start_flag = true;
+
+    update_sweep_target_period(n);
+    update_pulse_output_level(n);
+}
+
+static void clock_pulse_generator(unsigned n) {
+    assert(n < 2);
+    assert(pulse[n].duty < 4);
+    assert(pulse[n].waveform_pos < 8);
+    pulse[n].waveform_pos = (pulse[n].waveform_pos + 1) % 8;
+
+    update_pulse_output_level(n);
+}
+
+//*
+//* Triangle channel
+//*
+
+//* Range 0-15, premultiplied by 3 for mixing. Affected only by waveform
+//* position updates.
+static CONSOLE_LOCAL unsigned tri_output_level;
+
+static CONSOLE_LOCAL bool     tri_enabled;
+
+static CONSOLE_LOCAL unsigned tri_period;
+static CONSOLE_LOCAL unsigned tri_period_cnt;
+
+static CONSOLE_LOCAL unsigned tri_waveform_pos;
+
+static CONSOLE_LOCAL unsigned tri_len_cnt;
+static CONSOLE_LOCAL bool     tri_halt_flag;
+
+static CONSOLE_LOCAL unsigned tri_lin_cnt_load;
+static CONSOLE_LOCAL unsigned tri_lin_cnt;
+static CONSOLE_LOCAL bool     tri_lin_cnt_reload_flag;
+
+static void write_triangle_reg_0(uint8_t val) {
+    tri_halt_flag    = val & 0x80;
+    tri_lin_cnt_load = val & 0x7F;
+}
+
+static void write_triangle_reg_1(uint8_t val) {
+    tri_period = (tri_period & ~0x0FF) | val;
+}
+
+static void write_triangle_reg_2(uint8_t val) {
+    tri_lin_cnt_reload_flag = true;
+    if (tri_enabled)
+        tri_len_cnt = len_table[val >> 3];
+    tri_period = (tri_period & ~0x700) | ((val & 7) << 8);
+}
+
+//* Premultiply by three to save multiplication during mixing
+uint8_t const tri_waveform_steps[32] =
+  { 3*15, 3*14, 3*13, 3*12, 3*11, 3*10, 3*9, 3*8, 3*7, 3*6,  3*5,  3*4,  3*3,  3*2,  3*1,  3*0,
+     3*0,  3*1,  3*2,  3*3,  3*4,  3*5, 3*6, 3*7, 3*8, 3*9, 3*10, 3*11, 3*12, 3*13, 3*14, 3*15 };
+
+//* True if clocking the triangle channel moves the waveform position
+static bool tri_is_audible() {
+    return tri_len_cnt > 0 && tri_lin_cnt > 0 &&
+           //* Prevent ultrasonic frequencies, which cause pops (very audible for Crashman stage in MM2)
+           tri_period > 1 &&
+           //* Ditto for prolly-too-low-to-be-deliberate frequencies
+           tri_period <= 0x7FD;
+}
+
+static void clock_triangle_generator() {
+    if (tri_is_audible()) {
+        unsigned const prev_output_level = tri_output_level;
+
+        tri_waveform_pos = (tri_waveform_pos + 1) % 32;
+        tri_output_level = tri_waveform_steps[tri_waveform_pos];
+
+        if (tri_output_level != prev_output_level)
+            channel_updated = true;
+    }
+}
+
+//*
+//* Noise channel
+//*
+
+//* Range 0-15, premultiplied by 2 for mixing. Affected by
+//*   - volume updates,
+//*   - Length counter updates,
+//*   - and shift reg value
+static CONSOLE_LOCAL unsigned noise_output_level;
+
+static CONSOLE_LOCAL bool     noise_enabled;
+
+static CONSOLE_LOCAL bool     noise_halt_len_loop_env;
+static CONSOLE_LOCAL bool     noise_const_vol;
+static CONSOLE_LOCAL unsigned noise_vol;
+static CONSOLE_LOCAL unsigned noise_feedback_bit;
+static CONSOLE_LOCAL unsigned noise_period;
+static CONSOLE_LOCAL unsigned noise_period_cnt;
+static CONSOLE_LOCAL unsigned noise_len_cnt;
+static CONSOLE_LOCAL unsigned noise_shift_reg;
+static CONSOLE_LOCAL bool     noise_env_start_flag;
+static CONSOLE_LOCAL unsigned noise_env_vol;
+static CONSOLE_LOCAL unsigned noise_env_div_cnt;
+
+static void update_noise_output_level() {
+    unsigned const prev_output_level = noise_output_level;
+
+    noise_output_level =
+      (noise_len_cnt == 0 || !(noise_shift_reg & 1)) ?
+      0 :
+      2*(noise_const_vol ? noise_vol : noise_env_vol); //* Premultiply by 2
+
+    if (noise_output_level != prev_output_level)
+        channel_updated = true;
+}
+
+//* $400C
+static void write_noise_reg_0(uint8_t val) {
+    noise_halt_len_loop_env = val & 0x20;
+    noise_const_vol         = val & 0x10;
+    noise_vol               = val & 0x0F;
+
+    update_noise_output_level();
+}
+
+uint16_t const ntsc_noise_periods[] =
+  { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+uint16_t const pal_noise_periods[]  =
+  { 4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708,  944, 1890, 3778 };
+static CONSOLE_LOCAL uint16_t const *noise_periods;
+
+//* $400E
+static void write_noise_reg_1(uint8_t val) {
+    noise_feedback_bit = (val & 0x80) ? 6 : 1;
+    noise_period       = noise_periods[val & 0x0F];
+}
+
+//* $400F
+static void write_noise_reg_2(uint8_t val) {
+    if (noise_enabled) {
+        noise_len_cnt = len_table[val >> 3];
+        update_noise_output_level();
+    }
+    noise_env_start_flag = true;
+}
+
+//* True if the shift register could affect the output level. Otherwise, the
+//* channel can be clocked in bulk.
+static bool noise_is_audible() {
+    return noise_len_cnt != 0 && (noise_const_vol ? noise_vol : noise_env_vol) != 0;
+}
+
+static void clock_noise_shift_reg() {
+    //* Only the lowest bit from 'feedback' is used
+    unsigned const feedback = (noise_shift_reg >> noise_feedback_bit) ^ noise_shift_reg;
+    noise_shift_reg = (feedback << 14) | (noise_shift_reg >> 1);
+}
+
+static void clock_noise_generator() {
+    clock_noise_shift_reg();
+    update_noise_output_level();
+}
+
+//*
+//* DMC channel
+//*
+//* Only the output unit. Sample fetching is timed by apu.cpp, which logs the
+//* fetched bytes.
+
+//* Range 0-127
+//* Counter value directly determines output level
+static CONSOLE_LOCAL unsigned dmc_counter;
+
+static CONSOLE_LOCAL unsigned dmc_period;
+static CONSOLE_LOCAL unsigned dmc_period_cnt;
+
+static CONSOLE_LOCAL uint8_t  dmc_sample_buffer;
+static CONSOLE_LOCAL bool     dmc_sample_buffer_has_data;
+static CONSOLE_LOCAL uint8_t  dmc_shift_reg;
+static CONSOLE_LOCAL bool     dpcm_active;
+static CONSOLE_LOCAL unsigned dmc_bits_remaining;
+
+//* $4010
+static void write_dmc_reg_0(uint8_t val) {
+    dmc_period = dmc_periods[val & 0x0F];
+}
+
+//* $4011
+static void write_dmc_reg_1(uint8_t val) {
+    unsigned const old_dmc_counter = dmc_counter;
+
+    dmc_counter = val & 0x7F;
+
+    if (dmc_counter != old_dmc_counter)
+        channel_updated = true;
+}
+
+static void clock_dmc() {
+    if (dpcm_active) {
+        if (dmc_shift_reg & 1) {
+            if (dmc_counter < 126) {
+                dmc_counter += 2;
+                channel_updated = true;
+            }
+        }
+        else
+            if (dmc_counter > 1) {
+                dmc_counter -= 2;
+                channel_updated = true;
+            }
+        dmc_shift_reg >>= 1;
+    }
+
+    if (--dmc_bits_remaining == 0) {
+        dmc_bits_remaining = 8;
+
+        if ((dpcm_active = dmc_sample_buffer_has_data)) {
+            dmc_shift_reg              = dmc_sample_buffer;
+            dmc_sample_buffer_has_data = false;
+        }
+    }
+}
+
+//*
+//* Status
+//*
+
+//* $4015. The DMC bit is handled by apu.cpp.
+static void write_status(uint8_t val) {
+    for (unsigned n = 0; n < 2; ++n) {
+        if (!(pulse[n].enabled = val & (1 << n))) {
+            pulse[n].len_cnt = 0;
+            update_pulse_output_level(n);
+        }
+    }
+
+    if (!(tri_enabled = val & 4))
+        tri_len_cnt = 0;
+
+    if (!(noise_enabled = val & 8)) {
+        noise_len_cnt = 0;
+        update_noise_output_level();
+    }
+}
+
+//*
+//* Frame counter clocks
+//*
+
+//* Quarter frame
+static void clock_env_and_tri_lin() {
+
+    //* Pulse channels
+
+    for (unsigned n = 0; n < 2; ++n) {
+        if (pulse[n].env_start_flag) {
+            pulse[n].env_start_flag = false;
+
+            pulse[n].env_vol     = 15;
+            pulse[n].env_div_cnt = pulse[n].vol;
+        }
+        else {
+            if (pulse[n].env_div_cnt-- == 0) {
+                pulse[n].env_div_cnt = pulse[n].vol;
+
+                if (pulse[n].env_vol > 0)
+                    --pulse[n].env_vol;
+                else
+                    if (pulse[n].halt_len_loop_env)
+                        pulse[n].env_vol = 15;
+            }
+        }
+        update_pulse_output_level(n);
+    }
+
+    //* Noise channel
+
+    if (noise_env_start_flag) {
+        noise_env_start_flag = false;
+
+        noise_env_vol     = 15;
+        noise_env_div_cnt = noise_vol;
+    }
+    else {
+        if (noise_env_div_cnt-- == 0) {
+            noise_env_div_cnt = noise_vol;
+
+            if (noise_env_vol > 0)
+                --noise_env_vol;
+            else
+                if (noise_halt_len_loop_env)
+                    noise_env_vol = 15;
+        }
+    }
+    update_noise_output_level();
+
+    //* Triangle channel
+
+    if (tri_lin_cnt_reload_flag) {
+        tri_lin_cnt_reload_flag = tri_halt_flag;
+        tri_lin_cnt = tri_lin_cnt_load;
+    }
+    else
+        if (tri_lin_cnt > 0)
+            --tri_lin_cnt;
+}
+
+//* Half frame
+static void clock_len_and_sweep() {
+    for (unsigned n = 0; n < 2; ++n) {
+        if (!pulse[n].halt_len_loop_env && pulse[n].len_cnt > 0) {
+            --pulse[n].len_cnt;
+            update_pulse_output_level(n);
+        }
+
+        if (pulse[n].sweep_period_cnt == 0) {
+            if (pulse[n].sweep_enabled            &&
+                pulse[n].period      >= 8         &&
+                pulse[n].sweep_shift != 0         &&
+                pulse[n].sweep_target_period >= 0 &&
+                pulse[n].sweep_target_period <= 0x7FF) {
+
+                pulse[n].period = pulse[n].sweep_target_period;
+                update_sweep_target_period(n);
+                update_pulse_output_level(n);
+            }
+        }
+
+        if (pulse[n].sweep_reload_flag || pulse[n].sweep_period_cnt == 0) {
+            pulse[n].sweep_reload_flag = false;
+            pulse[n].sweep_period_cnt = pulse[n].sweep_period;
+        }
+        else
+            --pulse[n].sweep_period_cnt;
+    }
+
+    if (!tri_halt_flag && tri_len_cnt > 0)
+        --tri_len_cnt;
+
+    if (!noise_halt_len_loop_env && noise_len_cnt > 0) {
+        --noise_len_cnt;
+        update_noise_output_level();
+    }
+}
+
+//*
+//* Mixer
+//*
+
+//* http://*wiki.nesdev.com/w/index.php/APU_Mixer
+//*
+//* The mixer works in integers. The tables hold output levels scaled to the
+//* range of the signal, with the INT16_MIN bias folded into the
+//* triangle/noise/DMC table, so that mixing is two lookups and an add. This
+//* avoids float-to-int conversions, which are slow on ARMv7.
+
+static int16_t pulse_mixer_table[31];
+
+#ifdef NONLINEAR_TND_MIXER
+//* The triangle, noise and DMC outputs don't really mix linearly. With
+//* NONLINEAR_TND_MIXER ('make MIXER=nonlinear'), we use a full table indexed by
+//* all three levels (64 KB) instead of the usual approximation that is indexed
+//* by 3*triangle + 2*noise + DMC.
+static int16_t tri_noi_dmc_mixer_table[16][16][128];
+#else
+static int16_t tri_noi_dmc_mixer_table[203];
+#endif
+
+//* Mixer outputs in the range 0.0-1.0
+
+static double pulse_mix(unsigned pulse_sum) {
+    return pulse_sum ? 95.52/(8128.0/pulse_sum + 100.0) : 0.0;
+}
+
+#ifdef NONLINEAR_TND_MIXER
+
+static double tri_noi_dmc_mix(unsigned tri, unsigned noise, unsigned dmc) {
+    double const sum = tri/8227.0 + noise/12241.0 + dmc/22638.0;
+    return sum ? 159.79/(1.0/sum + 100.0) : 0.0;
+}
+
+#else
+
+//* 'n' is 3*triangle + 2*noise + DMC
+static double tri_noi_dmc_mix(unsigned n) {
+    return n ? 163.67/(24329.0/n + 100.0) : 0.0;
+}
+
+#endif
+
+//* Returns the biased level from the triangle/noise/DMC table. 'tri' and
+//* 'noise' are premultiplied, like tri_output_level and noise_output_level.
+static int tri_noi_dmc_mixer_level(unsigned tri, unsigned noise, unsigned dmc) {
+#ifdef NONLINEAR_TND_MIXER
+    return tri_noi_dmc_mixer_table[tri/3][noise/2][dmc];
+#else
+    return tri_noi_dmc_mixer_table[tri + noise + dmc];
+#endif
+}
+
+bool check_mixer() {
+    unsigned long n_mismatches = 0;
+    for (unsigned pulse_sum = 0; pulse_sum < 31; ++pulse_sum)
+        for (unsigned tri = 0; tri < 16; ++tri)
+            for (unsigned noise = 0; noise < 16; ++noise)
+                for (unsigned dmc = 0; dmc < 128; ++dmc) {
+#ifdef NONLINEAR_TND_MIXER
+                    float const tri_noi_dmc = tri_noi_dmc_mix(tri, noise, dmc);
+#else
+                    float const tri_noi_dmc =
+                      tri_noi_dmc_mix(3*tri + 2*noise + dmc);
+#endif
+                    int const float_level =
+                      INT16_MIN +
+                        ((float)pulse_mix(pulse_sum) + tri_noi_dmc)*
+                          (INT16_MAX - INT16_MIN);
+                    int const int_level =
+                      pulse_mixer_table[pulse_sum] +
+                      tri_noi_dmc_mixer_level(3*tri, 2*noise, dmc);
+
+                    if (int_level < INT16_MIN || int_level > INT16_MAX ||
+                        abs(int_level - float_level) > 1) {
+                        if (n_mismatches++ == 0)
+                            printf("Mixer mismatch for pulse %u, triangle %u, "
+                                   "noise %u, DMC %u: %d (integer) vs. %d "
+                                   "(floating point)\n",
+                                   pulse_sum, tri, noise, dmc, int_level,
+                                   float_level);
+                    }
+                }
+
+    if (n_mismatches != 0) {
+        printf("The integer mixer is off by more than one for %lu "
+               "combinations of output levels\n", n_mismatches);
+        return false;
+    }
+    puts("The integer mixer matches floating-point mixing within one for all "
+         "combinations of output levels");
+    return true;
+}
+
+void init_apu_synth() {
+    for (unsigned n = 0; n < 31; ++n)
+        pulse_mixer_table[n] = lround(pulse_mix(n)*(INT16_MAX - INT16_MIN));
+
+#ifdef NONLINEAR_TND_MIXER
+    for (unsigned tri = 0; tri < 16; ++tri)
+        for (unsigned noise = 0; noise < 16; ++noise)
+            for (unsigned dmc = 0; dmc < 128; ++dmc)
+                tri_noi_dmc_mixer_table[tri][noise][dmc] =
+                  lround(INT16_MIN + tri_noi_dmc_mix(tri, noise, dmc)*
+                                       (INT16_MAX - INT16_MIN));
+#else
+    for (unsigned n = 0; n < 203; ++n)
+        tri_noi_dmc_mixer_table[n] =
+          lround(INT16_MIN + tri_noi_dmc_mix(n)*(INT16_MAX - INT16_MIN));
+#endif
+}
+
+static void mix(uint64_t cycle) {
+    if (!channel_updated)
+        return;
+
+    int const signal_level =
+      pulse_mixer_table[pulse[0].output_level + pulse[1].output_level] +
+      tri_noi_dmc_mixer_level(tri_output_level, noise_output_level,
+                              dmc_counter);
+
+    set_audio_signal_level(
+      cycle - frame_start_cycle - 1 - (cycle <= dmc_stall_end_cycle),
+      signal_level);
+
+    channel_updated = false;
+}
+
+//*
+//* Catch-up
+//*
+
+//* Runs the channels up to and including 'end_cycle'. Channels that can't
+//* change their output level are clocked in bulk. Otherwise, we step from one
+//* clock of an audible channel to the next, mixing in between.
+static void run_channels(uint64_t end_cycle) {
+    while (synced_cycle < end_cycle) {
+        //* Find the next cycle on which the output could change. A change
+        //* already made (e.g. by a register write) is mixed on the next cycle.
+        uint64_t next = end_cycle;
+        if (channel_updated)
+            next = synced_cycle + 1;
+        else {
+            //* The pulse channels are clocked on every other cycle, when
+            //* apu_clk1 goes low
+            for (unsigned n = 0; n < 2; ++n)
+                if (pulse_is_audible(n))
+                    next = min(next, clk1_low_cycle +
+                                     2*((synced_cycle - clk1_low_cycle)/2 +
+                                        pulse[n].period_cnt));
+            if (tri_is_audible())
+                next = min(next, synced_cycle + tri_period_cnt);
+            if (noise_is_audible())
+                next = min(next, synced_cycle + noise_period_cnt);
+            next = min(next, synced_cycle + dmc_period_cnt);
+        }
+
+        uint64_t const cycles     = next - synced_cycle;
+        uint64_t const clk1_lows  = (next - clk1_low_cycle)/2 -
+                                    (synced_cycle - clk1_low_cycle)/2;
+        synced_cycle = next;
+
+        //*
+        //* Pulse
+        //*
+
+        for (unsigned n = 0; n < 2; ++n) {
+            uint64_t const clocks =
+              run_counter(pulse[n].period_cnt, pulse[n].period + 1, clk1_lows);
+            if (pulse_is_audible(n)) {
+                if (clocks != 0)
+                    clock_pulse_generator(n);
+            }
+            else
+                //* Output level stays at zero
+                pulse[n].waveform_pos = (pulse[n].waveform_pos + clocks)%8;
+        }
+
+        //*
+        //* Triangle
+        //*
+
+        if (run_counter(tri_period_cnt, tri_period + 1, cycles) != 0)
+            //* Does nothing if the channel isn't audible
+            clock_triangle_generator();
+
+        //*
+        //* Noise
+        //*
+
+        uint64_t noise_clocks =
+          run_counter(noise_period_cnt, noise_period + 1, cycles);
+        if (noise_is_audible()) {
+            if (noise_clocks != 0)
+                clock_noise_generator();
+        }
+        else
+            //* Output level stays at zero
+            while (noise_clocks-- != 0)
+                clock_noise_shift_reg();
+
+        //*
+        //* DMC
+        //*
+
+        if (run_counter(dmc_period_cnt, dmc_period, cycles) != 0)
+            clock_dmc();
+
+        mix(next);
+    }
+}
+
+//*
+//* Initialization and resetting
+//*
+
+//* See reset_apu()
+static void reset_channels(uint64_t cycle) {
+    clk1_low_cycle = cycle;
+
+    //* Pulse channels
+
+    for (unsigned n = 0; n < 2; ++n) {
+        pulse[n].enabled          = false;
+        pulse[n].waveform_pos     = 0;
+        pulse[n].len_cnt          = 0;
+        pulse[n].period_cnt       = 1;
+        pulse[n].sweep_period_cnt = 0;
+        pulse[n].env_div_cnt      = 0;
+        pulse[n].env_vol          = 0;
+    }
+
+    //* Triangle channel
+
+    tri_enabled      = false;
+    tri_period_cnt   = 1;
+    tri_waveform_pos = 0;
+    tri_len_cnt      = 0;
+    tri_lin_cnt      = 0;
+
+    //* Noise channel
+
+    noise_enabled     = false;
+    noise_period      = noise_period_cnt = noise_periods[0];
+    noise_len_cnt     = 0;
+    noise_shift_reg   = 1; //* Essential for LFSR to work
+    noise_env_vol     = 0;
+    noise_env_div_cnt = 0;
+
+    //* DMC channel
+
+    dmc_period_cnt             = dmc_period = dmc_periods[0];
+    dmc_sample_buffer_has_data = false;
+    dmc_bits_remaining         = 8;
+    //* The value here shouldn't matter, but this seems to be what the reset
+    //* signal does
+    dmc_shift_reg              = 0xFF;
+    dpcm_active                = false;
+
+    //* Set the initial output levels. The frame counter clocks in five-step
+    //* mode are logged after this, and don't change them.
+
+    for (unsigned n = 0; n < 2; ++n) {
+        update_sweep_target_period(n);
+        update_pulse_output_level(n);
+    }
+
+    update_noise_output_level();
+
+    //* Avoids a pop due to a sudden volume change when the triangle starts
+    //* playing
+    tri_output_level = tri_waveform_steps[tri_waveform_pos];
+}
+
+//* See set_apu_cold_boot_state()
+static void set_channels_cold_boot_state(uint64_t cycle, unsigned frame_offset) {
+    //* Start running the channels from 'cycle'
+    synced_cycle        = cycle;
+    frame_start_cycle   = cycle - frame_offset;
+    dmc_stall_end_cycle = 0;
+
+    //* Pulse channels
+
+    for (unsigned n = 0; n < 2; ++n) {
+        pulse[n].const_vol         = false;
+        pulse[n].duty              = 0;
+        pulse[n].period            = 0;
+        pulse[n].sweep_enabled     = false;
+        pulse[n].sweep_negate      = false;
+        pulse[n].sweep_period      = 0;
+        pulse[n].sweep_shift       = 0;
+        pulse[n].sweep_reload_flag = false;
+        pulse[n].vol               = 0;
+
+        pulse[n].halt_len_loop_env = false;
+        pulse[n].env_start_flag    = false;
+    }
+
+    //* Triangle channel
+
+    tri_period              = 0;
+    tri_halt_flag           = false;
+    tri_lin_cnt_load        = 0;
+    tri_lin_cnt_reload_flag = false;
+
+    //* Noise channel
+
+    noise_halt_len_loop_env = false;
+    noise_const_vol         = false;
+    noise_vol               = 0;
+    noise_feedback_bit      = 1; //* Noise looping off
+    noise_env_start_flag    = false;
+
+    //* DMC channel
+
+    dmc_counter       = 0;
+    dmc_sample_buffer = 0;
+
+    //* A reset is logged right after this
+}
+
+//*
+//* Log processing
+//*
+
+struct Apu_log_entry {
+    uint64_t     cycle;
+    unsigned     arg;
+    Apu_log_kind kind;
+};
+
+static void write_reg(unsigned addr, uint8_t val) {
+    switch (addr) {
+    case 0x4000: write_pulse_reg_0(0, val); break;
+    case 0x4001: write_pulse_reg_1(0, val); break;
+    case 0x4002: write_pulse_reg_2(0, val); break;
+    case 0x4003: write_pulse_reg_3(0, val); break;
+
+    case 0x4004: write_pulse_reg_0(1, val); break;
+    case 0x4005: write_pulse_reg_1(1, val); break;
+    case 0x4006: write_pulse_reg_2(1, val); break;
+    case 0x4007: write_pulse_reg_3(1, val); break;
+
+    case 0x4008: write_triangle_reg_0(val); break;
+    case 0x400A: write_triangle_reg_1(val); break;
+    case 0x400B: write_triangle_reg_2(val); break;
+
+    case 0x400C: write_noise_reg_0(val); break;
+    case 0x400E: write_noise_reg_1(val); break;
+    case 0x400F: write_noise_reg_2(val); break;
+
+    case 0x4010: write_dmc_reg_0(val); break;
+    case 0x4011: write_dmc_reg_1(val); break;
+
+    case 0x4015: write_status(val); break;
+    }
+}
+
+static void process_entry(Apu_log_entry const &entry) {
+    //* A cold boot restarts the channels from its cycle
+    if (entry.kind != APU_LOG_COLD_BOOT)
+        run_channels(entry.cycle);
+
+    switch (entry.kind) {
+    case APU_LOG_WRITE:
+        write_reg(entry.arg >> 8, entry.arg & 0xFF);
+        break;
+
+    case APU_LOG_QUARTER_FRAME:
+        clock_env_and_tri_lin();
+        break;
+
+    case APU_LOG_HALF_FRAME:
+        clock_len_and_sweep();
+        break;
+
+    case APU_LOG_DMC_STALL:
+        dmc_stall_end_cycle = entry.cycle + entry.arg;
+        break;
+
+    case APU_LOG_DMC_BYTE:
+        dmc_sample_buffer          = entry.arg;
+        dmc_sample_buffer_has_data = true;
+        break;
+
+    case APU_LOG_RESET:
+        reset_channels(entry.cycle);
+        break;
+
+    case APU_LOG_COLD_BOOT:
+        set_channels_cold_boot_state(entry.cycle, entry.arg);
+        break;
+
+    case APU_LOG_END_FRAME:
+        end_audio_frame(entry.cycle - frame_start_cycle);
+        frame_start_cycle = entry.cycle;
+        //* end_audio_frame() brings the signal level to zero, so it needs to
+        //* be set again. After the last frame, the next ROM starts from
+        //* zero instead.
+        if (!entry.arg)
+            channel_updated = true;
+        break;
+    }
+}
+
+//*
+//* Synthesis thread
+//*
+
+//* The log is a single-producer, single-consumer ring buffer, in the same style
+//* as the audio ring buffer in audio.cpp. The emulation thread only writes
+//* log_write_pos and the synthesis thread only writes log_read_pos. The
+//* synthesis thread advances log_read_pos after it has processed an entry, so
+//* once the two are equal, the synthesis state is safe to access from the
+//* emulation thread until the next entry is logged.
+
+static CONSOLE_LOCAL Apu_log_entry log_entries[8192];
+static CONSOLE_LOCAL std::atomic<size_t> log_read_pos, log_write_pos;
+
+//* Only accessed from the emulation thread
+static std::thread synth_thread;
+static CONSOLE_LOCAL bool synth_thread_running;
+
+static CONSOLE_LOCAL std::atomic<bool> stop_synth_thread;
+
+//* Set while running ahead (see mute_apu_synth()). Only accessed from the
+//* emulation thread.
+static CONSOLE_LOCAL bool synth_muted;
+
+static void run_synth_thread() {
+    unsigned idle_polls = 0;
+
+    for (;;) {
+        size_t       read  = log_read_pos.load(std::memory_order_relaxed);
+        size_t const write = log_write_pos.load(std::memory_order_acquire);
+
+        if (read != write) {
+            for (; read != write; ++read) {
+                process_entry(log_entries[read%ARRAY_LEN(log_entries)]);
+                log_read_pos.store(read + 1, std::memory_order_release);
+            }
+            idle_polls = 0;
+        }
+        else if (stop_synth_thread.load(std::memory_order_acquire))
+            return;
+        //* New entries usually arrive soon while the emulation is running, so
+        //* poll for a while before backing off (e.g. when paused)
+        else if (++idle_polls < 1000)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void wait_for_synth_thread() {
+    while (log_read_pos.load(std::memory_order_acquire) !=
+           log_write_pos.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+}
+
+void log_apu(uint64_t cycle, Apu_log_kind kind, unsigned arg) {
+    if (synth_muted)
+        return;
+
+    Apu_log_entry const entry = { cycle, arg, kind };
+
+    if (!synth_thread_running) {
+        BENCH_SCOPE(kind == APU_LOG_END_FRAME ? BENCH_AUDIO : BENCH_APU);
+        process_entry(entry);
+        return;
+    }
+
+    size_t const write = log_write_pos.load(std::memory_order_relaxed);
+    //* Wait for room. Only happens if the synthesis thread falls far behind.
+    while (write - log_read_pos.load(std::memory_order_acquire) ==
+           ARRAY_LEN(log_entries))
+        std::this_thread::yield();
+    log_entries[write%ARRAY_LEN(log_entries)] = entry;
+    log_write_pos.store(write + 1, std::memory_order_release);
+}
+
+void sync_apu_synth(uint64_t cycle) {
+    if (synth_thread_running)
+        wait_for_synth_thread();
+
+    BENCH_SCOPE(BENCH_APU);
+    run_channels(cycle);
+}
+
+void mute_apu_synth() {
+    synth_muted = true;
+}
+
+void unmute_apu_synth(uint64_t cycle) {
+    if (synth_thread_running)
+        wait_for_synth_thread();
+
+    //* Pick up as if a frame had ended on 'cycle'. The channels weren't run
+    //* while muted, but their state is loaded right after this.
+    synced_cycle = frame_start_cycle = cycle;
+    dmc_stall_end_cycle = 0;
+    channel_updated = true;
+    synth_muted = false;
+}
+
+void init_apu_synth_for_rom() {
+    noise_periods = is_pal ? pal_noise_periods : ntsc_noise_periods;
+    synth_muted = false;
+
+    if (bAPUThread) {
+        log_read_pos = log_write_pos = 0;
+        stop_synth_thread = false;
+        synth_thread = std::thread(run_synth_thread);
+        synth_thread_running = true;
+    }
+}
+
+void deinit_apu_synth_for_rom() {
+    if (synth_thread_running) {
+        //* Finishes the log first
+        stop_synth_thread = true;
+        synth_thread.join();
+        synth_thread_running = false;
+    }
+}
+
+//*
+//* State transfers
+//*
+
+template<bool calculating_size, bool is_save>
+void transfer_apu_synth_state(uint8_t *&buf) {
+    //* Saved as apu_clk1, as cpu_cycle isn't part of the state
+    bool clk1_is_high = (synced_cycle - clk1_low_cycle) & 1;
+    TRANSFER(clk1_is_high)
+    if (!calculating_size && !is_save)
+        clk1_low_cycle = synced_cycle - clk1_is_high;
+
+    //* Pulse channel
+
+    for (unsigned i = 0; i < 2; ++i) {
+        TRANSFER(pulse[i].output_level)
+        TRANSFER(pulse[i].enabled)
+        TRANSFER(pulse[i].const_vol)
+        TRANSFER(pulse[i].duty)
+        TRANSFER(pulse[i].waveform_pos);
+        TRANSFER(pulse[i].len_cnt)
+        TRANSFER(pulse[i].period)
+        TRANSFER(pulse[i].period_cnt)
+        TRANSFER(pulse[i].sweep_target_period)
+        TRANSFER(pulse[i].sweep_enabled)
+        TRANSFER(pulse[i].sweep_negate)
+        TRANSFER(pulse[i].sweep_period)
+        TRANSFER(pulse[i].sweep_period_cnt)
+        TRANSFER(pulse[i].sweep_shift)
+        TRANSFER(pulse[i].sweep_reload_flag)
+        TRANSFER(pulse[i].vol)
+
+        TRANSFER(pulse[i].env_div_cnt)
+        TRANSFER(pulse[i].env_vol)
+        TRANSFER(pulse[i].halt_len_loop_env)
+        TRANSFER(pulse[i].env_start_flag)
+    }
+
+    //* Triangle channel
+
+    TRANSFER(tri_output_level)
+    TRANSFER(tri_enabled)
+    TRANSFER(tri_period)
+    TRANSFER(tri_period_cnt)
+    TRANSFER(tri_waveform_pos)
+    TRANSFER(tri_len_cnt)
+    TRANSFER(tri_halt_flag)
+    TRANSFER(tri_lin_cnt_load)
+    TRANSFER(tri_lin_cnt)
+    TRANSFER(tri_lin_cnt_reload_flag)
+
+    //* Noise channel
+
+    TRANSFER(noise_output_level)
+    TRANSFER(noise_enabled)
+    TRANSFER(noise_halt_len_loop_env)
+    TRANSFER(noise_const_vol)
+    TRANSFER(noise_vol)
+    TRANSFER(noise_feedback_bit)
+    TRANSFER(noise_period)
+    TRANSFER(noise_period_cnt)
+    TRANSFER(noise_len_cnt)
+    TRANSFER(noise_shift_reg)
+    TRANSFER(noise_env_start_flag)
+    TRANSFER(noise_env_vol)
+    TRANSFER(noise_env_div_cnt)
+
+    update_noise_output_level();
+
+    //* DMC channel
+
+    TRANSFER(dmc_counter)
+    TRANSFER(dmc_period)
+    TRANSFER(dmc_period_cnt)
+    TRANSFER(dmc_sample_buffer)
+    TRANSFER(dmc_sample_buffer_has_data)
+    TRANSFER(dmc_shift_reg)
+    TRANSFER(dpcm_active)
+    TRANSFER(dmc_bits_remaining)
+}
+
+//* Explicit instantiations
+
+//* Calculating state size
+template void transfer_apu_synth_state<true, false>(uint8_t*&);
+//* Saving state to buffer
+template void transfer_apu_synth_state<false, true>(uint8_t*&);
+//* Loading state from buffer
+template void transfer_apu_synth_state<false, false>(uint8_t*&);
@@ -0,0 +1,74 @@
+//* APU channel synthesis
+//*
+//* The parts of the APU that only affect the audio output - the waveform
+//* generators, envelopes, sweep units, linear counter, DMC output unit and the
+//* mixer - run from a log of everything that affects them: register writes,
+//* frame counter clocks, DMC sample bytes, resets and the ends of frames. The
+//* log is recorded by apu.cpp, which handles everything the CPU can observe
+//* ($4015, the IRQs and DMC fetch timing).
+//*
+//* Log entries are normally processed right away. With bAPUThread, they are
+//* instead passed through a lock-free queue to a synthesis thread, which runs
+//* the channels, mixes, and resamples in parallel with the emulation.
+
+enum Apu_log_kind {
+    APU_LOG_WRITE,         //* Register write. 'arg' is (address << 8) | value.
+    APU_LOG_QUARTER_FRAME, //* Clocks the envelopes and the linear counter
+    APU_LOG_HALF_FRAME,    //* Clocks the length counters and sweep units
+    APU_LOG_DMC_STALL,     //* CPU stalled by a fetch started by the DMC clock.
+                           //* 'arg' is the length of the stall in cycles.
+    APU_LOG_DMC_BYTE,      //* Sample byte arriving in the sample buffer.
+                           //* 'arg' is the byte.
+    APU_LOG_RESET,
+    APU_LOG_COLD_BOOT,     //* 'arg' is frame_offset
+    APU_LOG_END_FRAME      //* End of a video frame. 'arg' is 1 if no frame
+                           //* follows (the ROM is being unloaded).
+};
+
+//* Records an entry that takes effect after the channels have been run up to
+//* and including 'cycle'. Entries must be logged in cycle order.
+void log_apu(uint64_t cycle, Apu_log_kind kind, unsigned arg = 0);
+
+//* Waits for the synthesis thread (if running) to catch up with the log, and
+//* then runs the channels up to and including 'cycle'. Needed before
+//* accessing the synthesis state from the emulation thread.
+void sync_apu_synth(uint64_t cycle);
+
+//* Makes log_apu() ignore everything, so that the channels stop running and no
+//* audio is produced. Used for run-ahead frames (see save_states.cpp).
+void mute_apu_synth();
+//* Resumes synthesis from 'cycle'. The channel state is stale, so it must be
+//* followed by a state load.
+void unmute_apu_synth(uint64_t cycle);
+
+void init_apu_synth();
+
+//* Checks the integer mixer against mixing in floating point (how it used to be
+//* done) for all combinations of output levels, and reports the result. They
+//* may differ by one due to rounding. Returns false if they differ by more, or
+//* if a level is out of range.
+bool check_mixer();
+//* Starts the synthesis thread if bAPUThread is set
+void init_apu_synth_for_rom();
+//* Stops the synthesis thread
+void deinit_apu_synth_for_rom();
+
+template<bool calculating_size, bool is_save>
+void transfer_apu_synth_state(uint8_t *&buf);
+
+//* Shared with apu.cpp
+
+extern uint8_t const len_table[32];
+extern CONSOLE_LOCAL uint16_t const *dmc_periods;
+
+//* Runs a down counter that is reloaded with 'reload' after reaching zero for
+//* 'ticks' ticks. Returns the number of times it reached zero.
+inline uint64_t run_counter(unsigned &cnt, unsigned reload, uint64_t ticks) {
+    if (ticks < cnt) {
+        cnt -= ticks;
+        return 0;
+    }
+    ticks -= cnt;
+    cnt = reload - ticks%reload;
+    return 1 + ticks/reload;
+}
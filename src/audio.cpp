@@ -1,25 +1,38 @@
 #include "common.h"
 
+#include <atomic>
+
 #include "audio.h"
 #include "cpu.h"
 #include "blip_buf.h"
 #include "timing.h"
-#include "sdl_backend.h"
+#include "backend.h"
 
 //*
 //* Audio ring buffer
 //*
 
+//* The ring buffer is written by the emulation thread (end_audio_frame()) and
+//* read by the audio thread (read_samples(), called from SDL's audio callback).
+//* It is lock-free: each side only ever modifies its own position and reads
+//* the other's. The positions count samples since the start and are reduced
+//* modulo the (power-of-two) buffer size when indexing, so read_pos ==
+//* write_pos unambiguously means the buffer is empty. The release store of a
+//* position, paired with the acquire load on the other side, makes sure the
+//* samples written (or the space freed) are visible before the new position
+//* is.
+
 //* Make room for 1/6th seconds of delay
 
-static int16_t buf[GE_POW_2(sample_rate/6)] __attribute__((aligned(32))) ;
-//* Indices from start_index up to but not including end_index (modulo wrapping)
-//* contain samples
-static size_t start_index = 0, end_index = 0;
-//* True if the last operation was a read. Indicates whether
-//* start_index == end_index means the buffer is full or empty.
-static bool prev_op_was_read = true;
-static blip_t *blip;
+static CONSOLE_LOCAL int16_t buf[GE_POW_2(sample_rate/6)] __attribute__((aligned(32))) ;
+static CONSOLE_LOCAL std::atomic<size_t> read_pos, write_pos;
+
+//* Number of read_samples() calls that ran out of samples, and of
+//* end_audio_frame() calls that had to drop samples due to the buffer being
+//* full. Each is only incremented by the side that notices.
+static CONSOLE_LOCAL std::atomic<unsigned long> underruns, overruns;
+
+static CONSOLE_LOCAL blip_t *blip;
 
 //* We try to keep the internal audio buffer 50% full for maximum protection
 //* against under- and overflow. To maintain that level, we adjust the playback
@@ -29,144 +42,121 @@ static blip_t *blip;
 //*double const max_adjust = 0.015;
 double const max_adjust = 0.015;
 
-static bool playback_started;
+//* Atomic since audio_running_behind() reads it from the emulation thread while
+//* end_audio_frame() might be running on the APU synthesis thread
+static CONSOLE_LOCAL std::atomic<bool> playback_started;
 
 //* Leave some extra room in the buffer to allow audio to be slowed down. Assume
 //* PAL, which gives a slightly larger buffer than NTSC. (The expression is
 //* equivalent to 1.3*sample_rate/frames_per_second, but a compile-time constant
 //* in C++03.)
 //TODO: Make dependent on max_adjust.
-static int16_t blip_samples[1300*sample_rate/pal_milliframes_per_second] __attribute__((aligned(32)));
+static CONSOLE_LOCAL int16_t blip_samples[1300*sample_rate/pal_milliframes_per_second] __attribute__((aligned(32)));
 
 
+static size_t buf_index(size_t pos) {
+    return pos & (ARRAY_LEN(buf) - 1);
+}
+
+//* Called from the audio thread
 void read_samples(int16_t *dst, size_t len) {
-    
-    assert(start_index < ARRAY_LEN(buf));
-    size_t contig_avail;
-    if ((start_index == end_index && !prev_op_was_read) || start_index > end_index)
-        contig_avail = ARRAY_LEN(buf) - start_index;
-    else
-        contig_avail = end_index - start_index;
-
-    prev_op_was_read = true;
-    if (contig_avail >= len) {
-        //* ...as many as we need. Copy it all in one go.
-        memcpy(dst, buf + start_index, sizeof(*buf)*len);
-        start_index = (start_index + len) % ARRAY_LEN(buf);
-    }
-    else {
-        //* ... less than we need. Copy the contiguous segment first.
-        memcpy(dst, buf + start_index, sizeof(*buf)*contig_avail);
-        len -= contig_avail;
-        assert(len > 0);
-        //* Move past the contiguous segment - possibly to index 0
-        start_index = (start_index + contig_avail) % ARRAY_LEN(buf);
-        assert(start_index <= end_index);
-        //* How many contiguous bytes are available now...?
-        size_t const avail = end_index - start_index;
-        if (avail >= len) {
-            //* ...as many as we need. Copy the rest.
-            memcpy(dst + contig_avail, buf + start_index, sizeof(*buf)*len);
-            start_index += len;
-            assert(start_index <= end_index);
-        }
-        else {
-            //* ...less than we need. Copy as much as we can and zero-fill
-            //* the rest of the output buffer, as required by SDL2.
-            memcpy(dst + contig_avail, buf + start_index, sizeof(*buf)*avail);
-            memset(dst + contig_avail + avail, 0, sizeof(*buf)*(len - avail));
-            assert(start_index + avail == end_index);
-            start_index = end_index;
-            //if (!bRunTests && bExtraVerbose){
-            //    puts("audio buffer underflow!");
-            //}
-        }
+    size_t const read  = read_pos.load(std::memory_order_relaxed);
+    size_t const avail = write_pos.load(std::memory_order_acquire) - read;
+    size_t const n     = min(len, avail);
+
+    //* Copy the samples, in two goes if they wrap around the end of the buffer
+    size_t const i = buf_index(read);
+    size_t const contig = min(n, ARRAY_LEN(buf) - i);
+    memcpy(dst, buf + i, sizeof(*buf)*contig);
+    memcpy(dst + contig, buf, sizeof(*buf)*(n - contig));
+
+    if (n < len) {
+        //* Underrun. Zero-fill the rest of the output buffer, as required by
+        //* SDL2.
+        memset(dst + n, 0, sizeof(*buf)*(len - n));
+        ++underruns;
     }
+
+    read_pos.store(read + n, std::memory_order_release);
+}
+
+size_t samples_avail() {
+    return write_pos.load(std::memory_order_acquire) -
+           read_pos.load(std::memory_order_acquire);
 }
 
 //* Writes up to 'len' samples from 'src' to the ring buffer. In case of
-//* overflow, writes as many samples as possible and returns 'false'.
+//* overrun, writes as many samples as possible and drops the rest.
 static void write_samples(int16_t const *src, size_t len) {
-    //* Copy samples from 'src' to the ring buffer by memcpy()ing contiguous
-    //* segments
-
-    //* How many contiguous bytes are available...?
+    size_t const write = write_pos.load(std::memory_order_relaxed);
+    size_t const space = ARRAY_LEN(buf) -
+                         (write - read_pos.load(std::memory_order_acquire));
+    size_t const n     = min(len, space);
 
-    size_t contig_avail;
-    if (start_index < end_index || (start_index == end_index && prev_op_was_read))
-        contig_avail = ARRAY_LEN(buf) - end_index;
-    else
-        contig_avail = start_index - end_index;
+    size_t const i = buf_index(write);
+    size_t const contig = min(n, ARRAY_LEN(buf) - i);
+    memcpy(buf + i, src, sizeof(*buf)*contig);
+    memcpy(buf, src + contig, sizeof(*buf)*(n - contig));
 
-    prev_op_was_read = false;
+    if (n < len)
+        ++overruns;
 
-    if (contig_avail >= len) {
-        //* ...as many as we need. Copy it all in one go.
-        memcpy(buf + end_index, src, sizeof(*buf)*len);
-        end_index = (end_index + len) % ARRAY_LEN(buf);
-    }
-    else {
-        //* ...less than we need. Fill the contiguous segment first.
-        memcpy(buf + end_index, src, sizeof(*buf)*contig_avail);
-        len -= contig_avail;
-        assert(len > 0);
-        //* Move past the contiguous segment - possibly to index 0
-        end_index = (end_index + contig_avail) % ARRAY_LEN(buf);
-        assert(end_index <= start_index);
-        //* How many contiguous bytes are available now...?
-        size_t const avail = start_index - end_index;
-        if (avail >= len) {
-            //* ...as many as we need. Copy the rest.
-            memcpy(buf + end_index, src + contig_avail, sizeof(*buf)*len);
-            end_index += len;
-            assert(end_index <= start_index);
-        }
-        else {
-            //* ...less than we need. Copy as much as we can and drop the
-            //* rest.
-            memcpy(buf + end_index, src + contig_avail, sizeof(*buf)*avail);
-            assert(end_index + avail == start_index);
-            end_index = start_index;
-            //if (!bRunTests && bExtraVerbose){
-            //    puts("audio buffer overflow!");
-            //}
-            
-        }
-    }
+    write_pos.store(write + n, std::memory_order_release);
 }
 
+unsigned long audio_underruns() { return underruns; }
+unsigned long audio_overruns()  { return overruns; }
+
 //* Returns the fill level of the ring buffer as a double in the range 0.0-1.0.
 static double fill_level() {
-    double const data_len = (end_index - start_index) % ARRAY_LEN(buf);
-    return data_len/ARRAY_LEN(buf);
+    return double(samples_avail())/ARRAY_LEN(buf);
+}
+
+bool audio_running_behind() {
+    //* Half the target fill level (see max_adjust), so that the slight
+    //* variations from rate control don't trigger it
+    return playback_started && fill_level() < 0.25;
+}
+
+//* Signal level changes are queued up and passed to blip_buf in batches, which
+//* saves some overhead per change
+static CONSOLE_LOCAL unsigned delta_times[1024];
+static CONSOLE_LOCAL int      deltas[ARRAY_LEN(delta_times)];
+static CONSOLE_LOCAL unsigned n_deltas;
+
+static void flush_deltas() {
+    //* bAccurateAudio selects band-limited synthesis. It sounds slightly
+    //* better, but is slower.
+    blip_add_deltas(blip, delta_times, deltas, n_deltas, !bAccurateAudio);
+    n_deltas = 0;
 }
 
-void set_audio_signal_level(int16_t level) {
+void set_audio_signal_level(unsigned time, int16_t level) {
     //TODO: Do something to reduce the initial pop here?
-    static int16_t previous_signal_level = 0;
-    unsigned time  = frame_offset;
+    static CONSOLE_LOCAL int16_t previous_signal_level = 0;
     int delta      = level - previous_signal_level;
 
-    //* Stil need to decide which is best to use.
-    #ifdef USE_BLIP_ADD_DELTA_FAST
-        blip_add_delta_fast(blip, time, delta);
-    #else
-        blip_add_delta(blip, time, delta);
-    #endif
+    if (delta != 0) {
+        if (n_deltas == ARRAY_LEN(deltas))
+            flush_deltas();
+        delta_times[n_deltas] = time;
+        deltas[n_deltas++]    = delta;
+    }
 
     previous_signal_level = level;
 }
 
-void end_audio_frame() {
+void end_audio_frame(unsigned frame_len) {
 
-    if (frame_offset == 0){
+    if (frame_len == 0){
         //* No audio added; blip_end_frame() dislikes being called with an* offset of 0.
         return;
     }
 
     //* Bring the signal level at the end of the frame to zero as outlined in set_audio_signal_level()
-    set_audio_signal_level(0);
-    blip_end_frame(blip, frame_offset);
+    set_audio_signal_level(frame_len, 0);
+    flush_deltas();
+    blip_end_frame(blip, frame_len);
 
     if (playback_started) {
 
@@ -195,19 +185,24 @@ void end_audio_frame() {
         blip_clear(blip);
     }
 
-    //* Save the samples to the audio ring buffer
-    //TODO: test not locking audio. could be faster?
-    //lock_audio();
+    //* Save the samples to the audio ring buffer. No locking needed - see
+    //* read_pos and write_pos.
     write_samples(blip_samples, n_samples);
-    //unlock_audio();
 }
 
 void init_audio_for_rom() {
     //* Maximum number of unread samples the buffer can hold
     blip = blip_new(sample_rate/10);
     blip_set_rates(blip, cpu_clock_rate, sample_rate);
+    n_deltas = 0;
+
+    underruns = overruns = 0;
 }
 
 void deinit_audio_for_rom() {
     blip_delete(blip);
+
+    if (bVerbose)
+        printf("audio buffer: %lu underruns, %lu overruns\n",
+               audio_underruns(), audio_overruns());
 }
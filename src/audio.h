@@ -3,11 +3,25 @@
 void init_audio_for_rom();
 void deinit_audio_for_rom();
 
-//* Sets the instantaneous signal level
-void set_audio_signal_level(int16_t level);
-//* Resamples and buffers the audio generated during one (video) frame
-void end_audio_frame();
+//* Sets the instantaneous signal level from 'time' on, in CPU cycles since the
+//* start of the frame. Calls must be made in time order.
+void set_audio_signal_level(unsigned time, int16_t level);
+//* Resamples and buffers the audio generated during one (video) frame, which
+//* was 'frame_len' CPU cycles long
+void end_audio_frame(unsigned frame_len);
 //* Moves up to 'len' samples from the audio buffer to 'dst'. In case of
-//* underflow, moves all remaining samples and zeroes the remainder of 'dst' (as
-//* required by SDL2).
+//* underrun, moves all remaining samples and zeroes the remainder of 'dst' (as
+//* required by SDL2). Safe to call from the audio thread without locking.
 void read_samples(int16_t *dst, size_t len);
+//* Number of samples in the audio buffer
+size_t samples_avail();
+//* True if playback has started and the audio buffer is getting close to
+//* running out, meaning emulation isn't keeping up. Used for automatic frame
+//* skipping.
+bool audio_running_behind();
+
+//* Number of times since the ROM was loaded that read_samples() ran out of
+//* samples (underrun) and that samples had to be dropped because the buffer
+//* was full (overrun). Can be called from any thread.
+unsigned long audio_underruns();
+unsigned long audio_overruns();
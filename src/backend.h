@@ -0,0 +1,50 @@
+#pragma once
+
+//* Interface between the emulation core and the frontend. The core (CPU, PPU,
+//* APU, mappers, audio buffering, tests) only talks to the outside world
+//* through the functions and flags declared here. They are implemented by
+//* sdl_backend.cpp for the normal build and by headless_backend.cpp for the
+//* display-free build.
+
+//* Configuration flags, set from the command line
+extern bool bVerbose;
+extern bool bExtraVerbose;
+
+extern bool bRunTests;
+extern bool bForcePAL;
+extern bool bForceNTSC;
+//* Run the APU channel synthesis on a separate thread (see apu_synth.h)
+extern bool bAPUThread;
+//* Use band-limited audio synthesis (blip_add_delta()) instead of the faster
+//* blip_add_delta_fast()
+extern bool bAccurateAudio;
+
+int const sample_rate = 44100;
+
+//* Video output. The PPU writes pixels to output_frame (see video.h), which
+//* the frontend must set up.
+
+//* Called at the end of each frame, once all pixels of output_frame have been
+//* written
+void draw_frame();
+
+//* Protect the audio buffer from concurrent access by the emulation thread and
+//* the audio output
+void lock_audio();
+void unlock_audio();
+
+//* Stop and start audio playback
+void start_audio_playback();
+void stop_audio_playback();
+
+//* Frontend hooks called from the emulation thread
+
+//* Called repeatedly while emulation is paused (running_state is false)
+void frontend_idle();
+//* Stops emulation and hands control back to the frontend. Used when the CPU
+//* hangs and when testing ends.
+void frontend_stop_emulation();
+//* Shows a short status message to the user
+void frontend_show_message(string const &msg);
+//* Called once the whole test list has been run
+void frontend_tests_finished();
@@ -0,0 +1,229 @@
+#include "common.h"
+
+#include "backend.h"
+#include "benchmark.h"
+#include "blip_buf.h"
+#include "timing.h"
+
+#include <sys/time.h>
+
+#ifdef BENCHMARK
+
+Bench_component volatile bench_component;
+
+//* Number of profiling timer samples that landed in each component
+static unsigned long volatile samples[N_BENCH_COMPONENTS];
+
+static char const *const component_names[N_BENCH_COMPONENTS] = {
+    "CPU", "PPU", "APU", "Mapper", "Audio", "Frontend", "Rewind", "Run-ahead" };
+
+//* Sample every millisecond of CPU time. The kernel might round this up to its
+//* tick length, which is fine for runs of a few seconds or more.
+static long const sample_interval_us = 1000;
+
+static void sigprof_handler(int) {
+    ++samples[bench_component];
+}
+
+static void set_profiling_timer(long interval_us) {
+    itimerval timer;
+    timer.it_interval.tv_sec  = timer.it_value.tv_sec  = 0;
+    timer.it_interval.tv_usec = timer.it_value.tv_usec = interval_us;
+    if(setitimer(ITIMER_PROF, &timer, 0) == -1) {
+        puts("failed to set up the profiling timer");
+        exit(1);
+    }
+}
+
+void start_benchmark_profiling() {
+    for (unsigned i = 0; i < N_BENCH_COMPONENTS; ++i)
+        samples[i] = 0;
+    bench_component = BENCH_CPU;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sigprof_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPROF, &sa, 0) == -1) {
+        puts("failed to install the SIGPROF handler");
+        exit(1);
+    }
+
+    set_profiling_timer(sample_interval_us);
+}
+
+void stop_benchmark_profiling() {
+    set_profiling_timer(0);
+}
+
+#else
+
+void start_benchmark_profiling() {}
+void stop_benchmark_profiling() {}
+
+#endif
+
+void print_benchmark_report(unsigned long shown_frames, unsigned long frames,
+                            uint64_t cpu_cycles, uint64_t instructions,
+                            uint64_t elapsed_ns) {
+    double const secs = elapsed_ns/1e9;
+    double const fps  = secs > 0 ? frames/secs : 0.0;
+
+    printf("Emulated %lu frames (%" PRIu64 " CPU cycles) in %.3f secs\n",
+           frames, cpu_cycles, secs);
+    if (shown_frames == frames)
+        printf("  %.1f frames/sec (%.2fx real time)\n", fps, fps/ppu_fps);
+    else {
+        //* Run-ahead. How fast the game runs depends on the frames shown.
+        double const shown_fps = secs > 0 ? shown_frames/secs : 0.0;
+        printf("  %.1f frames/sec emulated, %.1f shown (%.2fx real time)\n",
+               fps, shown_fps, shown_fps/ppu_fps);
+    }
+#ifdef BENCHMARK
+    printf("  %.2f million instructions/sec\n",
+           secs > 0 ? instructions/secs/1e6 : 0.0);
+#endif
+    printf("  %.2f host ns per emulated CPU cycle\n",
+           cpu_cycles ? (double)elapsed_ns/cpu_cycles : 0.0);
+
+#ifdef BENCHMARK
+    unsigned long total = 0;
+    for (unsigned i = 0; i < N_BENCH_COMPONENTS; ++i)
+        total += samples[i];
+
+    if (total == 0) {
+        puts("  No profiling samples - run for longer to get a time split");
+        return;
+    }
+
+    printf("  Time split (%lu samples):\n", total);
+    for (unsigned i = 0; i < N_BENCH_COMPONENTS; ++i)
+        printf("    %-9s %5.1f%%\n", component_names[i], 100.0*samples[i]/total);
+#else
+    puts("  (Build with 'make benchmark' for a per-component time split)");
+#endif
+}
+
+void print_idle_cycles_report(uint64_t cycles, uint64_t events,
+                              uint64_t elapsed_ns) {
+    printf("Ran %" PRIu64 " CPU cycles without executing instructions in %.3f secs\n",
+           cycles, elapsed_ns/1e9);
+    printf("  %.2f host ns per cycle (PPU with rendering off, APU, event scheduling)\n",
+           cycles ? (double)elapsed_ns/cycles : 0.0);
+    printf("  %" PRIu64 " events dispatched (one per %.0f cycles)\n",
+           events, events ? (double)cycles/events : 0.0);
+}
+
+//*
+//* Audio microbenchmark
+//*
+
+//* Signal level changes per frame. Games with busy audio get close to this.
+static unsigned const audio_bench_changes_per_frame = 2000;
+//* NTSC frame length in CPU cycles, and CPU clock rate
+static unsigned const audio_bench_frame_len = 29781;
+static double const audio_bench_clock_rate = 21477272.0/12.0;
+
+enum Blip_variant {
+    BLIP_SCALAR = 0,      //* blip_add_delta_scalar()
+    BLIP_ACCURATE,        //* blip_add_delta(), SIMD if available
+    BLIP_FAST,            //* blip_add_delta_fast()
+    BLIP_ACCURATE_BATCHED,
+    BLIP_FAST_BATCHED,
+    N_BLIP_VARIANTS
+};
+
+void run_audio_benchmark(unsigned long changes) {
+    static char const *const variant_names[N_BLIP_VARIANTS] = {
+      "blip_add_delta_scalar()", "blip_add_delta()", "blip_add_delta_fast()",
+      "blip_add_deltas()", "blip_add_deltas(fast)" };
+
+    //* One frame's worth of pseudo-random signal changes, reused for each
+    //* frame
+    static unsigned times[audio_bench_changes_per_frame];
+    static int      deltas[audio_bench_changes_per_frame];
+    uint32_t rand_state = 1;
+    for (unsigned i = 0; i < audio_bench_changes_per_frame; ++i) {
+        rand_state = 1664525*rand_state + 1013904223;
+        times[i]  = (uint64_t)i*audio_bench_frame_len/audio_bench_changes_per_frame;
+        deltas[i] = (int)(rand_state >> 20) - 2048;
+    }
+
+    unsigned long const frames =
+      max(changes/audio_bench_changes_per_frame, 1ul);
+
+    printf("Resampled %lu frames of %u signal changes with each blip_buf variant\n",
+           frames, audio_bench_changes_per_frame);
+
+    static int16_t samples[blip_max_frame];
+    uint64_t hashes[N_BLIP_VARIANTS];
+    uint64_t read_ns = 0;
+
+    for (unsigned variant = 0; variant < N_BLIP_VARIANTS; ++variant) {
+        blip_t *const blip = blip_new(sample_rate/10);
+        if (!blip) {
+            puts("failed to allocate blip_buf buffer");
+            exit(1);
+        }
+        blip_set_rates(blip, audio_bench_clock_rate, sample_rate);
+
+        //* FNV-1a hash of the output, to check that the variants that should
+        //* agree do
+        uint64_t hash = 14695981039346656037ULL;
+        uint64_t add_ns = 0;
+
+        for (unsigned long frame = 0; frame < frames; ++frame) {
+            uint64_t const start = get_host_time_ns();
+            switch (variant) {
+            case BLIP_SCALAR:
+                for (unsigned i = 0; i < audio_bench_changes_per_frame; ++i)
+                    blip_add_delta_scalar(blip, times[i], deltas[i]);
+                break;
+
+            case BLIP_ACCURATE:
+                for (unsigned i = 0; i < audio_bench_changes_per_frame; ++i)
+                    blip_add_delta(blip, times[i], deltas[i]);
+                break;
+
+            case BLIP_FAST:
+                for (unsigned i = 0; i < audio_bench_changes_per_frame; ++i)
+                    blip_add_delta_fast(blip, times[i], deltas[i]);
+                break;
+
+            case BLIP_ACCURATE_BATCHED:
+            case BLIP_FAST_BATCHED:
+                blip_add_deltas(blip, times, deltas,
+                                audio_bench_changes_per_frame,
+                                variant == BLIP_FAST_BATCHED);
+                break;
+            }
+            uint64_t const added = get_host_time_ns();
+
+            blip_end_frame(blip, audio_bench_frame_len);
+            int const n = blip_read_samples(blip, samples, ARRAY_LEN(samples), 0);
+            read_ns += get_host_time_ns() - added;
+            add_ns  += added - start;
+
+            for (int i = 0; i < n; ++i) {
+                hash = (hash ^ (uint16_t)samples[i])*1099511628211ULL;
+            }
+        }
+
+        blip_delete(blip);
+        hashes[variant] = hash;
+
+        printf("  %-24s %6.2f host ns per signal change\n", variant_names[variant],
+               (double)add_ns/(frames*audio_bench_changes_per_frame));
+    }
+
+    printf("  blip_read_samples()      %6.2f host ns per output sample\n",
+           (double)read_ns/(N_BLIP_VARIANTS*frames*
+                           (sample_rate*audio_bench_frame_len/audio_bench_clock_rate)));
+
+    bool const accurate_ok = hashes[BLIP_ACCURATE] == hashes[BLIP_SCALAR] &&
+                             hashes[BLIP_ACCURATE_BATCHED] == hashes[BLIP_SCALAR];
+    bool const fast_ok     = hashes[BLIP_FAST_BATCHED] == hashes[BLIP_FAST];
+    printf("  Output of the SIMD and batched variants %s\n",
+           accurate_ok && fast_ok ? "matches" : "DOES NOT MATCH");
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+//* Benchmark support ('make benchmark'). When the core is compiled with
+//* BENCHMARK defined, it tags the code that is running with the component it
+//* belongs to, and a profiling timer samples the tag to estimate how the time
+//* is split between components. Without BENCHMARK, the tagging compiles to
+//* nothing and only the overall speed is reported.
+
+enum Bench_component {
+    BENCH_CPU = 0,   //* The dispatch loop in run() and everything not tagged
+    BENCH_PPU,
+    BENCH_APU,
+    BENCH_MAPPER,    //* Mapper callbacks (register writes, PPU snooping, etc.)
+    BENCH_AUDIO,     //* Resampling and buffering at the end of each frame
+    BENCH_FRONTEND,
+    BENCH_REWIND,    //* Recording and loading rewind snapshots
+    BENCH_RUN_AHEAD, //* Saving and loading run-ahead snapshots
+    N_BENCH_COMPONENTS
+};
+
+#ifdef BENCHMARK
+
+//* The component currently running. Read from the SIGPROF handler.
+extern Bench_component volatile bench_component;
+
+//* Tags the rest of the enclosing scope with 'component', restoring the
+//* previous tag when the scope is left. This handles nesting, e.g. mapper
+//* callbacks made from within the PPU.
+struct Bench_scope {
+    Bench_component const prev;
+    Bench_scope(Bench_component component) : prev(bench_component) {
+        bench_component = component;
+    }
+    ~Bench_scope() { bench_component = prev; }
+};
+
+#  define BENCH_SCOPE(component) Bench_scope const bench_scope_(component)
+
+#else
+
+#  define BENCH_SCOPE(component)
+
+#endif
+
+//* Starts and stops the profiling timer. No-ops without BENCHMARK.
+void start_benchmark_profiling();
+void stop_benchmark_profiling();
+
+//* Prints frames/sec, host time per emulated CPU cycle and (with BENCHMARK)
+//* instructions/sec and the time split between components. 'shown_frames' can
+//* be less than 'frames' with run-ahead. 'cpu_cycles' covers all of 'frames'.
+//* 'instructions' is ignored without BENCHMARK.
+void print_benchmark_report(unsigned long shown_frames, unsigned long frames,
+                            uint64_t cpu_cycles, uint64_t instructions,
+                            uint64_t elapsed_ns);
+
+//* Prints the results of a run_idle_cycles() microbenchmark. 'events' is the
+//* number of scheduled events that were dispatched (see scheduler.h).
+void print_idle_cycles_report(uint64_t cycles, uint64_t events,
+                              uint64_t elapsed_ns);
+
+//* Microbenchmark for blip_buf: times adding 'changes' pseudo-random signal
+//* changes with each variant of the delta insertion (scalar, SIMD, fast,
+//* batched) and reading out the samples, and checks that the variants that
+//* should produce identical output do
+void run_audio_benchmark(unsigned long changes);
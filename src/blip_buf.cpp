@@ -7,6 +7,20 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* The band-limited step is added with SIMD where available. See add_step().
+Without optimization the intrinsics aren't inlined or kept in registers, and
+the SIMD step ends up slower than the scalar one, so unoptimized (debug) builds
+use the scalar step. */
+#if !defined(__OPTIMIZE__)
+	/* Scalar */
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+	#define BLIP_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define BLIP_NEON 1
+#endif
+
 /* Library Copyright (C) 2003-2009 Shay Green. This library is free software;
 you can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -109,6 +123,8 @@ static void check_assumptions( void )
 	assert( blip_max_frame <= (fixed_t) -1 >> time_bits );
 }
 
+static void init_step_pairs( void );
+
 blip_t* blip_new( int size )
 {
 	blip_t* m;
@@ -121,6 +137,11 @@ blip_t* blip_new( int size )
 		m->size   = size;
 		blip_clear( m );
 		check_assumptions();
+		{
+			/* Only once, as buffers can be created from several threads */
+			static int const step_pairs_ready = (init_step_pairs(), 1);
+			(void) step_pairs_ready;
+		}
 	}
 	return m;
 }
@@ -289,27 +310,60 @@ static short const bl_step [phase_count + 1] [half_width] =
 {    0,   43, -115,  350, -488, 1136, -914, 5861}
 };
 
+/* The kernel for each phase, rearranged for SIMD. For phase p, output i
+(0-15) gets a[i]*delta + b[i]*delta2 in blip_add_delta(), where a[] is
+bl_step[p] followed by bl_step[phase_count - p] reversed, and b[] likewise for
+the next phase. They're stored interleaved as a[0], b[0], a[1], b[1], ... */
+static short step_pairs [phase_count] [half_width*2*2] __attribute__((aligned(16)));
+
+static void init_step_pairs( void )
+{
+	int phase, i;
+
+	for ( phase = 0; phase < phase_count; ++phase )
+	{
+		short const* in  = bl_step [phase];
+		short const* rev = bl_step [phase_count - phase];
+		short* pairs = step_pairs [phase];
+
+		for ( i = 0; i < half_width; ++i )
+		{
+			pairs [2*i]     = in [i];
+			pairs [2*i + 1] = in [half_width + i];
+
+			pairs [2*(half_width + i)]     = rev [half_width - 1 - i];
+			pairs [2*(half_width + i) + 1] = rev [-1 - i];
+		}
+	}
+}
+
 /* Shifting by pre_shift allows calculation using unsigned int rather than
 possibly-wider fixed_t. On 32-bit platforms, this is likely more efficient.
 And by having pre_shift 32, a 32-bit platform can easily do the shift by
 simply ignoring the low half. */
 
-void blip_add_delta( blip_t* m, unsigned time, int delta )
+static unsigned fixed_time( blip_t const* m, unsigned time )
 {
-	unsigned fixed = (unsigned) ((time * m->factor + m->offset) >> pre_shift);
-	buf_t* out = SAMPLES( m ) + m->avail + (fixed >> frac_bits);
+	return (unsigned) ((time * m->factor + m->offset) >> pre_shift);
+}
 
-	int const phase_shift = frac_bits - phase_bits;
-	int phase = fixed >> phase_shift & (phase_count - 1);
-	short const* in  = bl_step [phase];
-	short const* rev = bl_step [phase_count - phase];
+/* Splits delta between the two nearest phases of the kernel */
+#define SPLIT_DELTA( fixed, delta ) \
+	int const phase_shift = frac_bits - phase_bits;\
+	int phase = fixed >> phase_shift & (phase_count - 1);\
+	int interp = fixed >> (phase_shift - delta_bits) & (delta_unit - 1);\
+	int delta2 = (delta * interp) >> delta_bits;\
+	delta -= delta2
 
-	int interp = fixed >> (phase_shift - delta_bits) & (delta_unit - 1);
-	int delta2 = (delta * interp) >> delta_bits;
-	delta -= delta2;
+static void add_step_scalar( buf_t* out, unsigned fixed, int delta )
+{
+	short const* in;
+	short const* rev;
 
-	/* Fails if buffer size was exceeded */
-	assert( out <= &SAMPLES( m ) [m->size + end_frame_extra] );
+	SPLIT_DELTA( fixed, delta );
+
+	in  = bl_step [phase];
+	rev = bl_step [phase_count - phase];
 
 	out [0] += in[0]*delta + in[half_width+0]*delta2;
 	out [1] += in[1]*delta + in[half_width+1]*delta2;
@@ -331,18 +385,116 @@ void blip_add_delta( blip_t* m, unsigned time, int delta )
 	out [15] += in[0]*delta + in[0-half_width]*delta2;
 }
 
-
-void blip_add_delta_fast( blip_t* m, unsigned time, int delta )
+/* Same result as add_step_scalar() */
+static inline void add_step( buf_t* out, unsigned fixed, int delta )
 {
-	unsigned fixed = (unsigned) ((time * m->factor + m->offset) >> pre_shift);
-	buf_t* out = SAMPLES( m ) + m->avail + (fixed >> frac_bits);
+#if BLIP_SSE2
+	/* SSE2 has no 32-bit multiply, so the kernel (16 bits) is multiplied
+	with delta and delta2 split into a low 15-bit and a high part, two at a
+	time with pmaddwd. Needs |delta| < 2^30, which is far beyond any sample
+	value. */
+	short const* pairs;
+	__m128i lo, hi;
+	int i;
+
+	SPLIT_DELTA( fixed, delta );
+
+	pairs = step_pairs [phase];
+	lo = _mm_set1_epi32( (delta & 0x7FFF) | (delta2 & 0x7FFF) << 16 );
+	hi = _mm_set1_epi32( ((unsigned) (delta >> 15) & 0xFFFF) |
+			(unsigned) (delta2 >> 15) << 16 );
+	for ( i = 0; i < 4; ++i )
+	{
+		__m128i const k = _mm_load_si128( (__m128i const*) pairs + i );
+		__m128i const sum = _mm_add_epi32( _mm_madd_epi16( k, lo ),
+				_mm_slli_epi32( _mm_madd_epi16( k, hi ), 15 ) );
+		__m128i* const o = (__m128i*) out + i;
+		_mm_storeu_si128( o, _mm_add_epi32( _mm_loadu_si128( o ), sum ) );
+	}
+#elif BLIP_NEON
+	short const* pairs;
+	int i;
+
+	SPLIT_DELTA( fixed, delta );
 
+	pairs = step_pairs [phase];
+	for ( i = 0; i < 4; ++i )
+	{
+		int16x4x2_t const k = vld2_s16( pairs + 8*i );
+		int32x4_t sum = vld1q_s32( out + 4*i );
+		sum = vmlaq_n_s32( sum, vmovl_s16( k.val [0] ), delta );
+		sum = vmlaq_n_s32( sum, vmovl_s16( k.val [1] ), delta2 );
+		vst1q_s32( out + 4*i, sum );
+	}
+#else
+	add_step_scalar( out, fixed, delta );
+#endif
+}
+
+static inline void add_step_fast( buf_t* out, unsigned fixed, int delta )
+{
 	int interp = fixed >> (frac_bits - delta_bits) & (delta_unit - 1);
 	int delta2 = delta * interp;
 
+	out [7] += delta * delta_unit - delta2;
+	out [8] += delta2;
+}
+
+void blip_add_delta( blip_t* m, unsigned time, int delta )
+{
+	unsigned fixed = fixed_time( m, time );
+	buf_t* out = SAMPLES( m ) + m->avail + (fixed >> frac_bits);
+
+	/* Fails if buffer size was exceeded */
+	assert( out <= &SAMPLES( m ) [m->size + end_frame_extra] );
+
+	add_step( out, fixed, delta );
+}
+
+void blip_add_delta_scalar( blip_t* m, unsigned time, int delta )
+{
+	unsigned fixed = fixed_time( m, time );
+	buf_t* out = SAMPLES( m ) + m->avail + (fixed >> frac_bits);
+
+	/* Fails if buffer size was exceeded */
+	assert( out <= &SAMPLES( m ) [m->size + end_frame_extra] );
+
+	add_step_scalar( out, fixed, delta );
+}
+
+void blip_add_delta_fast( blip_t* m, unsigned time, int delta )
+{
+	unsigned fixed = fixed_time( m, time );
+	buf_t* out = SAMPLES( m ) + m->avail + (fixed >> frac_bits);
+
 	//* Fails if buffer size was exceeded
 	assert( out <= &SAMPLES( m ) [m->size + end_frame_extra] );
 
-	out [7] += delta * delta_unit - delta2;
-	out [8] += delta2;
+	add_step_fast( out, fixed, delta );
+}
+
+void blip_add_deltas( blip_t* m, unsigned const clock_times [],
+		int const deltas [], int count, int fast )
+{
+	buf_t* const buf = SAMPLES( m ) + m->avail;
+	int i;
+
+	if ( fast )
+	{
+		for ( i = 0; i < count; ++i )
+		{
+			unsigned fixed = fixed_time( m, clock_times [i] );
+			assert( buf + (fixed >> frac_bits) <= &SAMPLES( m ) [m->size + end_frame_extra] );
+			add_step_fast( buf + (fixed >> frac_bits), fixed, deltas [i] );
+		}
+	}
+	else
+	{
+		for ( i = 0; i < count; ++i )
+		{
+			unsigned fixed = fixed_time( m, clock_times [i] );
+			assert( buf + (fixed >> frac_bits) <= &SAMPLES( m ) [m->size + end_frame_extra] );
+			add_step( buf + (fixed >> frac_bits), fixed, deltas [i] );
+		}
+	}
 }
@@ -35,6 +35,15 @@ void blip_add_delta( blip_t*, unsigned int clock_time, int delta );
 /** Same as blip_add_delta(), but uses faster, lower-quality synthesis. */
 void blip_add_delta_fast( blip_t*, unsigned int clock_time, int delta );
 
+/** Same as calling blip_add_delta() (or blip_add_delta_fast() if 'fast' is
+true) for each of the 'count' deltas in turn, with less overhead per delta. */
+void blip_add_deltas( blip_t*, unsigned int const clock_times [],
+		int const deltas [], int count, int fast );
+
+/** Same as blip_add_delta(), but never uses SIMD. For checking and
+benchmarking the SIMD version. */
+void blip_add_delta_scalar( blip_t*, unsigned int clock_time, int delta );
+
 /** Length of time frame, in clocks, needed to make sample_count additional
 samples available. */
 int blip_clocks_needed( const blip_t*, int sample_count );
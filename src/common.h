@@ -98,7 +98,7 @@ T *alloc_array_init(size_t size, T const&val) {
 //* Frees a pointer and sets it to null, making null equivalent to not
 //* allocated, memory errors easier to debug, and the pointer safe to re-free
 template<typename T>
-void free_array_set_null(T *p) {
+void free_array_set_null(T *&p) {
     delete [] p;
     p = 0;
 }
@@ -111,6 +111,17 @@ void free_array_set_null(T *p) {
 //           __FILE__, (unsigned)__LINE__);
 //#endif
 
+//* Marks the state of the emulated console. It is thread-local in builds with
+//* MULTI_CONSOLE ('make headless MULTI=1'), so that each thread runs its own
+//* console (see console.h), and plain global otherwise. Configuration set from
+//* the command line and tables that are only written during initialization
+//* stay shared.
+#ifdef MULTI_CONSOLE
+#  define CONSOLE_LOCAL __thread
+#else
+#  define CONSOLE_LOCAL
+#endif
+
 //* State serialization and deserialization helpers
 
 //* Saves a variable to or loads a variable from a buffer, incrementing the
@@ -0,0 +1,222 @@
+#include "common.h"
+
+#include "cpu.h"
+#include "input.h"
+#include "mapper.h"
+#include "rom.h"
+#include "save_states.h"
+#include "timing.h"
+#include "backend.h"
+#include "console.h"
+#include "headless_backend.h"
+
+//* The Console whose thread this is
+static CONSOLE_LOCAL Console *cur_console;
+
+Console::Console()
+  : busy(true), stopping(false),
+    power_on(false), in_run(false), unload_after_run(false) {
+
+    thread = std::thread(&Console::thread_main, this);
+    wait();
+}
+
+Console::~Console() {
+    unload_rom();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void Console::post(std::function<void()> const &fn) {
+    wait();
+    std::lock_guard<std::mutex> lock(mutex);
+    job  = fn;
+    busy = true;
+    cond.notify_all();
+}
+
+void Console::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return !busy; });
+}
+
+void Console::call(std::function<void()> const &fn) {
+    post(fn);
+    wait();
+}
+
+//* Called on the console's thread whenever it is paused. Returns the next job,
+//* or an empty function if the thread should exit.
+std::function<void()> Console::take_job() {
+    std::unique_lock<std::mutex> lock(mutex);
+    busy = false;
+    cond.notify_all();
+    cond.wait(lock, [this] { return job || stopping; });
+    std::function<void()> fn;
+    fn.swap(job);
+    return fn;
+}
+
+void Console::thread_main() {
+    cur_console = this;
+    init_headless_console(idle);
+
+    for (;;) {
+        std::function<void()> const fn = take_job();
+        if (!fn)
+            return;
+        fn();
+
+        if (power_on) {
+            power_on = false;
+            //* Returns once unload_rom() ends emulation, or when emulation
+            //* ends by itself. Jobs are run from idle() in the meantime.
+            in_run = true;
+            run();
+            in_run = false;
+            if (unload_after_run) {
+                unload_after_run = false;
+                ::unload_rom();
+            }
+        }
+    }
+}
+
+//* Called from frontend_idle() while emulation is paused
+void Console::idle() {
+    std::function<void()> const fn = cur_console->take_job();
+    if (fn)
+        fn();
+}
+
+bool Console::load_rom(char const *filename) {
+    unload_rom();
+
+    bool loaded;
+    call([&] {
+        if ((loaded = ::load_rom(filename))) {
+            headless_frames_run  = 0;
+            headless_pause_frame = 0;
+            //* run() pauses right away
+            running_state = false;
+            power_on = true;
+        }
+    });
+    return loaded;
+}
+
+void Console::unload_rom() {
+    call([this] {
+        if (in_run) {
+            //* The ROM is unloaded once run() returns
+            end_emulation();
+            running_state = true;
+            unload_after_run = true;
+        }
+        else if (is_rom_loaded())
+            ::unload_rom();
+    });
+}
+
+void Console::run_frames(unsigned long frames) {
+    post([this, frames] {
+        if (in_run && frames != 0) {
+            headless_pause_frame = headless_frames_run + frames;
+            running_state = true;
+        }
+    });
+}
+
+unsigned long Console::frames_run() {
+    unsigned long frames;
+    call([&] { frames = headless_frames_run; });
+    return frames;
+}
+
+void Console::set_button(unsigned n, unsigned button, bool pushed) {
+    call([=] {
+        if (pushed)
+            set_button_state(n, button);
+        else
+            clear_button_state(n, button);
+    });
+}
+
+void Console::get_frame(uint32_t *dst) {
+    call([=] { memcpy(dst, headless_frame_buffer(), 4*256*240); });
+}
+
+size_t Console::state_size() {
+    size_t size;
+    call([&] { size = get_state_size(); });
+    return size;
+}
+
+void Console::save_state(uint8_t *buf) {
+    call([=] { save_state_to(buf); });
+}
+
+void Console::load_state(uint8_t *buf) {
+    call([=] { load_state_from(buf); });
+}
+
+bool run_headless_consoles(char const *rom_file, unsigned n) {
+    Console *const consoles = new Console[n];
+
+    for (unsigned i = 0; i < n; ++i)
+        if (!consoles[i].load_rom(rom_file)) {
+            delete [] consoles;
+            return false;
+        }
+
+    uint64_t const start_time = get_host_time_ns();
+    for (unsigned i = 0; i < n; ++i)
+        consoles[i].run_frames(headless_frame_limit);
+    for (unsigned i = 0; i < n; ++i)
+        consoles[i].wait();
+    uint64_t const elapsed = get_host_time_ns() - start_time;
+
+    unsigned long total_frames = 0;
+    for (unsigned i = 0; i < n; ++i)
+        total_frames += consoles[i].frames_run();
+    double const secs = elapsed/1e9;
+    printf("Emulated %lu frames on %u consoles in %.3f secs (%.1f FPS in total).\n",
+           total_frames, n, secs, secs > 0 ? total_frames/secs : 0.0);
+
+    //* Same ROM and same input, so the consoles should all end up with the same
+    //* state and picture. Anything else means some state is shared.
+    size_t const size = consoles[0].state_size();
+    uint8_t  *const first_state = new uint8_t[size];
+    uint8_t  *const state       = new uint8_t[size];
+    uint32_t *const first_frame = new uint32_t[256*240];
+    uint32_t *const frame       = new uint32_t[256*240];
+    consoles[0].save_state(first_state);
+    consoles[0].get_frame(first_frame);
+
+    unsigned n_differing = 0;
+    for (unsigned i = 1; i < n; ++i) {
+        consoles[i].save_state(state);
+        consoles[i].get_frame(frame);
+        if (memcmp(state, first_state, size) ||
+            memcmp(frame, first_frame, 4*256*240))
+            ++n_differing;
+    }
+
+    if (n_differing == 0)
+        puts("All consoles ended up in the same state.");
+    else
+        printf("%u of %u consoles ended up in a different state than the first!\n",
+               n_differing, n);
+
+    delete [] frame;
+    delete [] first_frame;
+    delete [] state;
+    delete [] first_state;
+    delete [] consoles;
+
+    return n_differing == 0;
+}
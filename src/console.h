@@ -0,0 +1,82 @@
+#pragma once
+
+//* Several independent consoles in one process, each running on its own thread
+//*
+//* Only available in the MULTI_CONSOLE build ('make headless MULTI=1'), where
+//* all emulator state is thread-local (see CONSOLE_LOCAL in common.h). A
+//* console is then just a thread, and a Console owns one and does everything
+//* for the console on it. Consoles share the configuration flags (see
+//* backend.h) and the tables set up by init_apu() and init_mappers(), which
+//* must have been called first.
+//*
+//* A console only runs during run_frames() and is paused otherwise. The other
+//* functions wait for it to pause and then act on it from its thread, like the
+//* GUI does while paused in the SDL build. Each Console should only be used
+//* from one thread at a time.
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class Console {
+public:
+    Console();
+    //* Unloads the ROM, if any, and stops the thread
+    ~Console();
+
+    //* Loads a ROM and powers on. The console starts out paused before the
+    //* first instruction. Returns false if the ROM couldn't be loaded.
+    bool load_rom(char const *filename);
+    void unload_rom();
+
+    //* Starts running 'frames' frames and returns right away, so that several
+    //* consoles can run at once. Use wait() to wait for them to finish.
+    void run_frames(unsigned long frames);
+    //* Waits until the console is paused
+    void wait();
+
+    //* Frames run since the ROM was loaded. Stops increasing if emulation ends
+    //* by itself (the CPU hangs or a test ROM finishes).
+    unsigned long frames_run();
+
+    void set_button(unsigned n, unsigned button, bool pushed);
+
+    //* The last completed frame as 256x240 RGB pixels
+    void get_frame(uint32_t *dst);
+
+    //* In-memory save states (see save_states.h)
+    size_t state_size();
+    void save_state(uint8_t *buf);
+    void load_state(uint8_t *buf);
+
+    //* Runs 'fn' on the console's thread while it is paused and waits for it
+    //* to return. The console's state is seen through the usual globals.
+    void call(std::function<void()> const &fn);
+
+private:
+    void post(std::function<void()> const &fn);
+    std::function<void()> take_job();
+    void thread_main();
+    static void idle();
+
+    std::thread             thread;
+    std::mutex              mutex;
+    std::condition_variable cond;
+    //* Next function to run on the console's thread
+    std::function<void()>   job;
+    //* True from when a job is posted until the console is paused again
+    bool                    busy;
+    bool                    stopping;
+
+    //* Only accessed from the console's thread
+    bool                    power_on;
+    bool                    in_run;
+    bool                    unload_after_run;
+};
+
+//* Runs 'rom_file' on 'n' consoles at once for headless_frame_limit frames
+//* (scripted input with headless_benchmark), reports the combined speed, and
+//* checks that all consoles end up in the same state. Returns false if they
+//* don't or if the ROM can't be loaded.
+bool run_headless_consoles(char const *rom_file, unsigned n);
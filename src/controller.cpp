@@ -4,11 +4,11 @@
 #include "cpu.h"
 #include "input.h"
 
-static uint8_t controller_bits[2];
+static CONSOLE_LOCAL uint8_t controller_bits[2];
 
 //* Set by writing $4016:0. When enabled, the shift registers in the controllers
 //* are initialized from the buttons (level triggered).
-static bool strobe_latch;
+static CONSOLE_LOCAL bool strobe_latch;
 
 uint8_t read_controller(unsigned n) {
     //* Results for standard controller:
@@ -8,18 +8,20 @@
 
 #include "apu.h"
 #include "audio.h"
+#include "benchmark.h"
 #include "controller.h"
 #include "cpu.h"
 #include "input.h"
 #include "mapper.h"
+#include "movie.h"
 #include "opcodes.h"
 #include "ppu.h"
 #include "rom.h"
 #include "save_states.h"
+#include "scheduler.h"
 #include "timing.h"
 #include "test.h"
-#include "sdl_backend.h"
-#include "sdl_frontend.h"
+#include "backend.h"
 
 //*
 //* Event signaling
@@ -29,12 +31,12 @@
 //* Avoids having to check them all for each instruction. This includes
 //* interrupts, end-of-frame operations, state transfers, (soft) reset, and
 //* shutdown.
-static bool pending_event;
+static CONSOLE_LOCAL bool pending_event;
 
-static bool pending_end_emulation;
-static bool pending_frame_completion;
-static bool pending_reset;
-bool running_state = false;
+static CONSOLE_LOCAL bool pending_end_emulation;
+static CONSOLE_LOCAL bool pending_frame_completion;
+static CONSOLE_LOCAL bool pending_reset;
+CONSOLE_LOCAL bool running_state = false;
 
 void end_emulation() { pending_event = pending_end_emulation = true; }
 void frame_completed() { pending_event = pending_frame_completion = true; }
@@ -42,22 +44,22 @@ void soft_reset() { pending_event = pending_reset = true; }
 
 //* Set true if interrupt polling detects a pending IRQ or NMI. The next
 //* "instruction" executed is the interrupt sequence.
-static bool pending_irq;
-static bool pending_nmi;
+static CONSOLE_LOCAL bool pending_irq;
+static CONSOLE_LOCAL bool pending_nmi;
 
 //*
 //* RAM, registers, status flags, and misc. state
 //*
 
-static uint8_t ram[0x800];
+static CONSOLE_LOCAL uint8_t ram[0x800];
 
 //* Possible optimization: Making some of the variables a natural size for the
 //* implementation architecture might be faster. CPU emulation is already
 //* relatively speedy though, and we wouldn't get automatic wrapping.
 
 //* Registers
-static uint16_t pc;
-static uint8_t a, s, x, y;
+static CONSOLE_LOCAL uint16_t pc;
+static CONSOLE_LOCAL uint8_t a, s, x, y;
 
 //* Status flags
 
@@ -70,66 +72,113 @@ static uint8_t a, s, x, y;
 //* Having zn & 0x100 also indicate that the negative flag is set allows the two
 //* flags to be set separately, which is required by the BIT instruction and
 //* when pulling flags from the stack.
-static unsigned zn;
+static CONSOLE_LOCAL unsigned zn;
 
-static bool carry;
-static bool irq_disable;
-static bool decimal;
-static bool overflow;
+static CONSOLE_LOCAL bool carry;
+static CONSOLE_LOCAL bool irq_disable;
+static CONSOLE_LOCAL bool decimal;
+static CONSOLE_LOCAL bool overflow;
 
 //* The byte after the opcode byte. Always fetched, so factoring out the fetch
 //* saves logic.
-static uint8_t op_1;
-
-bool cpu_is_reading;
-static unsigned ticks_till_reset;
-uint8_t cpu_data_bus;
+static CONSOLE_LOCAL uint8_t op_1;
+
+CONSOLE_LOCAL bool cpu_is_reading;
+CONSOLE_LOCAL uint8_t cpu_data_bus;
+CONSOLE_LOCAL unsigned long frames_emulated;
+CONSOLE_LOCAL uint64_t cpu_cycles_emulated;
+#ifdef BENCHMARK
+CONSOLE_LOCAL uint64_t cpu_instructions_run;
+#  define COUNT_INSTRUCTION ++cpu_instructions_run
+#else
+#  define COUNT_INSTRUCTION
+#endif
 
 //*
 //* PPU and APU interface
 //*
 
-unsigned frame_offset;
+CONSOLE_LOCAL unsigned frame_offset;
 
-//* Down counter for adding an extra PPU tick for PAL
-static unsigned pal_extra_tick;
+//* Down counter for adding an extra PPU tick for PAL. Only brought up to date
+//* when the PPU is synced.
+static CONSOLE_LOCAL unsigned pal_extra_tick;
 
+//* The PPU is run lazily ("catch-up"). tick() only counts CPU cycles, and the
+//* PPU is brought up to date by sync_ppu() right before the CPU could observe
+//* it: on PPU register and mapper accesses, OAM DMA writes, and when the PPU
+//* reaches the end of the frame or raises the VBlank NMI (EVENT_PPU_SYNC).
+//*
+//* The cycle the PPU was last synced on
+static CONSOLE_LOCAL uint64_t ppu_synced_cycle;
+//* Mappers that raise IRQs from the PPU (e.g. MMC3) can't be predicted, so
+//* we run the PPU in lock-step with the CPU for those instead
+static CONSOLE_LOCAL bool lockstep_ppu;
 
+//* Returns the number of PPU ticks in the 'cycles' CPU cycles after the last
+//* sync. For NTSC, there are exactly three PPU ticks per CPU cycle. For PAL
+//* the number is 3.2, which is emulated by adding an extra PPU tick every fifth
+//* cycle. (This isn't perfect, but about as good as we can do without getting
+//* into super-obscure hardware behavior, including PPU half-ticks and analog
+//* effects.)
+static unsigned ppu_ticks_in(unsigned cycles)
+{
+    return 3*cycles + (is_pal ? (cycles + 5 - pal_extra_tick)/5 : 0);
+}
 
-void tick()
+//* Makes the PPU sync on the next cycle, for when it has been moved (e.g. by a
+//* reset or a state load) and the next sync point needs to be worked out again
+static void resync_ppu_next_cycle()
+{
+    schedule_event(EVENT_PPU_SYNC, cpu_cycle + 1);
+}
+
+void sync_ppu()
 {
-    //* For NTSC, there are exactly three PPU ticks per CPU cycle. For PAL the
-    //* number is 3.2, which is emulated by adding an extra PPU tick every fifth
-    //* call. (This isn't perfect, but about as good as we can do without getting
-    //* into super-obscure hardware behavior, including PPU half-ticks and analog
-    //* effects.)
+    BENCH_SCOPE(BENCH_PPU);
+
+    unsigned const cycles = cpu_cycle - ppu_synced_cycle;
+    run_ppu(ppu_ticks_in(cycles));
     if (is_pal)
-    {
-        if (--pal_extra_tick == 0)
-        {
-            pal_extra_tick = 5;
-            tick_pal_ppu();
-        }
-        tick_pal_ppu();
-        tick_pal_ppu();
-        tick_pal_ppu();
+        pal_extra_tick = 5 - (cycles + 5 - pal_extra_tick)%5;
+    ppu_synced_cycle = cpu_cycle;
+
+    if (lockstep_ppu)
+        return;
+
+    //* Sync again on the first cycle by which the PPU will have reached its
+    //* next event
+    unsigned const ticks_till_event = ppu_ticks_till_event();
+    unsigned cycles_till_event;
+    if (is_pal) {
+        //* Starts a cycle or two short, as there are at most 3.2 ticks (plus a
+        //* rounding tick) per cycle
+        cycles_till_event = max(5*ticks_till_event/16, 2u) - 1;
+        while (ppu_ticks_in(cycles_till_event) < ticks_till_event)
+            ++cycles_till_event;
     }
     else
-    {
-        tick_ntsc_ppu();
-        tick_ntsc_ppu();
-        tick_ntsc_ppu();
-    }
-
-    tick_apu();
+        cycles_till_event = max((ticks_till_event + 2)/3, 1u);
+    schedule_event(EVENT_PPU_SYNC, cpu_cycle + cycles_till_event);
+}
 
-    if(bRunTests){
-        if (ticks_till_reset > 0 && --ticks_till_reset == 0){
-            pending_reset = true;
-        }
-    }
+void do_test_reset()
+{
+    pending_reset = true;
+}
 
+void tick()
+{
+    ++cpu_cycle;
     ++frame_offset;
+
+    if (lockstep_ppu)
+        sync_ppu();
+
+    //* Everything else that happens on particular cycles is scheduled. The APU
+    //* channels are run from a log of register writes (see apu_synth.h).
+    if (cpu_cycle >= next_event_cycle)
+        run_due_events();
 }
 
 //*
@@ -150,61 +199,53 @@ static void write_tick()
     tick();
 }
 
-uint8_t read_mem(uint16_t addr)
+//* Reads from pages without a direct mapping in cpu_read_pages
+static uint8_t read_io(uint16_t addr)
 {
-    read_tick();
-
-    uint8_t res;
-
     switch (addr)
     {
-    case 0x0000 ... 0x1FFF:
-        res = ram[addr & 0x7FF];
-        break;
     case 0x2000 ... 0x3FFF:
-        res = read_ppu_reg(addr & 7);
-        break;
+        sync_ppu();
+        return read_ppu_reg(addr & 7);
     case 0x4015:
-        res = read_apu_status();
-        break;
+        return read_apu_status();
     case 0x4016:
-        res = read_controller(0);
-        break;
+        return read_controller(0);
     case 0x4017:
-        res = read_controller(1);
-        break;
-    case 0x4018 ... 0x5FFF:
-        res = mapper_fns.read(addr);
-        break; //* General enough?
-    case 0x6000 ... 0x7FFF:
-        //* WRAM/SRAM. Returns open bus if none present.
-        res = wram_6000_page ? wram_6000_page[addr & 0x1FFF] : cpu_data_bus;
-        break;
-    case 0x8000 ... 0xFFFF:
-        res = read_prg(addr);
-        break;
+        return read_controller(1);
+    case 0x4018 ... 0x5FFF: //* General enough?
+        {
+            sync_ppu();
+            BENCH_SCOPE(BENCH_MAPPER);
+            return mapper_fns.read(addr);
+        }
     default:
-        res = cpu_data_bus;
-        break; //* Open bus
+        //* Includes $6000-$7FFF when there's no WRAM
+        return cpu_data_bus; //* Open bus
     }
-
-    cpu_data_bus = res;
-    return res;
 }
 
-static void write_mem(uint8_t val, uint16_t addr)
+uint8_t read_mem(uint16_t addr)
 {
-    //NOTE: The write probably takes effect earlier within the CPU cycle than after the three PPU ticks and the one APU tick.
-    write_tick();
+    read_tick();
 
-    cpu_data_bus = val;
+    //* RAM, WRAM, and PRG are read directly through the page table
+    uint8_t const *const page = cpu_read_pages[addr >> 8];
+    cpu_data_bus = page ? page[addr & 0xFF] : read_io(addr);
+    return cpu_data_bus;
+}
+
+//* Writes to pages without a direct mapping in cpu_write_pages
+static void write_io(uint8_t val, uint16_t addr)
+{
+    //* Bring the APU up to date before its registers change
+    if (addr >= 0x4000 && addr <= 0x4017)
+        sync_apu();
 
     switch (addr)
     {
-    case 0x0000 ... 0x1FFF:
-        ram[addr & 0x7FF] = val;
-        break;
     case 0x2000 ... 0x3FFF:
+        sync_ppu();
         write_ppu_reg(val, addr & 7);
         break;
 
@@ -280,31 +321,42 @@ static void write_mem(uint8_t val, uint16_t addr)
     case 0x4017:
         write_frame_counter(val);
         break;
+    }
+}
 
-    case 0x6000 ... 0x7FFF:
-        if (bRunTests){
-            //* blargg's test ROMs write the test status to $6000 and a
-            //* corresponding text string to $6004
-            if (addr == 0x6000) {
-                if (val < 0x80)
-                    report_status_and_end_test(val, (char*)wram_6000_page + 4);
-                else if (val == 0x81)
-                    //* Wait 150 ms before resetting
-                    ticks_till_reset = 0.15*cpu_clock_rate;
-            }
-        }
-        //* SRAM/WRAM/PRG RAM
-        if (wram_6000_page) wram_6000_page[addr & 0x1FFF] = val;
-        break;
+static void write_mem(uint8_t val, uint16_t addr)
+{
+    //NOTE: The write probably takes effect earlier within the CPU cycle than after the three PPU ticks and the one APU tick.
+    write_tick();
 
-    case 0x8000 ... 0xFFFF:
-        write_prg(addr, val);
-        break;
+    cpu_data_bus = val;
+
+    //* RAM, WRAM, and PRG RAM are written directly through the page table
+    uint8_t *const page = cpu_write_pages[addr >> 8];
+    if (page)
+        page[addr & 0xFF] = val;
+    else
+        write_io(val, addr);
+
+    //* None of the supported mappers react to writes below $4018, so those are
+    //* done. Only addresses from $4018 up are mapper registers, so only those
+    //* need the PPU to be in sync (bank switching, mirroring, etc.).
+    if (addr < 0x4018)
+        return;
+
+    //* blargg's test ROMs write the test status to $6000 and a corresponding
+    //* text string to $6004
+    if (bRunTests && addr == 0x6000) {
+        if (val < 0x80)
+            report_status_and_end_test(val, (char*)wram_6000_page + 4);
+        else if (val == 0x81)
+            //* Wait 150 ms before resetting
+            schedule_event(EVENT_TEST_RESET,
+                           cpu_cycle + unsigned(0.15*cpu_clock_rate));
     }
 
-    //* An alternative to letting the mapper see all writes would be to have
-    //* separate functions for common address ranges that trigger mapper
-    //* operations
+    sync_ppu();
+    BENCH_SCOPE(BENCH_MAPPER);
     mapper_fns.write(val, addr);
 }
 
@@ -791,13 +843,13 @@ static void unoff_addr_write(uint16_t addr, uint8_t val, uint8_t index)
 //*
 
 //* IRQ from mapper hardware on the cart
-static bool cart_irq;
+static CONSOLE_LOCAL bool cart_irq;
 
 //* The OR of all IRQ sources. Updated in update_irq_status().
-static bool irq_line;
+static CONSOLE_LOCAL bool irq_line;
 
 //* Set true when a falling edge occurs on the NMI input
-static bool nmi_asserted;
+static CONSOLE_LOCAL bool nmi_asserted;
 
 static void update_irq_status()
 {
@@ -937,29 +989,88 @@ static void process_pending_events()
     {
         pending_frame_completion = false;
 
-        //* Run tests as fast as we can
-        if(bRunTests){
-            sleep_till_end_of_frame();
+        if (frame_is_shown())
+        {
+            BENCH_SCOPE(BENCH_FRONTEND);
+            draw_frame();
         }
-        draw_frame();
-        end_audio_frame();
-        begin_audio_frame();
+        end_apu_frame();
+        ++frames_emulated;
+        cpu_cycles_emulated += frame_offset;
         frame_offset = 0;
+
+        //* Rewinding and movies work on the real timeline. A movie can't be
+        //* rewound.
+        if (!running_ahead()) {
+            //* No frame follows if emulation is ending
+            if (!pending_end_emulation)
+                handle_movie_frame();
+            handle_rewind(rewind_pushed && !movie_active());
+        }
+        handle_run_ahead();
     }
 
     if (pending_reset)
     {
         pending_reset = false;
+        //* A reset while running ahead would be lost when going back to the
+        //* real timeline
+        cancel_run_ahead();
         //* Reset the APU and PPU first since they should tick during the
         //* CPU's reset sequence
+        sync_ppu();
         reset_apu();
         reset_ppu();
+        //* The PPU has moved, so work out the next sync point again
+        resync_ppu_next_cycle();
         reset_cpu();
     }
 }
 
+//* Fetches the opcode and the byte after it. For most instructions with
+//* single-byte opcodes, the interrupt poll happens after the first cycle.
+#define FETCH_OPCODE                                                           \
+    opcode = read_mem(pc++);                                                   \
+    if (polls_irq_after_first_cycle[opcode])                                   \
+        poll_for_interrupt();                                                  \
+    op_1 = read_mem(pc);                                                       \
+    COUNT_INSTRUCTION
+
+//* Instructions are dispatched either with a switch, or - with
+//* THREADED_DISPATCH ('make DISPATCH=threaded') - by jumping through a table
+//* of label addresses (a GCC extension):
+//*
+//*   http://*eli.thegreenplace.net/2012/07/12/computed-goto-for-efficient-dispatch-tables/
+//*   https://*www.cs.tcd.ie/David.Gregg/papers/toplas05.pdf
+//*
+//* In the threaded version each instruction fetches the next one and jumps
+//* straight to it, giving one indirect jump per instruction for the branch
+//* predictor to learn instead of a single shared one. When events are pending
+//* or emulation is paused, we go back to the top of the loop instead.
+//*
+//* OP(opcode) starts the code for an instruction and NEXT ends it.
+#ifdef THREADED_DISPATCH
+#  define OP(opcode) op_##opcode
+#  define NEXT                                                                 \
+    if (!running_state || pending_event)                                       \
+        continue;                                                              \
+    FETCH_OPCODE;                                                              \
+    goto *op_labels[opcode]
+#else
+#  define OP(opcode) case opcode
+#  define NEXT break
+#endif
+
 void run()
 {
+#ifdef THREADED_DISPATCH
+    static CONSOLE_LOCAL void *op_labels[256];
+#  define SET_OP_LABEL(name, value) op_labels[value] = &&op_##name;
+    FOR_EACH_OPCODE(SET_OP_LABEL)
+#  undef SET_OP_LABEL
+#endif
+
+    reset_events();
     set_apu_cold_boot_state();
     set_cpu_cold_boot_state();
     set_ppu_cold_boot_state();
@@ -967,54 +1078,64 @@ void run()
     init_timing();
     do_interrupt(Int_reset);
 
+    start_movie_at_power_on();
+
+    uint8_t opcode;
     for (;;)
     {
-        while (!running_state){
-            //* Show GUI when paused;
-            GUI::process_inputs();
-            GUI::render();
+        if (!running_state){
+            //* States saved or loaded while paused are for the real timeline
+            cancel_run_ahead();
+            //* Bring the PPU up to date so that states saved while paused
+            //* are complete
+            sync_ppu();
+            while (!running_state){
+                //* Let the frontend run (e.g. show the GUI) while paused
+                frontend_idle();
+            }
+            //* A state might have been loaded while paused
+            resync_ppu_next_cycle();
         }
 
         if (pending_event){
             pending_event = false;
             process_pending_events();
             if (pending_end_emulation){
+                //* Emulation can end partway through a frame. Catch the APU
+                //* up, so that the audio for it isn't lost.
+                sync_apu();
                 return;
             }
         }
 
-        uint8_t const opcode = read_mem(pc++);
-        if (polls_irq_after_first_cycle[opcode])
-            poll_for_interrupt();
-        op_1 = read_mem(pc);
-
-        //* http://*eli.thegreenplace.net/2012/07/12/computed-goto-for-efficient-dispatch-tables/
-        //* could possibly speed this up a bit (also,
-        //* https://*www.cs.tcd.ie/David.Gregg/papers/toplas05.pdf). CPU
-        //* emulation seems to account for less than 5% of the runtime though,
-        //* so it might not be worth uglifying the code for.
+        FETCH_OPCODE;
 
+#ifdef THREADED_DISPATCH
+        goto *op_labels[opcode];
+        {
+#else
         switch (opcode)
         {
+#endif
 
             //*
             //* Accumulator or implied addressing
             //*
 
-        case BRK:
+        OP(BRK):
             ++pc;
             do_interrupt(Int_BRK);
-            break;
+            NEXT;
 
-        case RTI:
+        OP(RTI):
             read_tick(); //* Corresponds to incrementing s
             pull_flags();
             pc = pull();
             poll_for_interrupt();
             pc |= pull() << 8;
-            break;
+            NEXT;
 
-        case RTS:
+        OP(RTS):
         {
             read_tick(); //* Corresponds to incrementing s
             uint8_t const pc_low = pull();
@@ -1022,205 +1143,205 @@ void run()
             poll_for_interrupt();
             read_tick(); //* Increment PC
         }
-        break;
+        NEXT;
 
-        case PHA:
+        OP(PHA):
             poll_for_interrupt();
             push(a);
-            break;
+            NEXT;
 
-        case PHP:
+        OP(PHP):
             poll_for_interrupt();
             push_flags(true);
-            break;
+            NEXT;
 
-        case PLA:
+        OP(PLA):
             read_tick(); //* Corresponds to incrementing s
             poll_for_interrupt();
             zn = a = pull();
-            break;
+            NEXT;
 
-        case PLP:
+        OP(PLP):
             read_tick(); //* Corresponds to incrementing s
             poll_for_interrupt();
             pull_flags();
-            break;
+            NEXT;
 
-        case ASL_ACC:
+        OP(ASL_ACC):
             a = asl(a);
-            break;
-        case LSR_ACC:
+            NEXT;
+        OP(LSR_ACC):
             a = lsr(a);
-            break;
-        case ROL_ACC:
+            NEXT;
+        OP(ROL_ACC):
             a = rol(a);
-            break;
-        case ROR_ACC:
+            NEXT;
+        OP(ROR_ACC):
             a = ror(a);
-            break;
+            NEXT;
 
-        case CLC:
+        OP(CLC):
             carry = false;
-            break;
-        case CLD:
+            NEXT;
+        OP(CLD):
             decimal = false;
-            break;
-        case CLI:
+            NEXT;
+        OP(CLI):
             irq_disable = false;
-            break;
-        case CLV:
+            NEXT;
+        OP(CLV):
             overflow = false;
-            break;
-        case SEC:
+            NEXT;
+        OP(SEC):
             carry = true;
-            break;
-        case SED:
+            NEXT;
+        OP(SED):
             decimal = true;
-            break;
-        case SEI:
+            NEXT;
+        OP(SEI):
             irq_disable = true;
-            break;
+            NEXT;
 
-        case DEX:
+        OP(DEX):
             zn = --x;
-            break;
-        case DEY:
+            NEXT;
+        OP(DEY):
             zn = --y;
-            break;
-        case INX:
+            NEXT;
+        OP(INX):
             zn = ++x;
-            break;
-        case INY:
+            NEXT;
+        OP(INY):
             zn = ++y;
-            break;
+            NEXT;
 
-        case TAX:
+        OP(TAX):
             zn = x = a;
-            break;
-        case TAY:
+            NEXT;
+        OP(TAY):
             zn = y = a;
-            break;
-        case TSX:
+            NEXT;
+        OP(TSX):
             zn = x = s;
-            break;
-        case TXA:
+            NEXT;
+        OP(TXA):
             zn = a = x;
-            break;
-        case TXS:
+            NEXT;
+        OP(TXS):
             s = x;
-            break;
-        case TYA:
+            NEXT;
+        OP(TYA):
             zn = a = y;
-            break;
+            NEXT;
 
         //* The "official" NOP and various unofficial NOPs with
         //* accumulator/implied addressing
-        case NOP:
-        case NO0:
-        case NO1:
-        case NO2:
-        case NO3:
-        case NO4:
-        case NO5:
-            break;
+        OP(NOP):
+        OP(NO0):
+        OP(NO1):
+        OP(NO2):
+        OP(NO3):
+        OP(NO4):
+        OP(NO5):
+            NEXT;
 
             //*
             //* Immediate addressing
             //*
 
-        case ADC_IMM:
+        OP(ADC_IMM):
             adc(op_1);
             ++pc;
-            break;
-        case ALR_IMM:
+            NEXT;
+        OP(ALR_IMM):
             alr(op_1);
             ++pc;
-            break; //* Unofficial
-        case AN0_IMM:
+            NEXT; //* Unofficial
+        OP(AN0_IMM):
             anc(op_1);
             ++pc;
-            break; //* Unofficial
-        case AN1_IMM:
+            NEXT; //* Unofficial
+        OP(AN1_IMM):
             anc(op_1);
             ++pc;
-            break; //* Unofficial
-        case AND_IMM:
+            NEXT; //* Unofficial
+        OP(AND_IMM):
             and_(op_1);
             ++pc;
-            break;
-        case ARR_IMM:
+            NEXT;
+        OP(ARR_IMM):
             arr(op_1);
             ++pc;
-            break; //* Unofficial
-        case ATX_IMM:
+            NEXT; //* Unofficial
+        OP(ATX_IMM):
             atx(op_1);
             ++pc;
-            break; //* Unofficial
-        case AXS_IMM:
+            NEXT; //* Unofficial
+        OP(AXS_IMM):
             axs(op_1);
             ++pc;
-            break; //* Unofficial
-        case CMP_IMM:
+            NEXT; //* Unofficial
+        OP(CMP_IMM):
             comp(a, op_1);
             ++pc;
-            break;
-        case CPX_IMM:
+            NEXT;
+        OP(CPX_IMM):
             comp(x, op_1);
             ++pc;
-            break;
-        case CPY_IMM:
+            NEXT;
+        OP(CPY_IMM):
             comp(y, op_1);
             ++pc;
-            break;
-        case EOR_IMM:
+            NEXT;
+        OP(EOR_IMM):
             eor(op_1);
             ++pc;
-            break;
-        case LDA_IMM:
+            NEXT;
+        OP(LDA_IMM):
             lda(op_1);
             ++pc;
-            break;
-        case LDX_IMM:
+            NEXT;
+        OP(LDX_IMM):
             ldx(op_1);
             ++pc;
-            break;
-        case LDY_IMM:
+            NEXT;
+        OP(LDY_IMM):
             ldy(op_1);
             ++pc;
-            break;
-        case ORA_IMM:
+            NEXT;
+        OP(ORA_IMM):
             ora(op_1);
             ++pc;
-            break;
-        case SB2_IMM: //* Unofficial, same as SBC
-        case SBC_IMM:
+            NEXT;
+        OP(SB2_IMM): //* Unofficial, same as SBC
+        OP(SBC_IMM):
             sbc(op_1);
             ++pc;
-            break;
-        case XAA_IMM:
+            NEXT;
+        OP(XAA_IMM):
             xaa(op_1);
             ++pc;
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
         //* Unofficial NOPs with immediate addressing
-        case NO0_IMM:
-        case NO1_IMM:
-        case NO2_IMM:
-        case NO3_IMM:
-        case NO4_IMM:
+        OP(NO0_IMM):
+        OP(NO1_IMM):
+        OP(NO2_IMM):
+        OP(NO3_IMM):
+        OP(NO4_IMM):
             ++pc;
-            break;
+            NEXT;
 
             //*
             //* Absolute addressing
             //*
 
-        case JMP_ABS:
+        OP(JMP_ABS):
             poll_for_interrupt();
             pc = (read_mem(pc + 1) << 8) | op_1;
-            break;
+            NEXT;
 
-        case JSR_ABS:
+        OP(JSR_ABS):
             ++pc;
 
             read_tick(); //* Internal operation
@@ -1230,108 +1351,108 @@ void run()
 
             poll_for_interrupt();
             pc = (read_mem(pc) << 8) | op_1;
-            break;
+            NEXT;
 
             //* Read instructions
 
-        case ADC_ABS:
+        OP(ADC_ABS):
             adc(get_abs_op());
-            break;
-        case AND_ABS:
+            NEXT;
+        OP(AND_ABS):
             and_(get_abs_op());
-            break;
-        case BIT_ABS:
+            NEXT;
+        OP(BIT_ABS):
             bit(get_abs_op());
-            break;
-        case CMP_ABS:
+            NEXT;
+        OP(CMP_ABS):
             comp(a, get_abs_op());
-            break;
-        case CPX_ABS:
+            NEXT;
+        OP(CPX_ABS):
             comp(x, get_abs_op());
-            break;
-        case CPY_ABS:
+            NEXT;
+        OP(CPY_ABS):
             comp(y, get_abs_op());
-            break;
-        case EOR_ABS:
+            NEXT;
+        OP(EOR_ABS):
             eor(get_abs_op());
-            break;
-        case LAX_ABS:
+            NEXT;
+        OP(LAX_ABS):
             lax(get_abs_op());
-            break; //* Unofficial
-        case LDA_ABS:
+            NEXT; //* Unofficial
+        OP(LDA_ABS):
             lda(get_abs_op());
-            break;
-        case LDX_ABS:
+            NEXT;
+        OP(LDX_ABS):
             ldx(get_abs_op());
-            break;
-        case LDY_ABS:
+            NEXT;
+        OP(LDY_ABS):
             ldy(get_abs_op());
-            break;
-        case ORA_ABS:
+            NEXT;
+        OP(ORA_ABS):
             ora(get_abs_op());
-            break;
-        case SBC_ABS:
+            NEXT;
+        OP(SBC_ABS):
             sbc(get_abs_op());
-            break;
+            NEXT;
 
         //* Unofficial NOP with absolute addressing (acts like a read)
-        case NOP_ABS:
+        OP(NOP_ABS):
             get_abs_op();
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case ASL_ABS:
+        OP(ASL_ABS):
             RMW(asl, get_abs_addr());
-            break;
-        case DCP_ABS:
+            NEXT;
+        OP(DCP_ABS):
             RMW(dcp, get_abs_addr());
-            break; //* Unofficial
-        case DEC_ABS:
+            NEXT; //* Unofficial
+        OP(DEC_ABS):
             RMW(dec, get_abs_addr());
-            break;
-        case INC_ABS:
+            NEXT;
+        OP(INC_ABS):
             RMW(inc, get_abs_addr());
-            break;
-        case ISC_ABS:
+            NEXT;
+        OP(ISC_ABS):
             RMW(isc, get_abs_addr());
-            break; //* Unofficial
-        case LSR_ABS:
+            NEXT; //* Unofficial
+        OP(LSR_ABS):
             RMW(lsr, get_abs_addr());
-            break;
-        case RLA_ABS:
+            NEXT;
+        OP(RLA_ABS):
             RMW(rla, get_abs_addr());
-            break; //* Unofficial
-        case RRA_ABS:
+            NEXT; //* Unofficial
+        OP(RRA_ABS):
             RMW(rra, get_abs_addr());
-            break; //* Unofficial
-        case ROL_ABS:
+            NEXT; //* Unofficial
+        OP(ROL_ABS):
             RMW(rol, get_abs_addr());
-            break;
-        case ROR_ABS:
+            NEXT;
+        OP(ROR_ABS):
             RMW(ror, get_abs_addr());
-            break;
-        case SLO_ABS:
+            NEXT;
+        OP(SLO_ABS):
             RMW(slo, get_abs_addr());
-            break; //* Unofficial
-        case SRE_ABS:
+            NEXT; //* Unofficial
+        OP(SRE_ABS):
             RMW(sre, get_abs_addr());
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //* Write instructions
 
-        case SAX_ABS:
+        OP(SAX_ABS):
             abs_write(a & x);
-            break; //* Unofficial
-        case STA_ABS:
+            NEXT; //* Unofficial
+        OP(STA_ABS):
             abs_write(a);
-            break;
-        case STX_ABS:
+            NEXT;
+        OP(STX_ABS):
             abs_write(x);
-            break;
-        case STY_ABS:
+            NEXT;
+        OP(STY_ABS):
             abs_write(y);
-            break;
+            NEXT;
 
             //*
             //* Zero page addressing
@@ -1339,106 +1460,106 @@ void run()
 
             //* Read instructions
 
-        case ADC_ZERO:
+        OP(ADC_ZERO):
             adc(get_zero_op());
-            break;
-        case AND_ZERO:
+            NEXT;
+        OP(AND_ZERO):
             and_(get_zero_op());
-            break;
-        case BIT_ZERO:
+            NEXT;
+        OP(BIT_ZERO):
             bit(get_zero_op());
-            break;
-        case CMP_ZERO:
+            NEXT;
+        OP(CMP_ZERO):
             comp(a, get_zero_op());
-            break;
-        case CPX_ZERO:
+            NEXT;
+        OP(CPX_ZERO):
             comp(x, get_zero_op());
-            break;
-        case CPY_ZERO:
+            NEXT;
+        OP(CPY_ZERO):
             comp(y, get_zero_op());
-            break;
-        case EOR_ZERO:
+            NEXT;
+        OP(EOR_ZERO):
             eor(get_zero_op());
-            break;
-        case LAX_ZERO:
+            NEXT;
+        OP(LAX_ZERO):
             lax(get_zero_op());
-            break; //* Unofficial
-        case LDA_ZERO:
+            NEXT; //* Unofficial
+        OP(LDA_ZERO):
             lda(get_zero_op());
-            break;
-        case LDX_ZERO:
+            NEXT;
+        OP(LDX_ZERO):
             ldx(get_zero_op());
-            break;
-        case LDY_ZERO:
+            NEXT;
+        OP(LDY_ZERO):
             ldy(get_zero_op());
-            break;
-        case ORA_ZERO:
+            NEXT;
+        OP(ORA_ZERO):
             ora(get_zero_op());
-            break;
-        case SBC_ZERO:
+            NEXT;
+        OP(SBC_ZERO):
             sbc(get_zero_op());
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case ASL_ZERO:
+        OP(ASL_ZERO):
             ZERO_RMW(asl);
-            break;
-        case DCP_ZERO:
+            NEXT;
+        OP(DCP_ZERO):
             ZERO_RMW(dcp);
-            break; //* Unofficial
-        case DEC_ZERO:
+            NEXT; //* Unofficial
+        OP(DEC_ZERO):
             ZERO_RMW(dec);
-            break;
-        case INC_ZERO:
+            NEXT;
+        OP(INC_ZERO):
             ZERO_RMW(inc);
-            break;
-        case ISC_ZERO:
+            NEXT;
+        OP(ISC_ZERO):
             ZERO_RMW(isc);
-            break; //* Unofficial
-        case LSR_ZERO:
+            NEXT; //* Unofficial
+        OP(LSR_ZERO):
             ZERO_RMW(lsr);
-            break;
-        case RLA_ZERO:
+            NEXT;
+        OP(RLA_ZERO):
             ZERO_RMW(rla);
-            break; //* Unofficial
-        case RRA_ZERO:
+            NEXT; //* Unofficial
+        OP(RRA_ZERO):
             ZERO_RMW(rra);
-            break; //* Unofficial
-        case ROL_ZERO:
+            NEXT; //* Unofficial
+        OP(ROL_ZERO):
             ZERO_RMW(rol);
-            break;
-        case ROR_ZERO:
+            NEXT;
+        OP(ROR_ZERO):
             ZERO_RMW(ror);
-            break;
-        case SLO_ZERO:
+            NEXT;
+        OP(SLO_ZERO):
             ZERO_RMW(slo);
-            break; //* Unofficial
-        case SRE_ZERO:
+            NEXT; //* Unofficial
+        OP(SRE_ZERO):
             ZERO_RMW(sre);
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //* Write instructions
 
-        case SAX_ZERO:
+        OP(SAX_ZERO):
             zero_write(a & x);
-            break; //* Unofficial
-        case STA_ZERO:
+            NEXT; //* Unofficial
+        OP(STA_ZERO):
             zero_write(a);
-            break;
-        case STX_ZERO:
+            NEXT;
+        OP(STX_ZERO):
             zero_write(x);
-            break;
-        case STY_ZERO:
+            NEXT;
+        OP(STY_ZERO):
             zero_write(y);
-            break;
+            NEXT;
 
         //* Unofficial NOPs with zero page addressing (acts like reads)
-        case NO0_ZERO:
-        case NO1_ZERO:
-        case NO2_ZERO:
+        OP(NO0_ZERO):
+        OP(NO1_ZERO):
+        OP(NO2_ZERO):
             get_zero_op();
-            break;
+            NEXT;
 
             //*
             //* Zero page indexed addressing
@@ -1446,100 +1567,100 @@ void run()
 
             //* Read instructions
 
-        case ADC_ZERO_X:
+        OP(ADC_ZERO_X):
             adc(get_zero_xy_op(x));
-            break;
-        case AND_ZERO_X:
+            NEXT;
+        OP(AND_ZERO_X):
             and_(get_zero_xy_op(x));
-            break;
-        case CMP_ZERO_X:
+            NEXT;
+        OP(CMP_ZERO_X):
             comp(a, get_zero_xy_op(x));
-            break;
-        case EOR_ZERO_X:
+            NEXT;
+        OP(EOR_ZERO_X):
             eor(get_zero_xy_op(x));
-            break;
-        case LAX_ZERO_Y:
+            NEXT;
+        OP(LAX_ZERO_Y):
             lax(get_zero_xy_op(y));
-            break; //* Unofficial
-        case LDA_ZERO_X:
+            NEXT; //* Unofficial
+        OP(LDA_ZERO_X):
             lda(get_zero_xy_op(x));
-            break;
-        case LDX_ZERO_Y:
+            NEXT;
+        OP(LDX_ZERO_Y):
             ldx(get_zero_xy_op(y));
-            break;
-        case LDY_ZERO_X:
+            NEXT;
+        OP(LDY_ZERO_X):
             ldy(get_zero_xy_op(x));
-            break;
-        case ORA_ZERO_X:
+            NEXT;
+        OP(ORA_ZERO_X):
             ora(get_zero_xy_op(x));
-            break;
-        case SBC_ZERO_X:
+            NEXT;
+        OP(SBC_ZERO_X):
             sbc(get_zero_xy_op(x));
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case ASL_ZERO_X:
+        OP(ASL_ZERO_X):
             ZERO_X_RMW(asl);
-            break;
-        case DCP_ZERO_X:
+            NEXT;
+        OP(DCP_ZERO_X):
             ZERO_X_RMW(dcp);
-            break; //* Unofficial
-        case DEC_ZERO_X:
+            NEXT; //* Unofficial
+        OP(DEC_ZERO_X):
             ZERO_X_RMW(dec);
-            break;
-        case INC_ZERO_X:
+            NEXT;
+        OP(INC_ZERO_X):
             ZERO_X_RMW(inc);
-            break;
-        case ISC_ZERO_X:
+            NEXT;
+        OP(ISC_ZERO_X):
             ZERO_X_RMW(isc);
-            break; //* Unofficial
-        case LSR_ZERO_X:
+            NEXT; //* Unofficial
+        OP(LSR_ZERO_X):
             ZERO_X_RMW(lsr);
-            break;
-        case RLA_ZERO_X:
+            NEXT;
+        OP(RLA_ZERO_X):
             ZERO_X_RMW(rla);
-            break; //* Unofficial
-        case RRA_ZERO_X:
+            NEXT; //* Unofficial
+        OP(RRA_ZERO_X):
             ZERO_X_RMW(rra);
-            break; //* Unofficial
-        case ROL_ZERO_X:
+            NEXT; //* Unofficial
+        OP(ROL_ZERO_X):
             ZERO_X_RMW(rol);
-            break;
-        case ROR_ZERO_X:
+            NEXT;
+        OP(ROR_ZERO_X):
             ZERO_X_RMW(ror);
-            break;
-        case SLO_ZERO_X:
+            NEXT;
+        OP(SLO_ZERO_X):
             ZERO_X_RMW(slo);
-            break; //* Unofficial
-        case SRE_ZERO_X:
+            NEXT; //* Unofficial
+        OP(SRE_ZERO_X):
             ZERO_X_RMW(sre);
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //* Write instructions
 
-        case SAX_ZERO_Y:
+        OP(SAX_ZERO_Y):
             zero_xy_write(a & x, y);
-            break; //* Unofficial
-        case STA_ZERO_X:
+            NEXT; //* Unofficial
+        OP(STA_ZERO_X):
             zero_xy_write(a, x);
-            break;
-        case STX_ZERO_Y:
+            NEXT;
+        OP(STX_ZERO_Y):
             zero_xy_write(x, y);
-            break;
-        case STY_ZERO_X:
+            NEXT;
+        OP(STY_ZERO_X):
             zero_xy_write(y, x);
-            break;
+            NEXT;
 
         //* Unofficial NOPs with indexed zero page addressing (acts like reads)
-        case NO0_ZERO_X:
-        case NO1_ZERO_X:
-        case NO2_ZERO_X:
-        case NO3_ZERO_X:
-        case NO4_ZERO_X:
-        case NO5_ZERO_X:
+        OP(NO0_ZERO_X):
+        OP(NO1_ZERO_X):
+        OP(NO2_ZERO_X):
+        OP(NO3_ZERO_X):
+        OP(NO4_ZERO_X):
+        OP(NO5_ZERO_X):
             get_zero_xy_op(x);
-            break;
+            NEXT;
 
             //*
             //* Absolute indexed addressing
@@ -1547,151 +1668,151 @@ void run()
 
             //* Read instructions
 
-        case ADC_ABS_X:
+        OP(ADC_ABS_X):
             adc(get_abs_xy_op_read(x));
-            break;
-        case ADC_ABS_Y:
+            NEXT;
+        OP(ADC_ABS_Y):
             adc(get_abs_xy_op_read(y));
-            break;
-        case AND_ABS_X:
+            NEXT;
+        OP(AND_ABS_X):
             and_(get_abs_xy_op_read(x));
-            break;
-        case AND_ABS_Y:
+            NEXT;
+        OP(AND_ABS_Y):
             and_(get_abs_xy_op_read(y));
-            break;
-        case CMP_ABS_X:
+            NEXT;
+        OP(CMP_ABS_X):
             comp(a, get_abs_xy_op_read(x));
-            break;
-        case CMP_ABS_Y:
+            NEXT;
+        OP(CMP_ABS_Y):
             comp(a, get_abs_xy_op_read(y));
-            break;
-        case EOR_ABS_X:
+            NEXT;
+        OP(EOR_ABS_X):
             eor(get_abs_xy_op_read(x));
-            break;
-        case EOR_ABS_Y:
+            NEXT;
+        OP(EOR_ABS_Y):
             eor(get_abs_xy_op_read(y));
-            break;
-        case LAS_ABS_Y:
+            NEXT;
+        OP(LAS_ABS_Y):
             las(get_abs_xy_op_read(y));
-            break; //* Unofficial
-        case LAX_ABS_Y:
+            NEXT; //* Unofficial
+        OP(LAX_ABS_Y):
             lax(get_abs_xy_op_read(y));
-            break; //* Unofficial
-        case LDA_ABS_X:
+            NEXT; //* Unofficial
+        OP(LDA_ABS_X):
             lda(get_abs_xy_op_read(x));
-            break;
-        case LDA_ABS_Y:
+            NEXT;
+        OP(LDA_ABS_Y):
             lda(get_abs_xy_op_read(y));
-            break;
-        case LDX_ABS_Y:
+            NEXT;
+        OP(LDX_ABS_Y):
             ldx(get_abs_xy_op_read(y));
-            break;
-        case LDY_ABS_X:
+            NEXT;
+        OP(LDY_ABS_X):
             ldy(get_abs_xy_op_read(x));
-            break;
-        case ORA_ABS_X:
+            NEXT;
+        OP(ORA_ABS_X):
             ora(get_abs_xy_op_read(x));
-            break;
-        case ORA_ABS_Y:
+            NEXT;
+        OP(ORA_ABS_Y):
             ora(get_abs_xy_op_read(y));
-            break;
-        case SBC_ABS_X:
+            NEXT;
+        OP(SBC_ABS_X):
             sbc(get_abs_xy_op_read(x));
-            break;
-        case SBC_ABS_Y:
+            NEXT;
+        OP(SBC_ABS_Y):
             sbc(get_abs_xy_op_read(y));
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case ASL_ABS_X:
+        OP(ASL_ABS_X):
             RMW(asl, get_abs_xy_addr_write(x));
-            break;
-        case DCP_ABS_X:
+            NEXT;
+        OP(DCP_ABS_X):
             RMW(dcp, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case DCP_ABS_Y:
+            NEXT; //* Unofficial
+        OP(DCP_ABS_Y):
             RMW(dcp, get_abs_xy_addr_write(y));
-            break; //* Unofficial
-        case DEC_ABS_X:
+            NEXT; //* Unofficial
+        OP(DEC_ABS_X):
             RMW(dec, get_abs_xy_addr_write(x));
-            break;
-        case INC_ABS_X:
+            NEXT;
+        OP(INC_ABS_X):
             RMW(inc, get_abs_xy_addr_write(x));
-            break;
-        case ISC_ABS_X:
+            NEXT;
+        OP(ISC_ABS_X):
             RMW(isc, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case ISC_ABS_Y:
+            NEXT; //* Unofficial
+        OP(ISC_ABS_Y):
             RMW(isc, get_abs_xy_addr_write(y));
-            break; //* Unofficial
-        case LSR_ABS_X:
+            NEXT; //* Unofficial
+        OP(LSR_ABS_X):
             RMW(lsr, get_abs_xy_addr_write(x));
-            break;
-        case RLA_ABS_X:
+            NEXT;
+        OP(RLA_ABS_X):
             RMW(rla, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case RLA_ABS_Y:
+            NEXT; //* Unofficial
+        OP(RLA_ABS_Y):
             RMW(rla, get_abs_xy_addr_write(y));
-            break; //* Unofficial
-        case RRA_ABS_X:
+            NEXT; //* Unofficial
+        OP(RRA_ABS_X):
             RMW(rra, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case RRA_ABS_Y:
+            NEXT; //* Unofficial
+        OP(RRA_ABS_Y):
             RMW(rra, get_abs_xy_addr_write(y));
-            break; //* Unofficial
-        case ROL_ABS_X:
+            NEXT; //* Unofficial
+        OP(ROL_ABS_X):
             RMW(rol, get_abs_xy_addr_write(x));
-            break;
-        case ROR_ABS_X:
+            NEXT;
+        OP(ROR_ABS_X):
             RMW(ror, get_abs_xy_addr_write(x));
-            break;
-        case SLO_ABS_X:
+            NEXT;
+        OP(SLO_ABS_X):
             RMW(slo, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case SLO_ABS_Y:
+            NEXT; //* Unofficial
+        OP(SLO_ABS_Y):
             RMW(slo, get_abs_xy_addr_write(y));
-            break; //* Unofficial
-        case SRE_ABS_X:
+            NEXT; //* Unofficial
+        OP(SRE_ABS_X):
             RMW(sre, get_abs_xy_addr_write(x));
-            break; //* Unofficial
-        case SRE_ABS_Y:
+            NEXT; //* Unofficial
+        OP(SRE_ABS_Y):
             RMW(sre, get_abs_xy_addr_write(y));
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //* Write instructions
 
-        case AXA_ABS_Y:
+        OP(AXA_ABS_Y):
             unoff_addr_write(get_abs_addr(), a & x, y);
-            break; //* Unofficial
-        case SAY_ABS_X:
+            NEXT; //* Unofficial
+        OP(SAY_ABS_X):
             unoff_addr_write(get_abs_addr(), y, x);
-            break; //* Unofficial
-        case XAS_ABS_Y:
+            NEXT; //* Unofficial
+        OP(XAS_ABS_Y):
             unoff_addr_write(get_abs_addr(), x, y);
-            break; //* Unofficial
+            NEXT; //* Unofficial
         //* Unofficial
-        case TAS_ABS_Y:
+        OP(TAS_ABS_Y):
             s = a & x;
             unoff_addr_write(get_abs_addr(), a & x, y);
-            break;
+            NEXT;
 
-        case STA_ABS_X:
+        OP(STA_ABS_X):
             abs_xy_write_a(x);
-            break;
-        case STA_ABS_Y:
+            NEXT;
+        OP(STA_ABS_Y):
             abs_xy_write_a(y);
-            break;
+            NEXT;
 
         //* Unofficial NOPs with absolute,x addressing (acts like reads)
-        case NO0_ABS_X:
-        case NO1_ABS_X:
-        case NO2_ABS_X:
-        case NO3_ABS_X:
-        case NO4_ABS_X:
-        case NO5_ABS_X:
+        OP(NO0_ABS_X):
+        OP(NO1_ABS_X):
+        OP(NO2_ABS_X):
+        OP(NO3_ABS_X):
+        OP(NO4_ABS_X):
+        OP(NO5_ABS_X):
             get_abs_xy_op_read(x);
-            break;
+            NEXT;
 
             //*
             //* Indexed indirect addressing
@@ -1699,60 +1820,60 @@ void run()
 
             //* Read instructions
 
-        case ADC_IND_X:
+        OP(ADC_IND_X):
             adc(get_ind_x_op());
-            break;
-        case AND_IND_X:
+            NEXT;
+        OP(AND_IND_X):
             and_(get_ind_x_op());
-            break;
-        case CMP_IND_X:
+            NEXT;
+        OP(CMP_IND_X):
             comp(a, get_ind_x_op());
-            break;
-        case EOR_IND_X:
+            NEXT;
+        OP(EOR_IND_X):
             eor(get_ind_x_op());
-            break;
-        case LAX_IND_X:
+            NEXT;
+        OP(LAX_IND_X):
             lax(get_ind_x_op());
-            break; //* Unofficial
-        case LDA_IND_X:
+            NEXT; //* Unofficial
+        OP(LDA_IND_X):
             lda(get_ind_x_op());
-            break;
-        case ORA_IND_X:
+            NEXT;
+        OP(ORA_IND_X):
             ora(get_ind_x_op());
-            break;
-        case SBC_IND_X:
+            NEXT;
+        OP(SBC_IND_X):
             sbc(get_ind_x_op());
-            break;
+            NEXT;
 
             //* Write instructions
 
-        case SAX_IND_X:
+        OP(SAX_IND_X):
             ind_x_write(a & x);
-            break; //* Unofficial
-        case STA_IND_X:
+            NEXT; //* Unofficial
+        OP(STA_IND_X):
             ind_x_write(a);
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case DCP_IND_X:
+        OP(DCP_IND_X):
             RMW(dcp, get_ind_x_addr());
-            break; //* Unofficial
-        case ISC_IND_X:
+            NEXT; //* Unofficial
+        OP(ISC_IND_X):
             RMW(isc, get_ind_x_addr());
-            break; //* Unofficial
-        case RLA_IND_X:
+            NEXT; //* Unofficial
+        OP(RLA_IND_X):
             RMW(rla, get_ind_x_addr());
-            break; //* Unofficial
-        case RRA_IND_X:
+            NEXT; //* Unofficial
+        OP(RRA_IND_X):
             RMW(rra, get_ind_x_addr());
-            break; //* Unofficial
-        case SLO_IND_X:
+            NEXT; //* Unofficial
+        OP(SLO_IND_X):
             RMW(slo, get_ind_x_addr());
-            break; //* Unofficial
-        case SRE_IND_X:
+            NEXT; //* Unofficial
+        OP(SRE_IND_X):
             RMW(sre, get_ind_x_addr());
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //*
             //* Indirect indexed addressing
@@ -1760,138 +1881,169 @@ void run()
 
             //* Read instructions
 
-        case ADC_IND_Y:
+        OP(ADC_IND_Y):
             adc(get_ind_y_op_read());
-            break;
-        case AND_IND_Y:
+            NEXT;
+        OP(AND_IND_Y):
             and_(get_ind_y_op_read());
-            break;
-        case CMP_IND_Y:
+            NEXT;
+        OP(CMP_IND_Y):
             comp(a, get_ind_y_op_read());
-            break;
-        case EOR_IND_Y:
+            NEXT;
+        OP(EOR_IND_Y):
             eor(get_ind_y_op_read());
-            break;
-        case LAX_IND_Y:
+            NEXT;
+        OP(LAX_IND_Y):
             lax(get_ind_y_op_read());
-            break; //* Unofficial
-        case LDA_IND_Y:
+            NEXT; //* Unofficial
+        OP(LDA_IND_Y):
             lda(get_ind_y_op_read());
-            break;
-        case ORA_IND_Y:
+            NEXT;
+        OP(ORA_IND_Y):
             ora(get_ind_y_op_read());
-            break;
-        case SBC_IND_Y:
+            NEXT;
+        OP(SBC_IND_Y):
             sbc(get_ind_y_op_read());
-            break;
+            NEXT;
 
         //* Write instructions
 
         //* Unofficial
-        case AXA_IND_Y:
+        OP(AXA_IND_Y):
             ++pc;
             read_tick(); //* Fetch effective address low
             read_tick(); //* Fetch effective address high
             unoff_addr_write(
                 (ram[(op_1 + 1) & 0xFF] << 8) | ram[op_1], //* Address
                 a & x, y);
-            break;
+            NEXT;
 
-        case STA_IND_Y:
+        OP(STA_IND_Y):
             ind_y_write_a();
-            break;
+            NEXT;
 
             //* Read-modify-write instructions
 
-        case DCP_IND_Y:
+        OP(DCP_IND_Y):
             RMW(dcp, get_ind_y_addr_write());
-            break; //* Unofficial
-        case ISC_IND_Y:
+            NEXT; //* Unofficial
+        OP(ISC_IND_Y):
             RMW(isc, get_ind_y_addr_write());
-            break; //* Unofficial
-        case RLA_IND_Y:
+            NEXT; //* Unofficial
+        OP(RLA_IND_Y):
             RMW(rla, get_ind_y_addr_write());
-            break; //* Unofficial
-        case RRA_IND_Y:
+            NEXT; //* Unofficial
+        OP(RRA_IND_Y):
             RMW(rra, get_ind_y_addr_write());
-            break; //* Unofficial
-        case SLO_IND_Y:
+            NEXT; //* Unofficial
+        OP(SLO_IND_Y):
             RMW(slo, get_ind_y_addr_write());
-            break; //* Unofficial
-        case SRE_IND_Y:
+            NEXT; //* Unofficial
+        OP(SRE_IND_Y):
             RMW(sre, get_ind_y_addr_write());
-            break; //* Unofficial
+            NEXT; //* Unofficial
 
             //*
             //* Indirect addressing
             //*
 
-        case JMP_IND:
+        OP(JMP_IND):
         {
             uint16_t const addr = (read_mem(pc + 1) << 8) | op_1;
             pc = read_mem(addr);
             poll_for_interrupt();
             pc |= read_mem((addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8;
-            break;
+            NEXT;
         }
 
             //*
             //* Branch instructions
             //*
 
-        case BCC:
+        OP(BCC):
             branch_if(!carry);
-            break;
-        case BCS:
+            NEXT;
+        OP(BCS):
             branch_if(carry);
-            break;
-        case BVC:
+            NEXT;
+        OP(BVC):
             branch_if(!overflow);
-            break;
-        case BVS:
+            NEXT;
+        OP(BVS):
             branch_if(overflow);
-            break;
-        case BEQ:
+            NEXT;
+        OP(BEQ):
             branch_if(!(zn & 0xFF));
-            break;
-        case BMI:
+            NEXT;
+        OP(BMI):
             branch_if(zn & 0x180);
-            break;
-        case BNE:
+            NEXT;
+        OP(BNE):
             branch_if(zn & 0xFF);
-            break;
-        case BPL:
+            NEXT;
+        OP(BPL):
             branch_if(!(zn & 0x180));
-            break;
+            NEXT;
 
             //*
             //* KIL instructions (hang the CPU)
             //*
 
-        case KI0:
-        case KI1:
-        case KI2:
-        case KI3:
-        case KI4:
-        case KI5:
-        case KI6:
-        case KI7:
-        case KI8:
-        case KI9:
-        case K10:
-        case K11:
+        OP(KI0):
+        OP(KI1):
+        OP(KI2):
+        OP(KI3):
+        OP(KI4):
+        OP(KI5):
+        OP(KI6):
+        OP(KI7):
+        OP(KI8):
+        OP(KI9):
+        OP(K10):
+        OP(K11):
             puts("KIL instruction executed, system hung");
-            GUI::StopEmulation();
+            frontend_stop_emulation();
+            NEXT;
         }
     }
 }
 
+#undef FETCH_OPCODE
+#undef OP
+#undef NEXT
+
+void run_idle_cycles(uint64_t cycles)
+{
+    reset_events();
+    set_apu_cold_boot_state();
+    set_cpu_cold_boot_state();
+    set_ppu_cold_boot_state();
+
+    for (uint64_t i = 0; i < cycles; ++i)
+    {
+        tick();
+
+        if (pending_frame_completion)
+        {
+            //* Keep the audio buffer from overflowing, like run() does
+            pending_frame_completion = false;
+            end_apu_frame();
+            frame_offset = 0;
+        }
+    }
+
+    pending_event = false;
+}
+
 //*
 //* Initialization and resetting
 //*
 static void set_cpu_cold_boot_state()
 {
     init_array(ram, (uint8_t)0xFF);
+    //* The 2 KB of RAM is mirrored four times in $0000-$1FFF
+    for (unsigned i = 0; i < 0x20; ++i)
+        cpu_read_pages[i] = cpu_write_pages[i] = ram + 0x100*(i & 7);
     cpu_data_bus = 0;
 
     //* s is later decremented to 0xFD during the reset operation
@@ -1910,6 +2062,10 @@ static void set_cpu_cold_boot_state()
 
     cpu_is_reading = true;
     pal_extra_tick = 5;
+
+    ppu_synced_cycle = cpu_cycle;
+    lockstep_ppu = mapper_fns.ppu_irqs;
+    resync_ppu_next_cycle();
 }
 
 static void reset_cpu()
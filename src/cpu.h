@@ -5,19 +5,40 @@
 //* Current CPU read/write state. Needed to get the timing for APU DMC sample
 //* loading right (tested by the sprdma_and_dmc_dma tests).
 
-extern bool cpu_is_reading;
-extern bool running_state;
+extern CONSOLE_LOCAL bool cpu_is_reading;
+extern CONSOLE_LOCAL bool running_state;
 
 //* Last value put on the CPU data bus. Used to implement open bus reads.
-extern uint8_t cpu_data_bus;
+extern CONSOLE_LOCAL uint8_t cpu_data_bus;
+
+#ifdef BENCHMARK
+//* Number of instructions executed. Never reset - only differences between
+//* readings are meaningful. Used for speed reports. Only counted in benchmark
+//* builds, as it would cost an increment per instruction otherwise.
+extern CONSOLE_LOCAL uint64_t cpu_instructions_run;
+#endif
 
 //* Offset in CPU cycles within the current frame. Used for audio generation.
-extern unsigned frame_offset;
+extern CONSOLE_LOCAL unsigned frame_offset;
+
+//* Frames completed and the CPU cycles in them, including frames that are run
+//* ahead and not shown. Never reset - only differences between readings are
+//* meaningful. Used for speed reports.
+extern CONSOLE_LOCAL unsigned long frames_emulated;
+extern CONSOLE_LOCAL uint64_t cpu_cycles_emulated;
 
 //* Runs the PPU and APU for one CPU cycle. Has external linkage so we can use
 //* it while the CPU is halted during DMA.
 void tick();
 
+//* The PPU runs behind the CPU and is only caught up when needed (see
+//* cpu.cpp). Brings it up to the current CPU cycle - call this before
+//* accessing PPU state from outside the PPU.
+void sync_ppu();
+
+//* Event handler for the delayed reset requested by test ROMs
+void do_test_reset();
+
 //* Also used outside the CPU core to load DMC samples - hence the external
 //* linkage
 uint8_t read_mem(uint16_t addr);
@@ -32,6 +53,11 @@ void set_frame_irq(bool s);
 //* loop
 void run();
 
+//* Runs 'cycles' CPU cycles from power-on without executing any instructions.
+//* Times the work done on every cycle (PPU catch-up, APU, and event scheduling)
+//* on its own. See -m in the headless build.
+void run_idle_cycles(uint64_t cycles);
+
 //* These functions inform the CPU emulation code of various events, which are
 //* handled at the next instruction boundary. Handling events at instruction
 //* boundaries simplifies state transfers as the current location within the CPU
@@ -0,0 +1,233 @@
+#include "common.h"
+
+#include "mapper.h"
+#include "rom.h"
+#include "headless_backend.h"
+#include "frame_hashes.h"
+
+#include <vector>
+
+char const *frame_hash_record_file;
+char const *frame_hash_check_file;
+
+//* XXH64, from the xxHash specification. Much faster than anything
+//* byte-at-a-time for a 240 KB frame, which keeps hashing every frame cheap.
+
+static uint64_t const xxh_prime1 = 0x9E3779B185EBCA87ULL;
+static uint64_t const xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static uint64_t const xxh_prime3 = 0x165667B19E3779F9ULL;
+static uint64_t const xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+static uint64_t const xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotl64(uint64_t x, unsigned n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+//* Little-endian reads, which is what both targets are
+static uint64_t read64(uint8_t const *p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return x;
+}
+
+static uint32_t read32(uint8_t const *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return x;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    return rotl64(acc + input*xxh_prime2, 31)*xxh_prime1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    return (acc ^ xxh64_round(0, val))*xxh_prime1 + xxh_prime4;
+}
+
+static uint64_t xxh64(void const *data, size_t len, uint64_t seed = 0) {
+    uint8_t const *p = (uint8_t const*)data;
+    uint8_t const *const end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + xxh_prime1 + xxh_prime2;
+        uint64_t v2 = seed + xxh_prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - xxh_prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    }
+    else
+        h = seed + xxh_prime5;
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ xxh64_round(0, read64(p)), 27)*xxh_prime1 + xxh_prime4;
+    if (p + 4 <= end) {
+        h = rotl64(h ^ read32(p)*xxh_prime1, 23)*xxh_prime2 + xxh_prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl64(h ^ *p*xxh_prime5, 11)*xxh_prime1;
+
+    h ^= h >> 33;
+    h *= xxh_prime2;
+    h ^= h >> 29;
+    h *= xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+struct Frame_hash {
+    uint64_t video;
+    uint64_t audio;
+};
+
+//* Golden hashes from frame_hash_check_file
+static CONSOLE_LOCAL std::vector<Frame_hash> *golden_hashes;
+//* Open while recording to frame_hash_record_file
+static CONSOLE_LOCAL FILE *record_file;
+
+static CONSOLE_LOCAL unsigned long frames_hashed;
+static CONSOLE_LOCAL unsigned long n_video_diffs, n_audio_diffs;
+//* First frame with a difference, or ULONG_MAX if none
+static CONSOLE_LOCAL unsigned long first_video_diff, first_audio_diff;
+
+static uint64_t prg_hash() {
+    return xxh64(prg_base, 16*1024*prg_16k_banks);
+}
+
+static bool load_golden_hashes(char const *filename) {
+    FILE *const f = fopen(filename, "r");
+    if (!f) {
+        printf("failed to open frame hash file '%s': %s\n", filename,
+               strerror(errno));
+        return false;
+    }
+
+    uint64_t golden_prg_hash;
+    if (fscanf(f, "prg %" SCNx64 "\n", &golden_prg_hash) != 1) {
+        printf("'%s' is not a frame hash file\n", filename);
+        fclose(f);
+        return false;
+    }
+    if (golden_prg_hash != prg_hash())
+        printf("Warning: '%s' was recorded with a different ROM\n", filename);
+
+    golden_hashes = new std::vector<Frame_hash>;
+    unsigned long n;
+    Frame_hash hash;
+    while (fscanf(f, "%lu %" SCNx64 " %" SCNx64 "\n",
+                  &n, &hash.video, &hash.audio) == 3) {
+        if (n != golden_hashes->size()) {
+            printf("frame %lu is out of order in '%s'\n", n, filename);
+            break;
+        }
+        golden_hashes->push_back(hash);
+    }
+    fclose(f);
+
+    if (golden_hashes->empty()) {
+        printf("no frame hashes in '%s'\n", filename);
+        delete golden_hashes;
+        golden_hashes = 0;
+        return false;
+    }
+    return true;
+}
+
+bool start_frame_hashes() {
+    frames_hashed = n_video_diffs = n_audio_diffs = 0;
+    first_video_diff = first_audio_diff = ULONG_MAX;
+
+    if (frame_hash_check_file && !load_golden_hashes(frame_hash_check_file))
+        return false;
+
+    if (frame_hash_record_file) {
+        if (!(record_file = fopen(frame_hash_record_file, "w"))) {
+            printf("failed to open '%s' for writing: %s\n",
+                   frame_hash_record_file, strerror(errno));
+            return false;
+        }
+        fprintf(record_file, "prg %016" PRIx64 "\n", prg_hash());
+    }
+
+    return true;
+}
+
+unsigned long golden_frame_count() {
+    return golden_hashes ? golden_hashes->size() : 0;
+}
+
+void hash_frame(unsigned long frame, uint32_t const *pixels,
+                int16_t const *samples, size_t n_samples) {
+    Frame_hash const hash = { xxh64(pixels, 4*256*240),
+                              xxh64(samples, 2*n_samples) };
+    ++frames_hashed;
+
+    if (record_file)
+        fprintf(record_file, "%lu %016" PRIx64 " %016" PRIx64 "\n",
+                frame, hash.video, hash.audio);
+
+    if (!golden_hashes || frame >= golden_hashes->size())
+        return;
+
+    Frame_hash const &golden = (*golden_hashes)[frame];
+    if (hash.video != golden.video) {
+        if (n_video_diffs++ == 0) {
+            first_video_diff = frame;
+            printf("Frame %lu differs from the golden frame\n", frame);
+        }
+    }
+    if (hash.audio != golden.audio) {
+        if (n_audio_diffs++ == 0) {
+            first_audio_diff = frame;
+            printf("Audio for frame %lu differs from the golden audio\n", frame);
+        }
+    }
+}
+
+bool end_frame_hashes() {
+    if (record_file) {
+        fclose(record_file);
+        record_file = 0;
+        printf("Wrote hashes for %lu frames to %s\n", frames_hashed,
+               frame_hash_record_file);
+    }
+
+    if (!golden_hashes)
+        return true;
+
+    unsigned long const n_golden = golden_hashes->size();
+    delete golden_hashes;
+    golden_hashes = 0;
+
+    unsigned long const n_compared = min(frames_hashed, n_golden);
+    //* A shorter run than the golden one is fine if asked for with -l
+    bool const ended_early = n_compared < min(headless_frame_limit, n_golden);
+    printf("Compared %lu of %lu golden frames%s", n_compared, n_golden,
+           ended_early ? " (the run ended early)" : "");
+    if (n_video_diffs == 0 && n_audio_diffs == 0)
+        puts(": all identical.");
+    else {
+        if (n_video_diffs != 0)
+            printf(", video differs in %lu (first: frame %lu)", n_video_diffs,
+                   first_video_diff);
+        if (n_audio_diffs != 0)
+            printf(", audio differs in %lu (first: frame %lu)", n_audio_diffs,
+                   first_audio_diff);
+        puts(".");
+    }
+
+    return n_video_diffs == 0 && n_audio_diffs == 0 && !ended_early;
+}
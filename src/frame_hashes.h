@@ -0,0 +1,44 @@
+#pragma once
+
+//* Golden frame hashes for the headless build
+//*
+//* Hashes each completed frame (as RGB, so that the conversion is covered too)
+//* and the audio samples that came with it, for a run with the scripted input
+//* from power-on. The hashes are written to a file, and a later run can be
+//* checked against that file to catch any change in the picture or sound,
+//* down to a single pixel or sample. Handy for checking that an optimization
+//* of the renderer or the APU doesn't change the output, including for test
+//* ROMs that can only be checked by looking at them.
+//*
+//* The samples are read out when a frame completes, before the APU has ended
+//* its audio frame, so the audio hash for a frame covers the samples from the
+//* frame before it.
+//*
+//* The file has a header line with the hash of the PRG ROM, and then one line
+//* per frame with the frame number and the two hashes in hex.
+
+//* Set up by the -g and -G options. Either, both or neither may be given.
+extern char const *frame_hash_record_file;
+extern char const *frame_hash_check_file;
+
+inline bool frame_hashes_enabled() {
+    return frame_hash_record_file || frame_hash_check_file;
+}
+
+//* Loads the golden hashes from frame_hash_check_file and creates
+//* frame_hash_record_file, as set. Call once the ROM is loaded. Returns false
+//* if either file can't be used.
+bool start_frame_hashes();
+
+//* Number of frames in the golden hashes, or 0 if there are none
+unsigned long golden_frame_count();
+
+//* Hashes frame number 'frame' (counting from 0) and compares it against the
+//* golden hashes, if any. 'pixels' is the frame as 256x240 RGB pixels.
+void hash_frame(unsigned long frame, uint32_t const *pixels,
+                int16_t const *samples, size_t n_samples);
+
+//* Closes frame_hash_record_file, if set, and reports how the run compared to
+//* the golden hashes. Returns false if any frame differed or emulation ended by
+//* itself before the frame limit and the golden frames had been reached.
+bool end_frame_hashes();
@@ -0,0 +1,208 @@
+#include "common.h"
+
+#include "audio.h"
+#include "benchmark.h"
+#include "cpu.h"
+#include "frame_hashes.h"
+#include "input.h"
+#include "save_states.h"
+#include "scheduler.h"
+#include "test.h"
+#include "timing.h"
+#include "video.h"
+#include "backend.h"
+#include "headless_backend.h"
+
+//* Configuration flags
+bool bVerbose = false;
+bool bExtraVerbose = false;
+
+bool bRunTests = false;
+bool bForcePAL = false;
+bool bForceNTSC = false;
+bool bAPUThread = false;
+bool bAccurateAudio = false;
+
+unsigned long headless_frame_limit = 0;
+CONSOLE_LOCAL unsigned long headless_frames_run;
+bool headless_benchmark = false;
+
+#ifdef MULTI_CONSOLE
+CONSOLE_LOCAL unsigned long headless_pause_frame;
+static CONSOLE_LOCAL void (*headless_idle_fn)();
+#endif
+
+//* Our screen buffer. Nothing displays it, so it's only converted to RGB when
+//* asked for.
+static CONSOLE_LOCAL Frame    frame;
+static CONSOLE_LOCAL uint32_t rgb_frame_buffer[240*256] __attribute__((aligned(32)));
+
+//* Nothing plays the audio, so we drain the ring buffer once per frame to keep
+//* it from filling up. Comfortably larger than one frame of samples.
+static CONSOLE_LOCAL int16_t audio_sink[sample_rate/10];
+
+uint32_t const *headless_frame_buffer() {
+    frame_to_rgb(frame, rgb_frame_buffer);
+    return rgb_frame_buffer;
+}
+
+//* Scripted input for benchmarks and frame hashes. Deterministic, so that runs
+//* are comparable.
+//* Start is pressed briefly every four seconds to get past title screens and
+//* pause menus, and a pseudo-random combination of the other buttons is held
+//* the rest of the time, changing every eight frames.
+static void apply_scripted_input() {
+    for (unsigned i = 0; i < 8; ++i)
+        clear_button_state(0, i);
+
+    if (headless_frames_run % 240 < 6) {
+        set_button_state(0, 3); //* Start
+        return;
+    }
+
+    //* Knuth's multiplicative hash of the eight-frame period
+    unsigned const pattern = ((headless_frames_run/8)*2654435761u) >> 24;
+    //* A, B, Up, Down, Left, Right (but not Select or Start)
+    static unsigned const buttons[] = { 0, 1, 4, 5, 6, 7 };
+    for (unsigned i = 0; i < ARRAY_LEN(buttons); ++i)
+        if (NTH_BIT(pattern, i))
+            set_button_state(0, buttons[i]);
+}
+
+void draw_frame() {
+    //* end_audio_frame() runs right after this, so this drains the samples
+    //* from the previous frame. Only read what's there, so that it doesn't
+    //* count as an underrun.
+    size_t const n_samples = min(samples_avail(), ARRAY_LEN(audio_sink));
+    read_samples(audio_sink, n_samples);
+
+    //* Nothing is displayed, but this counts skipped frames and decides
+    //* whether the PPU skips the next one, for measuring frameskip
+    end_output_frame();
+
+    if (frame_hashes_enabled())
+        hash_frame(headless_frames_run, headless_frame_buffer(), audio_sink,
+                   n_samples);
+
+    if (headless_benchmark || frame_hashes_enabled())
+        apply_scripted_input();
+
+    if (++headless_frames_run == headless_frame_limit) {
+        //* The limit covers the whole run, including the entire test list
+        if (bRunTests)
+            end_testing = true;
+        end_emulation();
+    }
+
+#ifdef MULTI_CONSOLE
+    if (headless_frames_run == headless_pause_frame)
+        running_state = false;
+#endif
+}
+
+//* No audio device, so there is nothing to lock or start
+void lock_audio() {}
+void unlock_audio() {}
+void start_audio_playback() {}
+void stop_audio_playback() {}
+
+//* Frontend hooks. There is no GUI to return to, so emulation is never paused,
+//* except on console threads.
+
+void frontend_idle() {
+#ifdef MULTI_CONSOLE
+    if (headless_idle_fn) {
+        headless_idle_fn();
+        return;
+    }
+#endif
+    running_state = true;
+}
+void frontend_stop_emulation() { end_emulation(); }
+
+void frontend_show_message(string const &msg) {
+    if (bVerbose)
+        puts(msg.c_str());
+}
+
+void frontend_tests_finished() {}
+
+static void start_headless_run() {
+    output_frame = &frame;
+    skip_frame = false;
+    frames_skipped = 0;
+    headless_frames_run = 0;
+    running_state = true;
+}
+
+void run_headless() {
+    start_headless_run();
+
+    if (headless_benchmark)
+        start_benchmark_profiling();
+
+    //* With run-ahead, more frames are emulated than are shown
+    unsigned long const start_frames = frames_emulated;
+    uint64_t const start_cycles = cpu_cycles_emulated;
+#ifdef BENCHMARK
+    uint64_t const start_instructions = cpu_instructions_run;
+#endif
+    uint64_t const start_time = get_host_time_ns();
+
+    if (bRunTests)
+        run_tests();
+    else
+        run();
+
+    uint64_t const elapsed = get_host_time_ns() - start_time;
+
+    if (headless_benchmark) {
+        stop_benchmark_profiling();
+#ifdef BENCHMARK
+        uint64_t const instructions = cpu_instructions_run - start_instructions;
+#else
+        uint64_t const instructions = 0;
+#endif
+        print_benchmark_report(headless_frames_run,
+                               frames_emulated - start_frames,
+                               cpu_cycles_emulated - start_cycles,
+                               instructions, elapsed);
+        if (rewind_budget != 0)
+            print_rewind_stats();
+        if (run_ahead_frames != 0)
+            print_run_ahead_stats();
+    }
+    else {
+        double const secs = elapsed/1e9;
+        printf("Emulated %lu frames in %.3f secs (%.1f FPS).\n",
+               headless_frames_run, secs, secs > 0 ? headless_frames_run/secs : 0.0);
+    }
+
+    if (frameskip != 0 || auto_frameskip)
+        printf("Skipped %lu of %lu frames.\n", frames_skipped, headless_frames_run);
+}
+
+void run_headless_quietly(unsigned long frame_limit) {
+    start_headless_run();
+    headless_frame_limit = frame_limit;
+    run();
+}
+
+#ifdef MULTI_CONSOLE
+void init_headless_console(void (*idle_fn)()) {
+    output_frame = &frame;
+    headless_idle_fn = idle_fn;
+}
+#endif
+
+void run_headless_idle_cycles(uint64_t cycles) {
+    output_frame = &frame;
+
+    uint64_t const start_events = events_dispatched;
+    uint64_t const start_time   = get_host_time_ns();
+
+    run_idle_cycles(cycles);
+
+    print_idle_cycles_report(cycles, events_dispatched - start_events,
+                             get_host_time_ns() - start_time);
+}
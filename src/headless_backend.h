@@ -0,0 +1,40 @@
+#pragma once
+
+//* Display-free backend for batch and server runs. There is no window, no
+//* audio device and no frame pacing - the emulation runs flat out on the
+//* calling thread, driving the same CPU/PPU/APU core as the SDL build.
+
+//* Emulation stops after this many frames. 0 means no limit.
+extern unsigned long headless_frame_limit;
+//* Frames completed since run_headless() was called
+extern CONSOLE_LOCAL unsigned long headless_frames_run;
+//* If true, feed the scripted input pattern to controller 1 (as is also done
+//* for frame hashes) and print a benchmark report (see benchmark.h) when
+//* emulation ends
+extern bool headless_benchmark;
+
+#ifdef MULTI_CONSOLE
+//* For console threads (see console.cpp). Emulation pauses once
+//* headless_frames_run reaches headless_pause_frame.
+extern CONSOLE_LOCAL unsigned long headless_pause_frame;
+
+//* Sets up the calling thread to run a console. frontend_idle() calls
+//* 'idle_fn' while paused instead of resuming right away.
+void init_headless_console(void (*idle_fn)());
+#endif
+
+//* The last completed frame as 256x240 RGB pixels, converted on each call
+uint32_t const *headless_frame_buffer();
+
+//* Runs the loaded ROM (or the test list, if tests were set up) until the frame
+//* limit is hit or emulation ends by itself
+void run_headless();
+
+//* Runs the loaded ROM until emulation ends by itself or 'frame_limit' frames
+//* have run (0 for no limit), without reporting anything. Sets
+//* headless_frame_limit. Used to run single test ROMs (see test_runner.h).
+void run_headless_quietly(unsigned long frame_limit);
+
+//* Times 'cycles' CPU cycles of the loaded ROM with no instructions executed
+//* and prints a report. A microbenchmark for the per-cycle overhead.
+void run_headless_idle_cycles(uint64_t cycles);
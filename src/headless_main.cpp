@@ -0,0 +1,291 @@
+#include "common.h"
+#include "cpu.h"
+#include "apu.h"
+#include "apu_synth.h"
+#include "mapper.h"
+#include "rom.h"
+#include "save_states.h"
+#include "test.h"
+#include "video.h"
+
+#include "backend.h"
+#include "benchmark.h"
+#include "frame_hashes.h"
+#include "movie.h"
+#include "headless_backend.h"
+#include "test_runner.h"
+#ifdef MULTI_CONSOLE
+#  include "console.h"
+#endif
+
+static void print_usage(char const *prog) {
+    printf("usage: %s [-v] [-d] [-n|-p] [-b] [-l frames] [-r KB] [-s frames] [-m cycles] [-a] [-q] [-k frames] [-j frames] [-c consoles] [-w workers] [-T frames] [-o results] [-g hashes] [-G hashes] [-M movie [-E frames]] [-P movie] (-f rom.nes | -t testlist.txt | -x changes | -X)\n"
+           "  -f  Load and run the specified ROM\n"
+           "  -t  Run through the ROMs listed in the text-file\n"
+           "  -w  Run the tests in parallel, this many at a time in separate processes (0: one per core)\n"
+           "  -T  With parallel tests, time a test out after this many frames (default: %lu)\n"
+           "  -o  With parallel tests, write the results to this file as JSON (or JUnit XML if it ends in .xml)\n"
+           "  -l  Stop after this many frames (default: run until the ROM/tests end)\n"
+           "  -b  Benchmark: use scripted input and report the emulation speed\n"
+           "  -g  Write a hash of each frame's picture and audio to this file (uses scripted input)\n"
+           "  -G  Check each frame's picture and audio against the hashes in this file (-l defaults to its length)\n"
+           "  -M  Record the input to this movie file, from power-on\n"
+           "  -E  With -M, run this many frames first and start the movie from a save state taken then\n"
+           "  -P  Play back the input from this movie file (-l defaults to its length)\n"
+           "  -r  Record rewind snapshots into a buffer of this many KB (default: off)\n"
+           "  -s  Frames between rewind snapshots (default: %u)\n"
+           "  -m  Microbenchmark: time this many CPU cycles with no instructions executed\n"
+           "  -a  Synthesize audio on a separate thread\n"
+           "  -j  Run this many frames ahead to hide input lag (with -b, reports the cost)\n"
+           "  -k  Skip this many frames after each one produced (no pixel output on skipped frames)\n"
+           "  -c  Run the ROM on this many consoles at once, each on its own thread (needs -l and a 'make headless MULTI=1' build)\n"
+           "  -q  Use band-limited (higher quality, slower) audio synthesis\n"
+           "  -x  Microbenchmark: time this many audio signal changes with each blip_buf variant (no ROM needed)\n"
+           "  -X  Check the integer audio mixer against floating-point mixing (no ROM needed)\n"
+           "  -n  Force NTSC\n"
+           "  -p  Force PAL\n"
+           "  -v  Verbose\n"
+           "  -d  Debug (even more verbose)\n", prog, default_test_frame_timeout,
+           default_rewind_interval);
+}
+
+//* Program Entry Point for the display-free build
+int main(int argc, char *argv[]) {
+
+    setvbuf (stdout, NULL, _IONBF, 0);
+
+    //* Load NES Modules.
+    init_apu();
+    init_mappers();
+
+    char const *rom_file = NULL;
+    uint64_t idle_cycles = 0;
+    unsigned long audio_changes = 0;
+    bool mixer_check = false;
+    unsigned n_consoles = 0;
+
+    //* Parallel test runner (see test_runner.h). Any of its options enable it.
+    bool parallel_tests = false;
+    unsigned test_workers = 0;
+    unsigned long test_frame_timeout = default_test_frame_timeout;
+    char const *test_results_file = NULL;
+
+    //* Input movies (see movie.h)
+    char const *movie_record_file = NULL;
+    char const *movie_play_file = NULL;
+    unsigned long movie_start_frame = 0;
+
+    //* Nothing can rewind here, so only record snapshots when asked to (to
+    //* measure the overhead)
+    rewind_budget = 0;
+
+    //* Parsing command-line arguments.
+    int opt;
+    while ((opt = getopt(argc, argv, "t:pnf:vdl:br:s:m:aqx:Xk:j:c:w:T:o:g:G:M:E:P:")) != -1) {
+        switch (opt) {
+            case 'v':
+                bVerbose = true;
+                break;
+            case 'd':
+                bVerbose = true;
+                bExtraVerbose = true;
+                break;
+            case 't':
+                setup_tests(optarg);
+                break;
+            case 'p':
+                bForcePAL = true;
+                break;
+            case 'n':
+                bForceNTSC = true;
+                break;
+            case 'f':
+                rom_file = optarg;
+                break;
+            case 'l':
+                headless_frame_limit = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                headless_benchmark = true;
+                break;
+            case 'r':
+                rewind_budget = 1024*strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                rewind_interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                idle_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'a':
+                bAPUThread = true;
+                break;
+            case 'q':
+                bAccurateAudio = true;
+                break;
+            case 'j':
+                run_ahead_frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                //* "auto" needs an audio device to go by
+                if (!parse_frameskip(optarg) || auto_frameskip) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'x':
+                audio_changes = strtoul(optarg, NULL, 0);
+                break;
+            case 'X':
+                mixer_check = true;
+                break;
+            case 'c':
+                n_consoles = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                parallel_tests = true;
+                test_workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'T':
+                parallel_tests = true;
+                test_frame_timeout = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                parallel_tests = true;
+                test_results_file = optarg;
+                break;
+            case 'g':
+                frame_hash_record_file = optarg;
+                break;
+            case 'G':
+                frame_hash_check_file = optarg;
+                break;
+            case 'M':
+                movie_record_file = optarg;
+                break;
+            case 'E':
+                movie_start_frame = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                movie_play_file = optarg;
+                break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (bForcePAL && bForceNTSC){
+        puts("Cannot force both PAL and NTSC.. Ignoring both options");
+        bForcePAL = bForceNTSC = false;
+    }
+
+    if (audio_changes != 0){
+        run_audio_benchmark(audio_changes);
+        return 0;
+    }
+
+    if (mixer_check)
+        return check_mixer() ? 0 : 1;
+
+#ifdef MULTI_CONSOLE
+    //* The synthesis thread would see its own state rather than the console's
+    if (bAPUThread){
+        puts("-a is not supported with MULTI=1 builds");
+        return 1;
+    }
+    //* The main thread is a console too. Loading a ROM touches output_frame.
+    init_headless_console(0);
+#endif
+
+    //* Skipped frames have no pixels, and the audio from the synthesis thread
+    //* isn't in step with the frames. With run-ahead, the frames shown come
+    //* from the run-ahead timeline and the audio is drained a frame late.
+    if (frame_hashes_enabled() &&
+        (frameskip != 0 || bAPUThread || run_ahead_frames != 0 ||
+         n_consoles != 0 || idle_cycles != 0 || bRunTests)){
+        puts("-g and -G can't be used with -k, -a, -j, -c, -m or -t");
+        return 1;
+    }
+
+    if ((movie_record_file || movie_play_file) &&
+        ((movie_record_file && movie_play_file) || n_consoles != 0 ||
+         idle_cycles != 0 || bRunTests)){
+        puts("-M and -P can't be used together or with -c, -m or -t");
+        return 1;
+    }
+
+    if (movie_start_frame != 0 && !movie_record_file){
+        puts("-E needs a movie to record to (-M)");
+        return 1;
+    }
+
+    if (n_consoles != 0){
+#ifdef MULTI_CONSOLE
+        if (!rom_file || bRunTests || headless_frame_limit == 0){
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_headless_consoles(rom_file, n_consoles) ? 0 : 1;
+#else
+        puts("-c needs a 'make headless MULTI=1' build");
+        return 1;
+#endif
+    }
+
+    if (parallel_tests){
+        if (!bRunTests){
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_tests_in_parallel(testlist_filename, test_workers,
+                                     test_frame_timeout, test_results_file) ? 0 : 1;
+    }
+
+    if (bRunTests){
+        run_headless();
+        return 0;
+    }
+
+    if (!rom_file){
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!load_rom(rom_file)){
+        return 1;
+    }
+
+    //* The movie starts when run() powers on
+    if (movie_record_file && !record_movie(movie_record_file, movie_start_frame))
+        return 1;
+    if (movie_play_file){
+        if (!play_movie(movie_play_file))
+            return 1;
+        if (headless_frame_limit == 0)
+            headless_frame_limit = movie_length();
+    }
+
+    if (frame_hashes_enabled()){
+        if (!start_frame_hashes())
+            return 1;
+        if (headless_frame_limit == 0)
+            headless_frame_limit = golden_frame_count();
+        if (headless_frame_limit == 0){
+            puts("-g needs a frame limit (-l)");
+            return 1;
+        }
+        run_headless();
+        bool const ok = end_frame_hashes();
+        unload_rom();
+        return ok ? 0 : 1;
+    }
+
+    if (idle_cycles != 0)
+        run_headless_idle_cycles(idle_cycles);
+    else
+        run_headless();
+    unload_rom();
+
+    return 0;
+}
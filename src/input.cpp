@@ -2,15 +2,35 @@
 #include "common.h"
 #include "input.h"
 
-static struct Controller_data {
+static CONSOLE_LOCAL struct Controller_data {
     //* Button states
     bool left_pushed, right_pushed, up_pushed, down_pushed,
          a_pushed, b_pushed, start_pushed, select_pushed;
 } controller_data[2];
 
-bool reset_pushed;
+CONSOLE_LOCAL bool reset_pushed;
+
+//* Button states seen by the game while a movie is recorded or played back
+static CONSOLE_LOCAL bool    movie_input_active;
+static CONSOLE_LOCAL uint8_t movie_buttons[2];
 
 uint8_t read_button_states(unsigned n) {
+    if (movie_input_active)
+        return movie_buttons[n];
+    return read_frontend_button_states(n);
+}
+
+void set_movie_input(uint8_t const buttons[2]) {
+    movie_input_active = true;
+    movie_buttons[0] = buttons[0];
+    movie_buttons[1] = buttons[1];
+}
+
+void end_movie_input() {
+    movie_input_active = false;
+}
+
+uint8_t read_frontend_button_states(unsigned n) {
     Controller_data &c = controller_data[n];
     return (c.right_pushed << 7) | (c.left_pushed  << 6) | (c.down_pushed   << 5) |
            (c.up_pushed    << 4) | (c.start_pushed << 3) | (c.select_pushed << 2) |
@@ -1,9 +1,19 @@
 
+//* Button states as seen by the game, one bit per button:
+//* Right, Left, Down, Up, Start, Select, B, A (from bit 7 to bit 0)
 uint8_t read_button_states(unsigned n);
 uint8_t set_button_state(unsigned n, unsigned i);
 uint8_t clear_button_state(unsigned n, unsigned i);
 
-extern bool reset_pushed;
+//* While a movie is recorded or played back (see movie.h), the game sees
+//* 'buttons' (for controllers 1 and 2) instead of the button states set by the
+//* frontend, so that input only changes at frame boundaries
+void set_movie_input(uint8_t const buttons[2]);
+void end_movie_input();
+//* The button states set by the frontend, even while movie input is in effect
+uint8_t read_frontend_button_states(unsigned n);
+
+extern CONSOLE_LOCAL bool reset_pushed;
 
 template<bool calculating_size, bool is_save>
 void transfer_input_state(uint8_t *&buf);
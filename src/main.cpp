@@ -4,7 +4,10 @@
 #include "cpu.h"
 #include "apu.h"
 #include "mapper.h"
+#include "movie.h"
+#include "save_states.h"
 #include "test.h"
+#include "video.h"
 
 #include "sdl_backend.h"
 #include "sdl_frontend.h"
@@ -19,9 +22,14 @@ int main(int argc, char *argv[]) {
     init_apu();
     init_mappers();
 
+    //* Input movies, started once emulation powers on
+    char const *movie_record_file = NULL;
+    char const *movie_play_file = NULL;
+    unsigned long movie_start_frame = 0;
+
     //* Parsing command-line arguments.
     int opt;
-    while ((opt = getopt(argc, argv, "t:pnf:vd")) != -1) {
+    while ((opt = getopt(argc, argv, "t:pnf:vdr:s:aqk:j:M:E:P:")) != -1) {
         switch (opt) {
             case 'v':
                 puts("Verbose Mode Enabled.");
@@ -37,6 +45,7 @@ int main(int argc, char *argv[]) {
                 //* Run NES Tests
                 if (optarg != NULL){
                     setup_tests(optarg);
+                    bShowGUI=false;
                 }
                 break;
             case 'p':
@@ -59,6 +68,45 @@ int main(int argc, char *argv[]) {
                     bForceNTSC=false;
                 }
                 break;
+            case 'r':
+                //* Rewind buffer size in KB, 0 to disable rewinding
+                rewind_budget = 1024*strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                //* Frames between rewind snapshots
+                rewind_interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                //* Synthesize audio on a separate thread
+                bAPUThread = true;
+                break;
+            case 'q':
+                //* Higher-quality (band-limited) audio synthesis
+                bAccurateAudio = true;
+                break;
+            case 'j':
+                //* Frames to run ahead, 0 to disable run-ahead
+                run_ahead_frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'M':
+                //* Record the input to a movie
+                movie_record_file = optarg;
+                break;
+            case 'E':
+                //* Frames to run before recording, from a save state taken then
+                movie_start_frame = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                //* Play back the input from a movie
+                movie_play_file = optarg;
+                break;
+            case 'k':
+                //* Frameskip: a fixed number of frames, or "auto"
+                if (!parse_frameskip(optarg)){
+                    printf("Invalid frameskip '%s' - expected a number of frames or 'auto'\n", optarg);
+                    return 1;
+                }
+                break;
             case 'f':
                 if (!bRunTests){
                     //* Try Loading the supplied ROM
@@ -74,6 +122,21 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (movie_record_file && movie_play_file){
+        puts("Cannot record and play back a movie at the same time");
+        return 1;
+    }
+    if (movie_start_frame != 0 && !movie_record_file){
+        puts("-E needs a movie to record to (-M)");
+        return 1;
+    }
+    if (movie_record_file && !record_movie(movie_record_file, movie_start_frame)){
+        return 1;
+    }
+    if (movie_play_file && !play_movie(movie_play_file)){
+        return 1;
+    }
+
     //* Show SDL version info
     if (bVerbose){
         SDL_version sdl_compiled_version, sdl_linked_version;
@@ -2,11 +2,11 @@
 #include "common.h"
 #include "cpu.h"
 #include "mapper.h"
+#include "ppu.h"
 #include "rom.h"
 
 static uint8_t nop_read(uint16_t) { return cpu_data_bus; } //* Return open bus by default
 static void    nop_write(uint8_t, uint16_t) {}
-static void    nop_ppu_tick_callback() {}
 
 //* Implicitly NULL-initialized
 Mapper_fns mapper_fns_table[256];
@@ -34,21 +34,22 @@ void init_mappers() {
     //* No mapper (hardwired/NROM)
     #define MAPPER_NONE(n)                                           \
       MAPPER_COMMON(n)                                               \
+      mapper_fns_table[n].mapper_class      = MAPPER_CLASS_NONE;     \
       mapper_fns_table[n].read              = nop_read;              \
-      mapper_fns_table[n].write             = nop_write;             \
-      mapper_fns_table[n].ppu_tick_callback = nop_ppu_tick_callback;
+      mapper_fns_table[n].write             = nop_write;
 
     //* Mapper that only reacts to writes
     #define MAPPER_W(n)                                              \
       MAPPER_COMMON(n)                                               \
+      mapper_fns_table[n].mapper_class      = MAPPER_CLASS_W;        \
       void mapper_##n##_write(uint8_t, uint16_t);                    \
       mapper_fns_table[n].read              = nop_read;              \
-      mapper_fns_table[n].write             = mapper_##n##_write;    \
-      mapper_fns_table[n].ppu_tick_callback = nop_ppu_tick_callback;
+      mapper_fns_table[n].write             = mapper_##n##_write;
 
     //* Mapper that reacts to writes and PPU events
     #define MAPPER_WP(n)                                                      \
       MAPPER_COMMON(n)                                                        \
+      mapper_fns_table[n].mapper_class      = MAPPER_CLASS_WP;                \
       void mapper_##n##_write(uint8_t, uint16_t);                             \
       void mapper_##n##_ppu_tick_callback();                                  \
       mapper_fns_table[n].read              = nop_read;                       \
@@ -59,6 +60,7 @@ void init_mappers() {
     //* (n)ametable mirroring (e.g. MMC5)
     #define MAPPER_RWPN(n)                                                    \
       MAPPER_COMMON(n)                                                        \
+      mapper_fns_table[n].mapper_class      = MAPPER_CLASS_RWPN;              \
       uint8_t mapper_##n##_read(uint16_t);                                    \
       void mapper_##n##_write(uint8_t, uint16_t);                             \
       void mapper_##n##_ppu_tick_callback();                                  \
@@ -101,6 +103,10 @@ void init_mappers() {
     //* Camerica/Capcom mapper used by the Quattro * games
     MAPPER_W(   232)
 
+    //* Scanline IRQ counters clocked by PPU activity
+    mapper_fns_table[4].ppu_irqs = true;
+    mapper_fns_table[5].ppu_irqs = true;
+
     #undef MAPPER_COMMON
     #undef MAPPER_NONE
     #undef MAPPER_W
@@ -112,23 +118,72 @@ void init_mappers() {
 //* Memory mapping
 //*
 
-//* PRG is split up into four 8 KB pages to handle memory mapping. This is the
-//* finest granularity switched by any mapper. These pointers point to the
-//* beginning of each page.
-static uint8_t *prg_pages[4];
-static bool prg_page_is_ram[4]; //* MMC5 can map WRAM into the $8000+ range
-
-uint8_t read_prg(uint16_t addr) {
-    return prg_pages[(addr >> 13) & 3][addr & 0x1FFF];
-}
+CONSOLE_LOCAL uint8_t *prg_pages[4];
+static CONSOLE_LOCAL bool prg_page_is_ram[4]; //* MMC5 can map WRAM into the $8000+ range
 
 void write_prg(uint16_t addr, uint8_t val) {
     if (prg_page_is_ram[(addr >> 13) & 3])
         prg_pages[(addr >> 13) & 3][addr & 0x1FFF] = val;
 }
 
+CONSOLE_LOCAL uint8_t *cpu_read_pages[256];
+CONSOLE_LOCAL uint8_t *cpu_write_pages[256];
+
+//* Keeps the CPU page tables in step with prg_pages[n]
+static void map_prg_page(unsigned n) {
+    for (unsigned i = 0; i < 32; ++i) {
+        uint8_t *const page = prg_pages[n] + 0x100*i;
+        cpu_read_pages [0x80 + 32*n + i] = page;
+        cpu_write_pages[0x80 + 32*n + i] = prg_page_is_ram[n] ? page : NULL;
+    }
+}
+
 //* CHR is split up into eight 1 KB pages
-uint8_t *chr_pages[8];
+CONSOLE_LOCAL uint8_t *chr_pages[8];
+
+//* Decoded rows for all of chr_base, two bytes of CHR per row
+static CONSOLE_LOCAL Chr_row *chr_rows;
+CONSOLE_LOCAL Chr_row *chr_row_pages[8];
+
+static void decode_chr_row(Chr_row &row, uint8_t const *tile_row) {
+    row.pixels = spread_pattern_bits(tile_row[0]) |
+                 (spread_pattern_bits(tile_row[8]) << 1);
+}
+
+//* Decodes rows from the start of chr_base up to (not including) 'end'
+static void decode_chr_rows(size_t end) {
+    for (size_t offset = 0; offset < end; offset += 16)
+        for (unsigned y = 0; y < 8; ++y)
+            decode_chr_row(chr_rows[offset/2 + y], chr_base + offset + y);
+}
+
+bool init_chr_rows() {
+    if (!(chr_rows = new (std::nothrow) Chr_row[0x1000*chr_8k_banks])) {
+        printf("failed to allocate %u KB for decoded CHR", 8*chr_8k_banks);
+        return false;
+    }
+    decode_chr_rows(0x2000*chr_8k_banks);
+    return true;
+}
+
+void deinit_chr_rows() {
+    free_array_set_null(chr_rows);
+}
+
+void update_chr_row(unsigned addr) {
+    uint8_t *const page = chr_pages[(addr >> 10) & 7];
+    decode_chr_row(chr_row_pages[(addr >> 10) & 7][((addr & 0x3F0) >> 1) | (addr & 7)],
+                   page + (addr & 0x3F7));
+}
+
+void update_all_chr_rows() {
+    decode_chr_rows(0x2000*chr_8k_banks);
+}
+
+//* Keeps chr_row_pages[n] in step with chr_pages[n]
+static void set_chr_row_page(unsigned n) {
+    chr_row_pages[n] = chr_rows + (chr_pages[n] - chr_base)/2;
+}
 
 void set_prg_32k_bank(unsigned bank) {
     if (prg_16k_banks == 1) {
@@ -143,8 +198,10 @@ void set_prg_32k_bank(unsigned bank) {
             prg_pages[i] = bank_ptr + 0x2000*i;
     }
 
-    for (unsigned i = 0; i < 4; ++i)
+    for (unsigned i = 0; i < 4; ++i) {
         prg_page_is_ram[i] = false;
+        map_prg_page(i);
+    }
 }
 
 void set_prg_16k_bank(unsigned n, int bank, bool is_ram /* = false */) {
@@ -168,6 +225,7 @@ void set_prg_16k_bank(unsigned n, int bank, bool is_ram /* = false */) {
     for (unsigned i = 0; i < 2; ++i) {
         prg_pages[2*n + i] = bank_ptr + 0x2000*i;
         prg_page_is_ram[2*n + i] = is_ram;
+        map_prg_page(2*n + i);
     }
 }
 
@@ -190,48 +248,78 @@ void set_prg_8k_bank(unsigned n, int bank, bool is_ram /* = false */) {
 
     prg_pages[n] = base + 0x2000*(bank & mask);
     prg_page_is_ram[n] = is_ram;
+    map_prg_page(n);
 }
 
 void set_chr_8k_bank(unsigned bank) {
     uint8_t *const bank_ptr = chr_base + 0x2000*(bank & (chr_8k_banks - 1));
-    for (unsigned i = 0; i < 8; ++i)
+    for (unsigned i = 0; i < 8; ++i) {
         chr_pages[i] = bank_ptr + 0x400*i;
+        set_chr_row_page(i);
+    }
 }
 
 void set_chr_4k_bank(unsigned n, unsigned bank) {
     assert(n < 2);
     uint8_t *const bank_ptr = chr_base + 0x1000*(bank & (2*chr_8k_banks - 1));
-    for (unsigned i = 0; i < 4; ++i)
+    for (unsigned i = 0; i < 4; ++i) {
         chr_pages[4*n + i] = bank_ptr + 0x400*i;
+        set_chr_row_page(4*n + i);
+    }
 }
 
 void set_chr_2k_bank(unsigned n, unsigned bank) {
     assert(n < 4);
     uint8_t *const bank_ptr = chr_base + 0x800*(bank & (4*chr_8k_banks - 1));
-    for (unsigned i = 0; i < 2; ++i)
+    for (unsigned i = 0; i < 2; ++i) {
         chr_pages[2*n + i] = bank_ptr + 0x400*i;
+        set_chr_row_page(2*n + i);
+    }
 }
 
 void set_chr_1k_bank(unsigned n, unsigned bank) {
     assert(n < 8);
     chr_pages[n] = chr_base + 0x400*(bank & (8*chr_8k_banks - 1));
+    set_chr_row_page(n);
 }
 
-uint8_t *wram_6000_page;
+CONSOLE_LOCAL uint8_t *wram_6000_page;
 
 void set_wram_6000_bank(unsigned bank) {
     wram_6000_page = wram_base + 0x2000*(bank & (wram_8k_banks - 1));
+    map_wram_6000_page();
+}
+
+void map_wram_6000_page() {
+    //* Without WRAM, $6000-$7FFF is open bus
+    for (unsigned i = 0; i < 32; ++i)
+        cpu_read_pages[0x60 + i] = cpu_write_pages[0x60 + i] =
+          wram_6000_page ? wram_6000_page + 0x100*i : NULL;
 }
 
 //*
 //* Mirroring
 //*
 
-Mirroring mirroring;
+CONSOLE_LOCAL Mirroring mirroring;
+
+CONSOLE_LOCAL uint8_t *nt_pages[4];
+CONSOLE_LOCAL bool nt_reads_via_mapper;
 
 void set_mirroring(Mirroring m) {
     //* In four-screen mode, the cart is assumed to be wired so that the mapper
     //* can't influence mirroring
     if (mirroring != FOUR_SCREEN)
         mirroring = m;
+
+    //* CIRAM page for each of the four nametables
+    static unsigned const ciram_pages[N_MIRRORING_MODES][4] = {
+      { 0, 0, 1, 1 },   //* HORIZONTAL
+      { 0, 1, 0, 1 },   //* VERTICAL
+      { 0, 0, 0, 0 },   //* ONE_SCREEN_LOW
+      { 1, 1, 1, 1 },   //* ONE_SCREEN_HIGH
+      { 0, 1, 2, 3 } }; //* FOUR_SCREEN
+
+    for (unsigned i = 0; i < 4; ++i)
+        nt_pages[i] = ciram + 0x400*ciram_pages[mirroring][i];
 }
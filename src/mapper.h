@@ -1,7 +1,20 @@
 //** Common mapper-related functionality
 
+//* Mappers are grouped into classes by which callbacks they implement (see
+//* init_mappers()). The PPU loop is specialized for each class at compile
+//* time, so that callbacks a mapper doesn't have cost nothing.
+enum Mapper_class {
+    MAPPER_CLASS_NONE, //* No mapper (hardwired/NROM)
+    MAPPER_CLASS_W,    //* Reacts to writes
+    MAPPER_CLASS_WP,   //* Reacts to writes and PPU events
+    MAPPER_CLASS_RWPN  //* Reacts to reads, writes, PPU events, and has special
+                       //* (n)ametable mirroring
+};
+
 //* Table of mapper-specific functions
 extern struct Mapper_fns {
+    Mapper_class mapper_class;
+
     void    (*init)();
 
     //* Reacting to CPU reads and writes
@@ -13,8 +26,11 @@ extern struct Mapper_fns {
     void    (*write_nt)(uint8_t val, uint16_t addr);
 
     //* Called each PPU tick. For mappers that snoop on PPU activity (the VRAM
-    //* address bus).
+    //* address bus). NULL for other mappers.
     void    (*ppu_tick_callback)();
+    //* True if ppu_tick_callback() can raise IRQs. The PPU then runs in
+    //* lock-step with the CPU, as the IRQ timing can't be predicted.
+    bool    ppu_irqs;
 
     //* Saving and loading of mapper-specific state
     size_t  (*state_size)(uint8_t*&);
@@ -28,10 +44,26 @@ void init_mappers();
 //* Memory mapping
 //*
 
-//* For accessing the $8000+ range. Takes an ordinary CPU address.
-uint8_t read_prg(uint16_t addr);
+//* PRG is split up into four 8 KB pages to handle memory mapping. This is the
+//* finest granularity switched by any mapper. These pointers point to the
+//* beginning of each page.
+extern CONSOLE_LOCAL uint8_t *prg_pages[4];
+
+//* For accessing the $8000+ range. Takes an ordinary CPU address. Reading is
+//* inline as it happens for nearly every instruction fetch.
+inline uint8_t read_prg(uint16_t addr) {
+    return prg_pages[(addr >> 13) & 3][addr & 0x1FFF];
+}
 void write_prg(uint16_t addr, uint8_t val);
 
+//* The CPU address space split up into 256-byte pages, for read_mem() and
+//* write_mem(). Each entry points to the memory mapped at the start of the
+//* page, or is NULL if accesses to the page need special handling (registers,
+//* open bus, and writes to ROM). Kept up to date by the bank switching
+//* functions below. The RAM pages are filled in by the CPU.
+extern CONSOLE_LOCAL uint8_t *cpu_read_pages[256];
+extern CONSOLE_LOCAL uint8_t *cpu_write_pages[256];
+
 //* Memory remapping functions. 'n' specifies the slot, 'bank' the bank to map
 //* there. Both are in units corresponding to the function.
 //*
@@ -46,21 +78,56 @@ void set_prg_32k_bank(unsigned bank);
 void set_prg_16k_bank(unsigned n, int bank, bool is_ram = false);
 void set_prg_8k_bank (unsigned n, int bank, bool is_ram = false);
 
-extern uint8_t *chr_pages[8];
+extern CONSOLE_LOCAL uint8_t *chr_pages[8];
 
 void set_chr_8k_bank(unsigned bank);
 void set_chr_4k_bank(unsigned n, unsigned bank);
 void set_chr_2k_bank(unsigned n, unsigned bank);
 void set_chr_1k_bank(unsigned n, unsigned bank);
 
+//* Decoded CHR. Each tile row (the bytes at 16*tile + y and 16*tile + y + 8) is
+//* also kept as eight two-bit pixels with the leftmost pixel in the top bits,
+//* so that renderers can fetch a whole row of pixels with one load. Paged in
+//* parallel with chr_pages by the set_chr_*_bank() functions.
+struct Chr_row {
+    uint16_t pixels;
+};
+
+extern CONSOLE_LOCAL Chr_row *chr_row_pages[8];
+
+//* Spreads the bits of 'b' out to the even bit positions. Combines the two
+//* bitplanes of a tile row into two-bit pixels.
+inline unsigned spread_pattern_bits(unsigned b) {
+    b = (b | (b << 4)) & 0x0F0F;
+    b = (b | (b << 2)) & 0x3333;
+    return (b | (b << 1)) & 0x5555;
+}
+
+//* Returns the decoded row for the pattern address 'addr' (which can be the
+//* address of either bitplane)
+inline Chr_row const &get_chr_row(unsigned addr) {
+    return chr_row_pages[(addr >> 10) & 7][((addr & 0x3F0) >> 1) | (addr & 7)];
+}
+
+//* Allocates and fills in the decoded rows for chr_base. Returns false on
+//* allocation errors.
+bool init_chr_rows();
+void deinit_chr_rows();
+//* Updates the decoded row after a write to CHR RAM at 'addr'
+void update_chr_row(unsigned addr);
+//* Decodes all of CHR RAM again, e.g. after loading a state
+void update_all_chr_rows();
+
 //* 8 KB page mapped at $6000-$7FFF. Used for extra work RAM (WRAM) and/or
 //* saving (SRAM). MMC5 can remap this.
-extern uint8_t *wram_6000_page;
+extern CONSOLE_LOCAL uint8_t *wram_6000_page;
 
 void set_wram_6000_bank(unsigned bank);
+//* Updates the CPU page tables after wram_6000_page has been changed directly
+void map_wram_6000_page();
 
 //* Updating this will require updating mirroring_to_str as well
-extern enum Mirroring {
+extern CONSOLE_LOCAL enum Mirroring {
     HORIZONTAL      = 0,
     VERTICAL        = 1,
     ONE_SCREEN_LOW  = 2,
@@ -70,8 +137,17 @@ extern enum Mirroring {
     N_MIRRORING_MODES
 } mirroring;
 
+//* Sets 'mirroring' and points nt_pages into CIRAM to match
 void set_mirroring(Mirroring m);
 
+//* The nametables are split up into four 1 KB pages, for $2000, $2400, $2800
+//* and $2C00 (mirrored up to $3EFF). set_mirroring() sets them up for the
+//* standard mirroring modes. Mappers with custom nametable mirroring (e.g.
+//* MMC5) can point them elsewhere, including at memory that isn't CIRAM, and
+//* only need to see reads through read_nt() when nt_reads_via_mapper is set.
+extern CONSOLE_LOCAL uint8_t *nt_pages[4];
+extern CONSOLE_LOCAL bool nt_reads_via_mapper;
+
 //* Helper macros for declaring mapper state that needs to be included in save
 //* states.
 //*
@@ -3,9 +3,9 @@
 #include "common.h"
 #include "mapper.h"
 
-static unsigned temp_reg;
-static unsigned nth_write;
-static unsigned regs[4];
+static CONSOLE_LOCAL unsigned temp_reg;
+static CONSOLE_LOCAL unsigned nth_write;
+static CONSOLE_LOCAL unsigned regs[4];
 
 static void apply_state() {
     switch (regs[0] & 3) {
@@ -3,7 +3,7 @@
 #include "common.h"
 #include "mapper.h"
 
-uint8_t prg_bank, chr_bank;
+CONSOLE_LOCAL uint8_t prg_bank, chr_bank;
 
 static void apply_state() {
     set_prg_32k_bank(prg_bank);
@@ -3,7 +3,7 @@
 #include "common.h"
 #include "mapper.h"
 
-static uint8_t chr_bank;
+static CONSOLE_LOCAL uint8_t chr_bank;
 
 static void apply_state() {
     set_chr_4k_bank(1, chr_bank);
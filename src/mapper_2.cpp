@@ -3,7 +3,7 @@
 #include "common.h"
 #include "mapper.h"
 
-static uint8_t prg_bank;
+static CONSOLE_LOCAL uint8_t prg_bank;
 
 static void apply_state() {
     set_prg_16k_bank(0, prg_bank);
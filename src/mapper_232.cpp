@@ -8,9 +8,9 @@
 
 //* 64 KB block, selected by 0x8000-0x9FFF. Represented as an offset in 16 KB
 //* units - always a multiple of four.
-static uint8_t block;
+static CONSOLE_LOCAL uint8_t block;
 //* 16 KB Page within block, selected by 0xA000-0xFFFF
-static uint8_t page;
+static CONSOLE_LOCAL uint8_t page;
 
 static void apply_state() {
     set_prg_16k_bank(0, block | page);
@@ -8,8 +8,8 @@
 #include "mapper.h"
 
 //* regs[0-3] correspond to R:$00, R:$01, R:$80, and R:$81 in the documentation
-static uint8_t regs[4];
-static unsigned regs_i;
+static CONSOLE_LOCAL uint8_t regs[4];
+static CONSOLE_LOCAL unsigned regs_i;
 
 static void apply_state() {
     set_chr_8k_bank(regs[0] & 3);
@@ -4,18 +4,18 @@
 #include "mapper.h"
 #include "ppu.h"
 
-static unsigned reg_8000;
+static CONSOLE_LOCAL unsigned reg_8000;
 
 //* regs[0-5] define CHR mappings, regs[6-7] PRG mappings
-static unsigned regs[8];
+static CONSOLE_LOCAL unsigned regs[8];
 
-static bool horizontal_mirroring;
+static CONSOLE_LOCAL bool horizontal_mirroring;
 
 //* IRQs
 
-static uint8_t irq_period;
-static uint8_t irq_period_cnt;
-static bool    irq_enabled;
+static CONSOLE_LOCAL uint8_t irq_period;
+static CONSOLE_LOCAL uint8_t irq_period_cnt;
+static CONSOLE_LOCAL bool    irq_enabled;
 
 static void apply_state() {
     //* Second 8K PRG bank fixed to regs[7]
@@ -99,7 +99,7 @@ static void clock_scanline_counter() {
     }
 }
 
-static uint64_t last_a12_high_cycle;
+static CONSOLE_LOCAL uint64_t last_a12_high_cycle;
 
 unsigned const min_a12_rise_diff = 16;
 
@@ -7,7 +7,7 @@
 #include "rom.h"
 
 //* 1 KB of extra on-chip memory
-static uint8_t exram[1024];
+static CONSOLE_LOCAL uint8_t exram[1024];
 
 //* Mirroring:
 //*  ---------------------------
@@ -31,45 +31,52 @@ static uint8_t exram[1024];
 //*    Vert:  $44  (%01 00 01 00)
 //*    1ScA:  $00  (%00 00 00 00)
 //*    1ScB:  $55  (%01 01 01 01)
-static uint8_t mmc5_mirroring;
+static CONSOLE_LOCAL uint8_t mmc5_mirroring;
 
 //* $5104:  [.... ..XX]    ExRAM mode
 //*     %00 = Extra Nametable mode    ("Ex0")
 //*     %01 = Extended Attribute mode ("Ex1")
 //*     %10 = CPU access mode         ("Ex2")
 //*     %11 = CPU read-only mode      ("Ex3")
-static unsigned exram_mode;
+static CONSOLE_LOCAL unsigned exram_mode;
 
-static unsigned prg_mode;
-static unsigned chr_mode;
+static CONSOLE_LOCAL unsigned prg_mode;
+static CONSOLE_LOCAL unsigned chr_mode;
 
-static unsigned prg_banks[4];
-static unsigned sprite_chr_banks[8];
-static unsigned bg_chr_banks[4];
+static CONSOLE_LOCAL unsigned prg_banks[4];
+static CONSOLE_LOCAL unsigned sprite_chr_banks[8];
+static CONSOLE_LOCAL unsigned bg_chr_banks[4];
 
-static unsigned wram_6000_bank;
+static CONSOLE_LOCAL unsigned wram_6000_bank;
 
-static unsigned high_chr_bits; //* $5130, pre-shifted by 6
+static CONSOLE_LOCAL unsigned high_chr_bits; //* $5130, pre-shifted by 6
 
 //* Built-in multiplier in $5205/$5206
-static unsigned multiplicand, multiplier;
+static CONSOLE_LOCAL unsigned multiplicand, multiplier;
 
 //* Scanline IRQ and frame logic
 
-static bool    irq_pending;
-static bool    irq_enabled;
-static uint8_t irq_scanline;
-static uint8_t scanline_cnt;
-static bool    in_frame;
+static CONSOLE_LOCAL bool    irq_pending;
+static CONSOLE_LOCAL bool    irq_enabled;
+static CONSOLE_LOCAL uint8_t irq_scanline;
+static CONSOLE_LOCAL uint8_t scanline_cnt;
+static CONSOLE_LOCAL bool    in_frame;
 
 //* 'true' if the background CHR mappings are currently active. Only an
 //* optimization at the moment.
-static bool using_bg_chr;
+static CONSOLE_LOCAL bool using_bg_chr;
 
 //* Fill mode
 
-static uint8_t fill_tile;
-static uint8_t fill_attrib;
+static CONSOLE_LOCAL uint8_t fill_tile;
+static CONSOLE_LOCAL uint8_t fill_attrib;
+
+//* Nametable contents in fill mode, so that it can be mapped into nt_pages like
+//* the other nametables. Kept in sync with fill_tile and fill_attrib.
+static CONSOLE_LOCAL uint8_t fill_nt[1024];
+
+//* What ExRAM reads as through the PPU in ExRAM modes 2 and 3
+static CONSOLE_LOCAL uint8_t zero_nt[1024];
 
 //* Extended attribute mode
 
@@ -77,18 +84,18 @@ static uint8_t fill_attrib;
 //* is able to supply the corresponding attribute byte for the subsequent
 //* attribute fetch. Use this to keep track of the previously fetched
 //* non-attribute value from exram so we can do the same.
-static uint8_t exram_val;
+static CONSOLE_LOCAL uint8_t exram_val;
 
 //* Vertical split mode
 
 //* $5200
-static bool     split_enabled;
-static bool     split_on_right;
-static unsigned split_tile_nr;
+static CONSOLE_LOCAL bool     split_enabled;
+static CONSOLE_LOCAL bool     split_on_right;
+static CONSOLE_LOCAL unsigned split_tile_nr;
 //* $5201
-static unsigned split_y_scroll;
+static CONSOLE_LOCAL unsigned split_y_scroll;
 //* $5202
-static unsigned split_chr_page;
+static CONSOLE_LOCAL unsigned split_chr_page;
 
 static void use_bg_chr() {
     using_bg_chr = true;
@@ -183,6 +190,24 @@ static void apply_state() {
 
     set_wram_6000_bank(wram_6000_bank);
 
+    if (fill_nt[0] != fill_tile || fill_nt[0x3FF] != fill_attrib) {
+        memset(fill_nt, fill_tile, 0x3C0);
+        memset(fill_nt + 0x3C0, fill_attrib, 0x40);
+    }
+
+    //* Map $2000 to bits 1-0, $2400 to bits 3-2, etc.
+    for (unsigned i = 0; i < 4; ++i)
+        switch ((mmc5_mirroring >> 2*i) & 3) {
+        case 0: nt_pages[i] = ciram;                                break;
+        case 1: nt_pages[i] = ciram + 0x400;                        break;
+        case 2: nt_pages[i] = exram_mode <= 1 ? exram : zero_nt;    break;
+        case 3: nt_pages[i] = fill_nt;                              break;
+        }
+
+    //* Extended attributes and split screen mode need to see each fetch.
+    //* Everything else can be served from nt_pages.
+    nt_reads_via_mapper = exram_mode == 1 || (split_enabled && exram_mode <= 1);
+
     //* Update the currently active CHR mapping
     if (using_bg_chr) {
         //* The BG CHR bank registers are not used in extended attribute mode
@@ -3,7 +3,7 @@
 #include "common.h"
 #include "mapper.h"
 
-static uint8_t reg;
+static CONSOLE_LOCAL uint8_t reg;
 
 static void apply_state() {
     set_mirroring(reg & 0x10 ? ONE_SCREEN_HIGH : ONE_SCREEN_LOW);
@@ -5,7 +5,7 @@
 
 //NOTE: This mapper has variants that work differently
 
-static uint8_t prg_bank;
+static CONSOLE_LOCAL uint8_t prg_bank;
 
 static void apply_state() {
     set_prg_16k_bank(0, prg_bank);
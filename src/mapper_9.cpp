@@ -4,20 +4,20 @@
 #include "mapper.h"
 #include "ppu.h"
 
-static uint8_t prg_bank;
+static CONSOLE_LOCAL uint8_t prg_bank;
 
 //* Index 0 is from $B000/$D000, index 1 from $C000/$E000
-static uint8_t chr_low_bank[2];
-static uint8_t chr_high_bank[2];
+static CONSOLE_LOCAL uint8_t chr_low_bank[2];
+static CONSOLE_LOCAL uint8_t chr_high_bank[2];
 
-static bool chr_low_uses_C000, chr_high_uses_E000;
+static CONSOLE_LOCAL bool chr_low_uses_C000, chr_high_uses_E000;
 
 //* Assume the CHR switch-over happens when the PPU address bus goes from one of
 //* the magic values to some other value (maybe not perfectly accurate, but
 //* captures observed behavior)
-static uint16_t prev_ppu_addr_bus;
+static CONSOLE_LOCAL uint16_t prev_ppu_addr_bus;
 
-static bool horizontal_mirroring;
+static CONSOLE_LOCAL bool horizontal_mirroring;
 
 static void apply_state() {
     set_prg_8k_bank(0, prg_bank);
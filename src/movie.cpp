@@ -0,0 +1,290 @@
+#include "common.h"
+
+#include "apu.h"
+#include "cpu.h"
+#include "input.h"
+#include "mapper.h"
+#include "md5.h"
+#include "rom.h"
+#include "save_states.h"
+#include "backend.h"
+#include "movie.h"
+
+#include <vector>
+
+//* Movie files are laid out as follows, with numbers in little-endian:
+//*
+//*   8 bytes   "NESMOVIE"
+//*   16 bytes  MD5 of the PRG ROM
+//*   4 bytes   Size of the embedded save state in bytes (0 if the movie starts
+//*             from power-on)
+//*   4 bytes   Number of frames
+//*   ...       The save state
+//*   ...       Two bytes per frame, with the buttons of controllers 1 and 2 in
+//*             the format of read_button_states()
+//*
+//* Save states depend on the ROM and the emulator version, so movies that
+//* embed one only play back with the same build.
+
+static char const movie_magic[] = "NESMOVIE";
+static size_t const header_size = 8 + 16 + 4 + 4;
+
+enum Movie_mode {
+    MOVIE_NONE,
+    MOVIE_WAITING_TO_RECORD, //* Running the frames before start_frame
+    MOVIE_RECORDING,
+    MOVIE_PLAYING
+};
+
+static CONSOLE_LOCAL Movie_mode mode;
+//* Set by record_movie() and play_movie(), and acted on at power-on
+static CONSOLE_LOCAL Movie_mode pending_mode;
+
+//* Input for each frame, two bytes per frame
+static CONSOLE_LOCAL std::vector<uint8_t> *inputs;
+//* The embedded save state, or null if the movie starts from power-on
+static CONSOLE_LOCAL uint8_t *start_state;
+static CONSOLE_LOCAL size_t   start_state_size;
+
+//* The frame being played back or recorded, counting from the start of the
+//* movie. While waiting to record, the frames left until recording starts.
+static CONSOLE_LOCAL unsigned long cur_frame;
+
+//* Recording
+static CONSOLE_LOCAL FILE *record_file;
+static CONSOLE_LOCAL unsigned long record_start_frame;
+
+//* Playback
+static CONSOLE_LOCAL uint8_t movie_prg_md5[16];
+
+static void get_prg_md5(uint8_t md5[16]) {
+    MD5_CTX md5_ctx;
+    MD5_Init(&md5_ctx);
+    MD5_Update(&md5_ctx, (void*)prg_base, 16*1024*prg_16k_banks);
+    MD5_Final(md5, &md5_ctx);
+}
+
+//* Closes the movie without writing anything
+static void close_movie() {
+    if (record_file) {
+        fclose(record_file);
+        record_file = 0;
+    }
+    delete inputs;
+    inputs = 0;
+    free_array_set_null(start_state);
+    start_state_size = 0;
+}
+
+bool record_movie(char const *filename, unsigned long start_frame) {
+    end_movie();
+    close_movie();
+    pending_mode = MOVIE_NONE;
+
+    if (!(record_file = fopen(filename, "wb"))) {
+        printf("failed to create movie '%s': %s\n", filename, strerror(errno));
+        return false;
+    }
+    record_start_frame = start_frame;
+    pending_mode = MOVIE_RECORDING;
+    return true;
+}
+
+bool play_movie(char const *filename) {
+    end_movie();
+    close_movie();
+    pending_mode = MOVIE_NONE;
+
+    FILE *const file = fopen(filename, "rb");
+    if (!file) {
+        printf("failed to open movie '%s': %s\n", filename, strerror(errno));
+        return false;
+    }
+    long file_size;
+    if (fseek(file, 0, SEEK_END) == -1 || (file_size = ftell(file)) == -1 ||
+        fseek(file, 0, SEEK_SET) == -1) {
+        printf("failed to get the size of movie '%s': %s\n", filename,
+               strerror(errno));
+        fclose(file);
+        return false;
+    }
+    size_t const size = file_size;
+    uint8_t *const buf = new uint8_t[size];
+    if (fread(buf, 1, size, file) != size) {
+        printf("failed to read movie '%s'\n", filename);
+        delete [] buf;
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    uint32_t state_size, n_frames;
+    if (size >= header_size) {
+        memcpy(&state_size, buf + 24, 4);
+        memcpy(&n_frames  , buf + 28, 4);
+    }
+    if (size < header_size || memcmp(buf, movie_magic, 8) ||
+        size != header_size + state_size + 2*(size_t)n_frames) {
+        printf("'%s' is not a valid movie\n", filename);
+        delete [] buf;
+        return false;
+    }
+
+    memcpy(movie_prg_md5, buf + 8, 16);
+    if (state_size != 0) {
+        start_state = new uint8_t[state_size];
+        memcpy(start_state, buf + header_size, state_size);
+        start_state_size = state_size;
+    }
+    inputs = new std::vector<uint8_t>(buf + header_size + state_size,
+                                      buf + size);
+    delete [] buf;
+
+    pending_mode = MOVIE_PLAYING;
+    return true;
+}
+
+unsigned long movie_length() {
+    return mode == MOVIE_PLAYING || pending_mode == MOVIE_PLAYING ?
+             inputs->size()/2 : 0;
+}
+
+bool movie_active() {
+    return mode == MOVIE_RECORDING || mode == MOVIE_PLAYING;
+}
+
+static void play_frame_input() {
+    set_movie_input(&(*inputs)[2*cur_frame]);
+}
+
+static void record_frame_input() {
+    uint8_t const buttons[2] = { read_frontend_button_states(0),
+                                 read_frontend_button_states(1) };
+    inputs->push_back(buttons[0]);
+    inputs->push_back(buttons[1]);
+    set_movie_input(buttons);
+}
+
+static void start_recording(bool from_state) {
+    inputs = new std::vector<uint8_t>;
+    if (from_state) {
+        //* The PPU state needs to be complete
+        sync_ppu();
+        start_state_size = get_state_size();
+        start_state = new uint8_t[start_state_size];
+        save_state_to(start_state);
+    }
+    mode = MOVIE_RECORDING;
+    cur_frame = 0;
+    record_frame_input();
+}
+
+static void start_playback() {
+    uint8_t md5[16];
+    get_prg_md5(md5);
+    if (memcmp(md5, movie_prg_md5, 16))
+        puts("Warning: the movie was recorded with a different ROM");
+
+    if (start_state) {
+        if (start_state_size != get_state_size()) {
+            puts("The movie's save state doesn't fit this ROM or emulator version");
+            close_movie();
+            return;
+        }
+        //* The state was saved at the end of a frame. End the frame the reset
+        //* sequence started, and catch up, so that no cycles from it are left
+        //* to be run on the loaded state.
+        end_apu_frame();
+        frame_offset = 0;
+        sync_ppu();
+        load_state_from(start_state);
+        //* The PPU is somewhere else now. This works out the next sync point
+        //* again.
+        sync_ppu();
+    }
+
+    mode = MOVIE_PLAYING;
+    cur_frame = 0;
+    if (inputs->empty())
+        end_movie();
+    else
+        play_frame_input();
+}
+
+void start_movie_at_power_on() {
+    Movie_mode const new_mode = pending_mode;
+    pending_mode = MOVIE_NONE;
+
+    switch (new_mode) {
+    case MOVIE_RECORDING:
+        if (record_start_frame == 0)
+            start_recording(false);
+        else {
+            mode = MOVIE_WAITING_TO_RECORD;
+            cur_frame = record_start_frame;
+        }
+        break;
+
+    case MOVIE_PLAYING:
+        start_playback();
+        break;
+
+    default:
+        break;
+    }
+}
+
+void handle_movie_frame() {
+    switch (mode) {
+    case MOVIE_WAITING_TO_RECORD:
+        if (--cur_frame == 0)
+            start_recording(true);
+        break;
+
+    case MOVIE_RECORDING:
+        ++cur_frame;
+        record_frame_input();
+        break;
+
+    case MOVIE_PLAYING:
+        if (++cur_frame == inputs->size()/2) {
+            end_movie();
+            frontend_show_message("Movie playback finished");
+        }
+        else
+            play_frame_input();
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void write_movie() {
+    uint8_t md5[16];
+    get_prg_md5(md5);
+    uint32_t const state_size = start_state_size;
+    uint32_t const n_frames   = inputs->size()/2;
+
+    if (fwrite(movie_magic, 1, 8, record_file) != 8 ||
+        fwrite(md5, 1, 16, record_file) != 16 ||
+        fwrite(&state_size, 4, 1, record_file) != 1 ||
+        fwrite(&n_frames, 4, 1, record_file) != 1 ||
+        fwrite(start_state, 1, state_size, record_file) != state_size ||
+        fwrite(inputs->data(), 1, inputs->size(), record_file) != inputs->size())
+        puts("failed to write movie");
+    else if (bVerbose)
+        printf("Recorded a movie of %u frames\n", n_frames);
+}
+
+void end_movie() {
+    if (mode == MOVIE_NONE)
+        return;
+
+    if (mode == MOVIE_RECORDING)
+        write_movie();
+    if (mode == MOVIE_RECORDING || mode == MOVIE_PLAYING)
+        end_movie_input();
+    mode = MOVIE_NONE;
+    close_movie();
+}
@@ -0,0 +1,48 @@
+//* Input movies
+//*
+//* A movie is the controller input for each frame, recorded from power-on or
+//* from a save state embedded in the movie. Playing it back gives the same
+//* emulation, frame for frame, which makes runs comparable between builds and
+//* hosts.
+//*
+//* Input from the frontend arrives at any point in a frame (and on another
+//* thread in the SDL build), so while a movie is recorded or played back, the
+//* game only sees button changes at frame boundaries (see set_movie_input() in
+//* input.h). Rewinding is disabled meanwhile, and loading a state from the GUI
+//* makes the rest of the recording useless.
+//*
+//* Audio resampling isn't part of save states, so the audio from a movie that
+//* starts from a save state can differ slightly from that of the recording
+//* run. It is the same on every playback.
+//*
+//* Movies start at the next power-on (the next run()), so these should be
+//* called before emulation starts, with or without a ROM loaded. A recording
+//* is written out when the ROM is unloaded.
+
+//* Records to 'filename'. If 'start_frame' is non-zero, that many frames are
+//* run from power-on first, and recording starts from a save state taken then.
+//* Returns false if the file can't be created.
+bool record_movie(char const *filename, unsigned long start_frame = 0);
+
+//* Plays back 'filename'. Input from the frontend is ignored until playback
+//* ends. Returns false, after printing why, if the file can't be opened or
+//* read or isn't a valid movie.
+bool play_movie(char const *filename);
+
+//* Number of frames in the movie being played back, or 0 if none
+unsigned long movie_length();
+
+//* True while a movie is recorded or played back
+bool movie_active();
+
+//* Called by run() at power-on, after the cold boot. Loads the embedded save
+//* state, if any, when playing back.
+void start_movie_at_power_on();
+
+//* Called at the end of each frame on the real timeline. Records or plays back
+//* the input for the next frame.
+void handle_movie_frame();
+
+//* Stops recording or playing back. A recording is written out. A movie that
+//* hasn't started yet is kept for the next power-on.
+void end_movie();
@@ -1,131 +1,153 @@
 #include "common.h"
 
+#include "benchmark.h"
 #include "cpu.h"
 #include "ppu.h"
 #include "mapper.h"
 #include "rom.h"
-#include "sdl_backend.h"
+#include "backend.h"
 #include "timing.h"
-
-#include "palette.inc"
-
-//* Points to the current palette as determined by the color tint bits
-static uint32_t const     *pal_to_rgb;
+#include "video.h"
 
 //* If true, treat the emulated code as the first code that runs (i.e., not the
 //* situation on PowerPak), which means writes to certain registers will be
 //* inhibited during the initial frame. This breaks some demos.
 bool const                starts_on_initial_frame = false;
 
-uint8_t                   *ciram;
+CONSOLE_LOCAL uint8_t                   *ciram;
 
-unsigned                  prerender_line;
+CONSOLE_LOCAL unsigned                  prerender_line;
 
-static uint8_t            palettes[0x20];
-static uint8_t            oam[0x100];
-static uint8_t            sec_oam[0x20];
+static CONSOLE_LOCAL uint8_t            palettes[0x20];
+static CONSOLE_LOCAL uint8_t            oam[0x100];
+static CONSOLE_LOCAL uint8_t            sec_oam[0x20];
 
 //* VRAM address/scroll regs. 15 bits long.
-static unsigned           t, v;
-static uint8_t            fine_x;
-//* v is not immediately updated from t on the second write to $2006. This
-//* variable implements the delay.
-static unsigned           pending_v_update;
-
-static unsigned           v_inc;           //* $2000:2
-static uint16_t           sprite_pat_addr; //* $2000:3
-static uint16_t           bg_pat_addr;     //* $2000:4
-static enum Sprite_size {
+static CONSOLE_LOCAL unsigned           t, v;
+static CONSOLE_LOCAL uint8_t            fine_x;
+//* v is not immediately updated from t on the second write to $2006. This is
+//* the ppu_cycle on which it is, or 0 if no update is pending.
+static CONSOLE_LOCAL uint64_t           v_update_cycle;
+
+static CONSOLE_LOCAL unsigned           v_inc;           //* $2000:2
+static CONSOLE_LOCAL uint16_t           sprite_pat_addr; //* $2000:3
+static CONSOLE_LOCAL uint16_t           bg_pat_addr;     //* $2000:4
+static CONSOLE_LOCAL enum Sprite_size {
     EIGHT_BY_EIGHT,
     EIGHT_BY_SIXTEEN
 }                         sprite_size;   //* $2000:5
-static bool               nmi_on_vblank; //* $2000:7
+static CONSOLE_LOCAL bool               nmi_on_vblank; //* $2000:7
 
 //* $2001:0 - 0x30 if grayscale mode enabled, otherwise 0x3F
-static uint8_t            grayscale_color_mask;
-static bool               show_bg_left_8;       //* $2001:1
-static bool               show_sprites_left_8;  //* $2001:2
-static bool               show_bg;              //* $2001:3
-static bool               show_sprites;         //* $2001:4
-static uint8_t            tint_bits;            //* $2001:7-5
-
-bool                      rendering_enabled;
+static CONSOLE_LOCAL uint8_t            grayscale_color_mask;
+static CONSOLE_LOCAL bool               show_bg_left_8;       //* $2001:1
+static CONSOLE_LOCAL bool               show_sprites_left_8;  //* $2001:2
+static CONSOLE_LOCAL bool               show_bg;              //* $2001:3
+static CONSOLE_LOCAL bool               show_sprites;         //* $2001:4
+static CONSOLE_LOCAL uint8_t            tint_bits;            //* $2001:7-5
+
+CONSOLE_LOCAL bool                      rendering_enabled;
 //* Optimizations - if bg/sprites are disabled, a value is set that causes
 //* comparisons to always fail. If the leftmost 8 pixels should be clipped,
 //* comparisons only fail for those pixels. Otherwise, comparisons never fail.
-static unsigned           bg_clip_comp;
-static unsigned           sprite_clip_comp;
+static CONSOLE_LOCAL unsigned           bg_clip_comp;
+static CONSOLE_LOCAL unsigned           sprite_clip_comp;
 
-static bool               sprite_overflow; //* $2002:5
-static bool               sprite_zero_hit; //* $2002:6
-static bool               in_vblank;       //* $2002:7
+static CONSOLE_LOCAL bool               sprite_overflow; //* $2002:5
+static CONSOLE_LOCAL bool               sprite_zero_hit; //* $2002:6
+static CONSOLE_LOCAL bool               in_vblank;       //* $2002:7
 
-static uint8_t            oam_addr; //* $2003
+static CONSOLE_LOCAL uint8_t            oam_addr; //* $2003
 //* Pointer into the secondary OAM, 5 bits wide
 //*  - Updated during sprite evaluation and loading
 //*  - Cleared at dots 64.5, 256.5 and 340.5, if rendering
-static unsigned           sec_oam_addr;
-static uint8_t            oam_data; //* $2004 (seen when reading from $2004)
+static CONSOLE_LOCAL unsigned           sec_oam_addr;
+static CONSOLE_LOCAL uint8_t            oam_data; //* $2004 (seen when reading from $2004)
 
 //* Sprite evaluation state
 
 //* Goes high for three ticks when an in-range sprite is found during sprite
 //* evaluation
-static unsigned           copy_sprite_signal;
-static bool               oam_addr_overflow, sec_oam_addr_overflow;
-static bool               overflow_detection;
+static CONSOLE_LOCAL unsigned           copy_sprite_signal;
+static CONSOLE_LOCAL bool               oam_addr_overflow, sec_oam_addr_overflow;
+static CONSOLE_LOCAL bool               overflow_detection;
 
 //* PPUSCROLL/PPUADDR write flip-flop. First write when false, second write when
 //* true.
-static bool               write_flip_flop;
+static CONSOLE_LOCAL bool               write_flip_flop;
 
-static uint8_t            ppu_data_reg; //* $2007 read buffer
+static CONSOLE_LOCAL uint8_t            ppu_data_reg; //* $2007 read buffer
 
-static bool               odd_frame;
+static CONSOLE_LOCAL bool               odd_frame;
 
-uint64_t                  ppu_cycle;
+CONSOLE_LOCAL uint64_t                  ppu_cycle;
 
 //* Internal PPU counters and registers
 
-unsigned                  dot, scanline;
+CONSOLE_LOCAL unsigned                  dot, scanline;
+
+static CONSOLE_LOCAL uint8_t            nt_byte, at_byte;
+static CONSOLE_LOCAL uint8_t            bg_byte_l, bg_byte_h;
+//* The two background pattern shift registers, combined into sixteen two-bit
+//* pixels with the next pixel in the top bits (see Chr_row)
+static CONSOLE_LOCAL uint32_t           bg_shift;
+static CONSOLE_LOCAL unsigned           at_shift_l, at_shift_h;
+static CONSOLE_LOCAL unsigned           at_latch_l, at_latch_h;
 
-static uint8_t            nt_byte, at_byte;
-static uint8_t            bg_byte_l, bg_byte_h;
-static uint16_t           bg_shift_l, bg_shift_h;
-static unsigned           at_shift_l, at_shift_h;
-static unsigned           at_latch_l, at_latch_h;
+static CONSOLE_LOCAL uint8_t            sprite_attribs[8];
+static CONSOLE_LOCAL uint8_t            sprite_x[8];
+static CONSOLE_LOCAL uint8_t            sprite_pat_l[8];
+static CONSOLE_LOCAL uint8_t            sprite_pat_h[8];
 
-static uint8_t            sprite_attribs[8];
-static uint8_t            sprite_x[8];
-static uint8_t            sprite_pat_l[8];
-static uint8_t            sprite_pat_h[8];
+static CONSOLE_LOCAL bool               s0_on_next_scanline;
+static CONSOLE_LOCAL bool               s0_on_cur_scanline;
 
-static bool               s0_on_next_scanline;
-static bool               s0_on_cur_scanline;
+//* The sprite output units above, decoded into one entry per pixel of the line
+//* so that finding the sprite pixel at a location is a single load. Entries are
+//* 0 for no sprite pixel, and otherwise
+//*
+//*   bits 1-0: pattern bits (nonzero)
+//*   bits 3-2: palette
+//*   bit 4   : behind background
+//*   bit 5   : from sprite zero on a line where it's in range
+//*
+//* Derived from the sprite output units, so not part of the save state. Sprites
+//* are drawn eight pixels at a time, so there's room for them to overhang the
+//* right edge.
+static CONSOLE_LOCAL uint8_t            sprite_line[256 + 8] __attribute__((aligned(8)));
+//* X positions of the sprites drawn into sprite_line, for clearing it again
+static CONSOLE_LOCAL uint8_t            sprite_line_xs[8];
+static CONSOLE_LOCAL unsigned           n_sprite_line_sprites;
+//* Set when the sprite output units change. sprite_line is rebuilt when next
+//* needed.
+static CONSOLE_LOCAL bool               sprite_line_dirty;
 
 //* Temporary storage (also exists in PPU) for data during sprite loading
-static uint8_t            sprite_y, sprite_index;
-static bool               sprite_in_range;
+static CONSOLE_LOCAL uint8_t            sprite_y, sprite_index;
+static CONSOLE_LOCAL bool               sprite_in_range;
 
 //* Writes to certain registers are suppressed during the initial frame:
 //* http://*wiki.nesdev.com/w/index.php/PPU_power_up_state
 //*
 //* Emulating this makes NY2011 and possibly other demos hang. They probably
 //* don't run on the real thing either.
-static bool               initial_frame;
+static CONSOLE_LOCAL bool               initial_frame;
 
-unsigned                  ppu_addr_bus;
+CONSOLE_LOCAL unsigned                  ppu_addr_bus;
 
 //* Open bus for reads from PPU $2000-$2007 (tested by ppu_open_bus.nes).
 //* "wcycle" is short for "write cycle".
 
-static uint8_t            ppu_open_bus;
-static uint64_t           bit_7_6_wcycle, bit_5_wcycle, bit_4_0_wcycle;
+static CONSOLE_LOCAL uint8_t            ppu_open_bus;
+static CONSOLE_LOCAL uint64_t           bit_7_6_wcycle, bit_5_wcycle, bit_4_0_wcycle;
+
+static CONSOLE_LOCAL unsigned           open_bus_decay_cycles;
 
-static unsigned           open_bus_decay_cycles;
+static void select_ppu_loop();
 
 void init_ppu_for_rom() {
     prerender_line = is_pal ? 311 : 261;
+    select_ppu_loop();
     //* PPU open bus values fade after about 600 ms
     open_bus_decay_cycles = 0.6*ppu_clock_rate;
 }
@@ -165,29 +187,46 @@ static uint8_t &chr_ref(unsigned chr_addr) {
 
 //* Nametable reading and writing
 
-//* Returns the physical CIRAM address after mirroring
-static uint16_t get_mirrored_addr(uint16_t addr) {
-    switch (mirroring) {
-    case VERTICAL:        return addr & 0x07FF;
-    case HORIZONTAL:      return ((addr >> 1) & 0x0400) + (addr & 0x03FF);
-    case ONE_SCREEN_LOW:  return addr & 0x03FF;
-    case ONE_SCREEN_HIGH: return 0x0400 + (addr & 0x03FF);
-    case FOUR_SCREEN:     return addr & 0x0FFF;
-    default: UNREACHABLE;
-    }
+static uint8_t &nt_ref(uint16_t addr) {
+    return nt_pages[(addr >> 10) & 3][addr & 0x03FF];
 }
 
 static uint8_t read_nt(uint16_t addr) {
-    return mapper_fns.read_nt ?
-             mapper_fns.read_nt(addr) :
-             ciram[get_mirrored_addr(addr)];
+    if (nt_reads_via_mapper) {
+        BENCH_SCOPE(BENCH_MAPPER);
+        return mapper_fns.read_nt(addr);
+    }
+    return nt_ref(addr);
+}
+
+//* Nametable read during rendering. Only mappers with custom nametable
+//* mirroring can need to be called, and whether that's the case is known at
+//* compile time. Even those mostly get by with nt_pages.
+template<Mapper_class MAPPER_CLASS>
+static uint8_t fetch_nt(uint16_t addr) {
+    if (MAPPER_CLASS == MAPPER_CLASS_RWPN && nt_reads_via_mapper) {
+        BENCH_SCOPE(BENCH_MAPPER);
+        return mapper_fns.read_nt(addr);
+    }
+    return nt_ref(addr);
 }
 
 static void write_nt(uint16_t addr, uint8_t val) {
-    if (mapper_fns.write_nt)
+    if (mapper_fns.write_nt) {
+        BENCH_SCOPE(BENCH_MAPPER);
         mapper_fns.write_nt(val, addr);
+    }
     else
-        ciram[get_mirrored_addr(addr)] = val;
+        nt_ref(addr) = val;
+}
+
+//* Inverse of spread_pattern_bits(), for 16 bits. Picks out every other bit.
+static unsigned compact_pattern_bits(uint32_t x) {
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0F0F0F0F;
+    x = (x | (x >> 4)) & 0x00FF00FF;
+    return (x | (x >> 8)) & 0x0000FFFF;
 }
 
 //* Bumps the horizontal bits in v every eight pixels during rendering
@@ -238,12 +277,13 @@ static void copy_vert() {
 }
 
 //* Fetches nametable and tile bytes for the background
+template<Mapper_class MAPPER_CLASS>
 static void do_bg_fetches() {
     switch ((dot - 1) % 8) {
 
     //* NT byte
     case 0: ppu_addr_bus = 0x2000 | (v & 0x0FFF); break;
-    case 1: nt_byte = read_nt(ppu_addr_bus);      break;
+    case 1: nt_byte = fetch_nt<MAPPER_CLASS>(ppu_addr_bus); break;
 
     //* AT byte
     case 2:
@@ -253,7 +293,7 @@ static void do_bg_fetches() {
         ppu_addr_bus = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 7);
         break;
     case 3:
-        at_byte = read_nt(ppu_addr_bus);
+        at_byte = fetch_nt<MAPPER_CLASS>(ppu_addr_bus);
         break;
 
     //* Low BG tile byte
@@ -277,30 +317,94 @@ static void do_bg_fetches() {
     }
 }
 
-//* Looks for an in-range sprite pixel at the current location.
+//* Returns a word with bit 7 - i of 'b' in the low bit of byte i (the byte for
+//* the ith pixel from the left, on a little-endian host)
+static uint64_t spread_pattern_bits_to_bytes(uint8_t b) {
+    //* Copy the byte to all bytes, keep a different bit in each, and turn
+    //* nonzero bytes into 1s. Adding 0x7F can't carry between bytes here.
+    uint64_t const bits = (b*UINT64_C(0x0101010101010101)) & UINT64_C(0x0102040810204080);
+    return ((bits + UINT64_C(0x7F7F7F7F7F7F7F7F)) >> 7) & UINT64_C(0x0101010101010101);
+}
+
+//* Decodes the sprite output units into sprite_line
+static void build_sprite_line() {
+    sprite_line_dirty = false;
+
+    uint64_t const zero = 0;
+    for (unsigned i = 0; i < n_sprite_line_sprites; ++i)
+        memcpy(sprite_line + sprite_line_xs[i], &zero, 8);
+    n_sprite_line_sprites = 0;
+
+    //* Where sprites overlap, the lowest-numbered one with a non-transparent
+    //* pixel wins, so draw them from the highest number down
+    for (unsigned i = 8; i-- > 0;) {
+        if (!(sprite_pat_l[i] | sprite_pat_h[i]))
+            continue;
+
+        uint64_t const pats = spread_pattern_bits_to_bytes(sprite_pat_l[i]) |
+                              (spread_pattern_bits_to_bytes(sprite_pat_h[i]) << 1);
+        //* 0xFF in the bytes for non-transparent pixels
+        uint64_t const opaque = ((pats | (pats >> 1)) & UINT64_C(0x0101010101010101))*0xFF;
+        unsigned const attrs = ((sprite_attribs[i] & 3) << 2)   |
+                               ((sprite_attribs[i] & 0x20) >> 1) |
+                               ((s0_on_cur_scanline && i == 0) << 5);
+        uint64_t const entries = pats | attrs*UINT64_C(0x0101010101010101);
+
+        uint64_t line;
+        memcpy(&line, sprite_line + sprite_x[i], 8);
+        line = (line & ~opaque) | (entries & opaque);
+        memcpy(sprite_line + sprite_x[i], &line, 8);
+
+        sprite_line_xs[n_sprite_line_sprites++] = sprite_x[i];
+    }
+}
+
+//* True if any sprite on the current line has a non-transparent pixel.
+//* Rebuilds sprite_line if needed, so call this before get_sprite_pixel().
+static bool sprites_on_line() {
+    if (sprite_line_dirty)
+        build_sprite_line();
+    return n_sprite_line_sprites != 0;
+}
+
+//* Looks for an in-range sprite pixel at the given location on the current line.
 //* Performance hotspot!
-//* Possible optimization: Set flag if any sprites on the line
-static unsigned get_sprite_pixel(unsigned &spr_pal, bool &spr_behind_bg, bool &spr_is_s0) {
-    unsigned const pixel = dot - 2;
+static unsigned get_sprite_pixel(unsigned pixel, unsigned &spr_pal, bool &spr_behind_bg, bool &spr_is_s0) {
     //* Equivalent to 'if (!show_sprites || (!show_sprites_left_8 && pixel < 8))'
     if (pixel < sprite_clip_comp)
         return 0;
 
-    for (unsigned i = 0; i < 8; ++i) {
-        unsigned const offset = pixel - sprite_x[i];
-        if (offset < 8) { //* offset >= 0 && offset < 8
-            unsigned const pat_res = (NTH_BIT(sprite_pat_h[i], 7 - offset) << 1) |
-                                      NTH_BIT(sprite_pat_l[i], 7 - offset);
-            if (pat_res) {
-                spr_pal       = sprite_attribs[i] & 3;
-                spr_behind_bg = sprite_attribs[i] & 0x20;
-                spr_is_s0     = s0_on_cur_scanline && (i == 0);
-                return pat_res;
-            }
-        }
-    }
+    unsigned const entry = sprite_line[pixel];
+    spr_pal       = (entry >> 2) & 3;
+    spr_behind_bg = entry & 0x10;
+    spr_is_s0     = entry & 0x20;
+    return entry & 3;
+}
+
+//* Produces the palette index for a pixel on the current line while rendering,
+//* given the background pixel value and attribute bits from the shift
+//* registers, according to background/sprite priority. Also handles sprite zero
+//* hit detection. CHECK_SPRITES can be set false if it's known that no sprite
+//* has a non-transparent pixel at the location.
+//* Performance hotspot!
+template<bool CHECK_SPRITES>
+static unsigned get_rendered_pal_index(unsigned pixel, unsigned bg_pixel_pat, unsigned attr_bits) {
+    bool           spr_behind_bg = false, spr_is_s0 = false;
+    unsigned       spr_pal = 0;
+
+    unsigned const spr_pat = CHECK_SPRITES ?
+      get_sprite_pixel(pixel, spr_pal, spr_behind_bg, spr_is_s0) : 0;
 
-    return 0;
+    //* Equivalent to 'if (!show_bg || (!show_bg_left_8 && pixel < 8))'
+    if (pixel < bg_clip_comp)
+        bg_pixel_pat = 0;
+    else if (spr_pat && spr_is_s0 && bg_pixel_pat && pixel != 255)
+        sprite_zero_hit = true;
+
+    if (spr_pat && !(spr_behind_bg && bg_pixel_pat))
+        return 0x10 + (spr_pal << 2) + spr_pat;
+
+    return bg_pixel_pat ? (attr_bits << 2) | bg_pixel_pat : 0;
 }
 
 //* Fetches pixels from the background and sprite shift registers and produces
@@ -308,8 +412,13 @@ static unsigned get_sprite_pixel(unsigned &spr_pal, bool &spr_behind_bg, bool &s
 //* priority. Also handles sprite zero hit detection.
 //* Performance hotspot!
 static void do_pixel_output_and_sprite_zero() {
+    //* Only called for dots 2-257
+    unsigned const pixel = dot - 2;
 
-    const int pixel = (dot >= 328) ? dot - 343 : dot - 2;
+    //* On skipped frames, nothing is output, and the pixel only needs to be
+    //* worked out if it could be a sprite zero hit
+    if (skip_frame && !(rendering_enabled && s0_on_cur_scanline))
+        return;
 
     unsigned pal_index;
 
@@ -319,40 +428,16 @@ static void do_pixel_output_and_sprite_zero() {
         //* color
         pal_index = (~v & 0x3F00) ? 0 : v & 0x1F;
     else {
-        unsigned       bg_pixel_pat;
-
-        bool           spr_behind_bg, spr_is_s0;
-        unsigned       spr_pal;
-
-	unsigned const spr_pat = 
-		((pixel >= 0) && (pixel < 256)) ? 
-		get_sprite_pixel(spr_pal, spr_behind_bg, spr_is_s0) : 0;
-
-        //* Equivalent to 'if (!show_bg || (!show_bg_left_8 && pixel < 8))'
-        if ((pixel < (int)bg_clip_comp) || (pixel >= 256))
-            bg_pixel_pat = 0;
-        else {
-            bg_pixel_pat = (NTH_BIT(bg_shift_h, 15 - fine_x) << 1) |
-                            NTH_BIT(bg_shift_l, 15 - fine_x);
-
-            if (spr_pat && spr_is_s0 && bg_pixel_pat && pixel != 255)
-                sprite_zero_hit = true;
-        }
-
-        if (spr_pat && !(spr_behind_bg && bg_pixel_pat))
-            pal_index = 0x10 + (spr_pal << 2) + spr_pat;
-        else {
-            if (!bg_pixel_pat)
-                pal_index = 0;
-            else {
-                unsigned const attr_bits = (NTH_BIT(at_shift_h, 7 - fine_x) << 1) |
-                                            NTH_BIT(at_shift_l, 7 - fine_x);
-                pal_index = (attr_bits << 2) | bg_pixel_pat;
-            }
-        }
+        unsigned const bg_pixel_pat = (bg_shift >> (30 - 2*fine_x)) & 3;
+        unsigned const attr_bits =
+          (NTH_BIT(at_shift_h, 7 - fine_x) << 1)  | NTH_BIT(at_shift_l, 7 - fine_x);
+        pal_index = sprites_on_line() ?
+          get_rendered_pal_index<true> (pixel, bg_pixel_pat, attr_bits) :
+          get_rendered_pal_index<false>(pixel, bg_pixel_pat, attr_bits);
     }
 
-    put_pixel(pixel, scanline, pal_to_rgb[palettes[pal_index] & grayscale_color_mask]);
+    if (!skip_frame)
+        output_frame->pixels[256*scanline + pixel] = palettes[pal_index] & grayscale_color_mask;
 }
 
 //* Shifts the background shift registers, reloading the upper eight bits and
@@ -361,15 +446,14 @@ static void do_shifts_and_reloads() {
     assert(at_latch_l <= 1);
     assert(at_latch_h <= 1);
 
-    bg_shift_l <<= 1;
-    bg_shift_h <<= 1;
+    bg_shift <<= 2;
     at_shift_l = (at_shift_l << 1) | at_latch_l;
     at_shift_h = (at_shift_h << 1) | at_latch_h;
 
     if (dot % 8 == 1) {
         //* Reload regs
-        bg_shift_l = (bg_shift_l & 0xFF00) | bg_byte_l;
-        bg_shift_h = (bg_shift_h & 0xFF00) | bg_byte_h;
+        bg_shift = (bg_shift & 0xFFFF0000) | spread_pattern_bits(bg_byte_l) |
+                   (spread_pattern_bits(bg_byte_h) << 1);
 
         //* v:
         //*
@@ -533,6 +617,8 @@ static void do_sprite_loading() {
     //* This is position-based in the hardware as well
     unsigned const sprite_n = (dot - 257)/8;
 
+    sprite_line_dirty = true;
+
     if (dot == 257)
         sec_oam_addr = 0;
 
@@ -604,6 +690,7 @@ static void do_sprite_loading() {
 
 //* Common operations for the visible lines (0-239) and the pre-render line.
 //* Performance hotspot!
+template<Mapper_class MAPPER_CLASS>
 static void do_render_line_ops() {
     //* We get a short dummy bg-related fetch here. Probably not worth
     //* emulating the exact address.
@@ -616,7 +703,7 @@ static void do_render_line_ops() {
     switch (dot) {
     case 1 ... 256: case 321 ... 336:
         //* Possible optimization: Could be merged to save double decoding of dot
-        do_bg_fetches();
+        do_bg_fetches<MAPPER_CLASS>();
         if (dot == 256)
             bump_vert();
         break;
@@ -640,30 +727,36 @@ static void do_render_line_ops() {
     }
 }
 
+//* Secondary OAM clear and sprite evaluation for the visible lines. Does not
+//* interact with background rendering or pixel output on the same line.
+static void do_sec_oam_clear_and_sprite_evaluation() {
+    switch (dot) {
+    case 1 ... 64:
+        //* Secondary OAM clear
+        if (dot & 1)
+            oam_data = 0xFF;
+        else {
+            sec_oam[sec_oam_addr] = oam_data;
+            //* Should this be done when setting oam_data? Extremely
+            //* obscure.
+            sec_oam_addr = (sec_oam_addr + 1) & 0x1F;
+        }
+        break;
+
+    case 65 ... 256:
+        do_sprite_evaluation();
+    }
+}
+
 //* Called for dots on the visible lines (0-239)
+template<Mapper_class MAPPER_CLASS>
 static void do_visible_line_ops() {
     if (dot >= 2 && dot <= 257)
         do_pixel_output_and_sprite_zero();
 
     if (rendering_enabled) {
-        do_render_line_ops();
-
-        switch (dot) {
-        case 1 ... 64:
-            //* Secondary OAM clear
-            if (dot & 1)
-                oam_data = 0xFF;
-            else {
-                sec_oam[sec_oam_addr] = oam_data;
-                //* Should this be done when setting oam_data? Extremely
-                //* obscure.
-                sec_oam_addr = (sec_oam_addr + 1) & 0x1F;
-            }
-            break;
-
-        case 65 ... 256:
-            do_sprite_evaluation();
-        }
+        do_render_line_ops<MAPPER_CLASS>();
+        do_sec_oam_clear_and_sprite_evaluation();
     }
 }
 
@@ -676,6 +769,7 @@ static void do_line_241_ops() {
 }
 
 //* Called for dots on the pre-render line
+template<Mapper_class MAPPER_CLASS>
 static void do_prerender_line_ops() {
     //* This might be one tick off due to the possibility of reading the flags
     //* really shortly after they are cleared in the preferred alignment
@@ -684,7 +778,7 @@ static void do_prerender_line_ops() {
     if (dot == 2) in_vblank = false;
 
     if (rendering_enabled) {
-        do_render_line_ops();
+        do_render_line_ops<MAPPER_CLASS>();
 
         //* This is where s0_on_next_scanline is initialized on the
         //* prerender line the hardware. There's an "in visible frame"
@@ -704,8 +798,11 @@ static void do_prerender_line_ops() {
 //* IS_PAL is set true for PAL emulation, with PRERENDER_LINE set accordingly to
 //* the scanline number of the pre-render line (the final line of the frame).
 //* These are also available as 'is_pal' and 'prerender_line', but kept as
-//* compile-time constants here for performance.
-template<bool IS_PAL, unsigned PRERENDER_LINE>
+//* compile-time constants here for performance. MAPPER_CLASS is likewise
+//* mapper_fns.mapper_class. V_UPDATE is set for the tick on which a delayed v
+//* update happens.
+template<bool IS_PAL, unsigned PRERENDER_LINE, Mapper_class MAPPER_CLASS,
+         bool V_UPDATE = false>
 static void tick_ppu() {
     ++ppu_cycle;
 
@@ -724,6 +821,7 @@ static void tick_ppu() {
 
         case PRERENDER_LINE + 1:
             scanline = 0;
+            begin_frame(*output_frame, tint_bits);
             if (!IS_PAL) {
                 if (rendering_enabled && odd_frame) ++dot;
                 odd_frame = !odd_frame;
@@ -731,7 +829,7 @@ static void tick_ppu() {
         }
     }
 
-    if (pending_v_update > 0 && --pending_v_update == 0) {
+    if (V_UPDATE) {
         v = t;
         if ((scanline >= 240 && scanline < PRERENDER_LINE) || !rendering_enabled)
             //* The PPU address bus mirrors v outside of rendering
@@ -739,21 +837,167 @@ static void tick_ppu() {
     }
 
     switch (scanline) {
-    case 0 ... 239     : do_visible_line_ops();   break;
-    case 241           : do_line_241_ops();       break;
-    case PRERENDER_LINE: do_prerender_line_ops();
+    case 0 ... 239     : do_visible_line_ops<MAPPER_CLASS>();   break;
+    case 241           : do_line_241_ops();                     break;
+    case PRERENDER_LINE: do_prerender_line_ops<MAPPER_CLASS>();
     }
 
     //* Mapper-specific operations - usually to snoop on ppu_addr_bus
-    mapper_fns.ppu_tick_callback();
+    if (MAPPER_CLASS == MAPPER_CLASS_WP || MAPPER_CLASS == MAPPER_CLASS_RWPN) {
+        BENCH_SCOPE(BENCH_MAPPER);
+        mapper_fns.ppu_tick_callback();
+    }
 }
 
-void tick_ntsc_ppu() {
-    tick_ppu<false, 261>();
+//* Fast path for visible lines: runs the eight dots dot+1 to dot+8 in one go,
+//* for dot = 1, 9, ..., 241. That covers the output of one tile's worth of
+//* pixels and the background fetches for a later tile. The result is identical
+//* to eight tick_ppu() calls; see run_ppu_loop() for when it can be used.
+template<Mapper_class MAPPER_CLASS>
+static void render_tile_span() {
+    //* Output pixels. Pixel i is output after the shift registers have been
+    //* shifted i times. The attribute shift registers shift in the attribute
+    //* latch bits.
+    unsigned const first_pixel = dot - 1;
+    unsigned const at_l = ((at_shift_l & 0xFF) << 8) | (at_latch_l ? 0xFF : 0);
+    unsigned const at_h = ((at_shift_h & 0xFF) << 8) | (at_latch_h ? 0xFF : 0);
+
+    //* Sprites only need to be looked at if they have non-transparent pixels
+    //* in the span and aren't clipped for all of it
+    bool sprites_in_span = false;
+    if (first_pixel + 7 >= sprite_clip_comp && sprites_on_line()) {
+        uint64_t span_entries;
+        memcpy(&span_entries, sprite_line + first_pixel, 8);
+        sprites_in_span = span_entries != 0;
+    }
+
+    //* On skipped frames, the pixels are only worked out if one of them could
+    //* be a sprite zero hit, and aren't output
+    if (!skip_frame || (sprites_in_span && s0_on_cur_scanline))
+        for (unsigned i = 0; i < 8; ++i) {
+            unsigned const bit = 15 - fine_x - i;
+            unsigned const bg_pixel_pat = (bg_shift >> 2*bit) & 3;
+            unsigned const attr_bits    = (NTH_BIT(at_h, bit) << 1) | NTH_BIT(at_l, bit);
+            unsigned const pal_index = sprites_in_span ?
+              get_rendered_pal_index<true> (first_pixel + i, bg_pixel_pat, attr_bits) :
+              get_rendered_pal_index<false>(first_pixel + i, bg_pixel_pat, attr_bits);
+            if (!skip_frame)
+                output_frame->pixels[256*scanline + first_pixel + i] =
+                  palettes[pal_index] & grayscale_color_mask;
+        }
+
+    //* Background fetches, in the same order as in do_bg_fetches(). The NT
+    //* address was put on the bus on the dot before the span.
+    nt_byte = fetch_nt<MAPPER_CLASS>(ppu_addr_bus);
+    ppu_addr_bus = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 7);
+    at_byte = fetch_nt<MAPPER_CLASS>(ppu_addr_bus);
+    assert(v <= 0x7FFF);
+    ppu_addr_bus = bg_pat_addr + 16*nt_byte + (v >> 12);
+    //* Nothing can switch banks between the two pattern fetches here, so the
+    //* pixels can be taken from the decoded row
+    Chr_row const &bg_row = get_chr_row(ppu_addr_bus);
+    bg_byte_l = chr_ref(ppu_addr_bus);
+    ppu_addr_bus += 8;
+    bg_byte_h = chr_ref(ppu_addr_bus);
+    bump_horiz();
+
+    //* Eight shifts, with a reload on the last dot. Same as
+    //* do_shifts_and_reloads().
+    bg_shift = (bg_shift << 16) | bg_row.pixels;
+    at_shift_l = (at_shift_l << 8) | (at_latch_l ? 0xFF : 0);
+    at_shift_h = (at_shift_h << 8) | (at_latch_h ? 0xFF : 0);
+    unsigned const at_bits = at_byte >> (((v >> 4) & 4) | ((v - 1) & 2));
+    at_latch_l = at_bits & 1;
+    at_latch_h = (at_bits >> 1) & 1;
+
+    //* The NT fetch for the next tile starts on the last dot
+    ppu_addr_bus = 0x2000 | (v & 0x0FFF);
+
+    for (unsigned i = 0; i < 8; ++i) {
+        ++dot;
+        do_sec_oam_clear_and_sprite_evaluation();
+    }
+
+    ppu_cycle += 8;
 }
 
-void tick_pal_ppu() {
-    tick_ppu<true, 311>();
+//* True if the next eight ticks can be run with render_tile_span(). Nothing
+//* outside the PPU can run in the middle of a run_ppu() call, and mappers that
+//* look at individual PPU ticks or nametable fetches are excluded at compile
+//* time. A delayed v update is always less than eight ticks away, and
+//* run_ppu_loop() runs up to it first.
+static bool can_render_tile_span() {
+    return dot % 8 == 1 && dot <= 241 && scanline < 240 && rendering_enabled;
+}
+
+template<bool IS_PAL, unsigned PRERENDER_LINE, Mapper_class MAPPER_CLASS>
+static void run_ppu_ticks(unsigned n) {
+    bool const mapper_snoops =
+      MAPPER_CLASS == MAPPER_CLASS_WP || MAPPER_CLASS == MAPPER_CLASS_RWPN;
+
+    while (n > 0) {
+        if (!mapper_snoops && n >= 8 && can_render_tile_span()) {
+            render_tile_span<MAPPER_CLASS>();
+            n -= 8;
+        }
+        else {
+            tick_ppu<IS_PAL, PRERENDER_LINE, MAPPER_CLASS>();
+            --n;
+        }
+    }
+}
+
+template<bool IS_PAL, unsigned PRERENDER_LINE, Mapper_class MAPPER_CLASS>
+static void run_ppu_loop(unsigned n) {
+    //* The delayed v update happens partway through a tick, so that tick is
+    //* run separately instead of checking for it on every tick
+    if (v_update_cycle != 0 && v_update_cycle - ppu_cycle <= n) {
+        unsigned const ticks_before = v_update_cycle - ppu_cycle - 1;
+        run_ppu_ticks<IS_PAL, PRERENDER_LINE, MAPPER_CLASS>(ticks_before);
+        tick_ppu<IS_PAL, PRERENDER_LINE, MAPPER_CLASS, true>();
+        v_update_cycle = 0;
+        n -= ticks_before + 1;
+    }
+
+    run_ppu_ticks<IS_PAL, PRERENDER_LINE, MAPPER_CLASS>(n);
+}
+
+CONSOLE_LOCAL void (*run_ppu)(unsigned n);
+
+//* Points run_ppu to the loop for the current TV standard and mapper. The PPU
+//* only cares about PPU-related callbacks, so mappers that just react to
+//* writes share the loop with hardwired ones.
+static void select_ppu_loop() {
+    #define SELECT_FOR(mapper_class)                                  \
+      run_ppu = is_pal ? run_ppu_loop<true , 311, mapper_class> :     \
+                         run_ppu_loop<false, 261, mapper_class>;
+
+    switch (mapper_fns.mapper_class) {
+    case MAPPER_CLASS_NONE:
+    case MAPPER_CLASS_W:    SELECT_FOR(MAPPER_CLASS_NONE) break;
+    case MAPPER_CLASS_WP:   SELECT_FOR(MAPPER_CLASS_WP)   break;
+    case MAPPER_CLASS_RWPN: SELECT_FOR(MAPPER_CLASS_RWPN) break;
+    default: UNREACHABLE
+    }
+
+    #undef SELECT_FOR
+}
+
+unsigned ppu_ticks_till_event() {
+    //* Frame completion happens at dot 0 of line 240, and the NMI for VBlank
+    //* is raised at dot 1 of line 241
+    unsigned const frame_completion_pos = 341*240;
+    unsigned const nmi_pos              = 341*241 + 1;
+
+    unsigned const pos = 341*scanline + dot;
+    if (pos < frame_completion_pos)
+        return frame_completion_pos - pos;
+    if (pos < nmi_pos)
+        return nmi_pos - pos;
+    //* Wrap around to the next frame. Assume the frame is one dot short, as
+    //* for odd NTSC frames with rendering enabled. If it isn't, we end up
+    //* syncing one tick early, which is harmless.
+    return 341*(prerender_line + 1) - 1 - pos + frame_completion_pos;
 }
 
 static void do_2007_post_access_bump() {
@@ -819,7 +1063,12 @@ static void write_vram(uint8_t val) {
     switch (v & 0x3FFF) {
 
     //* Pattern tables
-    case 0x0000 ... 0x1FFF: if (chr_is_ram) chr_ref(v) = val; break;
+    case 0x0000 ... 0x1FFF:
+        if (chr_is_ram) {
+            chr_ref(v) = val;
+            update_chr_row(v);
+        }
+        break;
     //* Nametables
     case 0x2000 ... 0x3EFF: write_nt(v, val); break;
     //* Palettes
@@ -908,12 +1157,24 @@ void write_oam_data_reg(uint8_t val) {
     oam[oam_addr++] = val;
 }
 
+//* The tint bits aren't applied to the pixels output (see video.h), so a
+//* change to them is recorded in the frame, taking effect from the next pixel
+//* to be output. Changes outside the visible lines are picked up when the next
+//* frame starts instead.
+static void record_tint_change() {
+    if (scanline >= 240)
+        return;
+    //* Pixel x is output on dot x + 2, and dot has already been run
+    unsigned const pixel = 256*scanline + (dot == 0 ? 0 : min(dot - 1, 256u));
+    if (pixel < 240*256)
+        add_tint_change(*output_frame, pixel, tint_bits);
+}
+
 static void set_derived_ppumask_vars() {
     rendering_enabled = show_bg || show_sprites;
     bg_clip_comp      = !show_bg      ? 256 : show_bg_left_8      ? 0 : 8;
     sprite_clip_comp  = !show_sprites ? 256 : show_sprites_left_8 ? 0 : 8;
-    //* The status of the tint bits determines the current palette
-    pal_to_rgb        = nes_to_rgb[tint_bits];
+    record_tint_change();
 }
 
 void write_ppu_reg(uint8_t val, unsigned n) {
@@ -1022,7 +1283,7 @@ void write_ppu_reg(uint8_t val, unsigned n) {
             //* t: ... .... ABCD EFGH = val: ABCD EFGH
             t = (t & 0x7F00) | val;
             //* There is a delay of ~3 ticks before t is copied to v
-            pending_v_update = 3;
+            v_update_cycle = ppu_cycle + 3;
         }
 
         write_flip_flop = !write_flip_flop;
@@ -1054,9 +1315,7 @@ static void clear_2001() {
     show_bg_left_8       = show_sprites_left_8 = false;
     show_bg              = show_sprites        = false;
     tint_bits            = 0;
-    pal_to_rgb           = nes_to_rgb[tint_bits];
-    rendering_enabled    = false;
-    bg_clip_comp         = sprite_clip_comp = 256;
+    set_derived_ppumask_vars();
 }
 
 void set_ppu_cold_boot_state() {
@@ -1092,12 +1351,13 @@ void set_ppu_cold_boot_state() {
     //* Misc. regs and helpers
     write_flip_flop     = false;
     ppu_data_reg        = 0;
-    pending_v_update    = 0;     //* No pending v update
+    v_update_cycle      = 0;     //* No pending v update
     odd_frame           = false; //* Initial frame is even
     initial_frame       = starts_on_initial_frame;
     s0_on_next_scanline = s0_on_cur_scanline = false;
     ppu_addr_bus        = 0;
     dot                 = scanline = ppu_cycle = 0;
+    begin_frame(*output_frame, tint_bits);
 
     //* Open bus
 
@@ -1108,7 +1368,7 @@ void set_ppu_cold_boot_state() {
 
     nt_byte    = at_byte    = 0;
     bg_byte_l  = bg_byte_h  = 0;
-    bg_shift_l = bg_shift_h = 0;
+    bg_shift   = 0;
     at_shift_l = at_shift_h = 0;
     at_latch_l = at_latch_h = 0;
 
@@ -1119,6 +1379,10 @@ void set_ppu_cold_boot_state() {
     init_array(sprite_x      , (uint8_t)0);
     init_array(sprite_pat_l  , (uint8_t)0);
     init_array(sprite_pat_h  , (uint8_t)0);
+
+    init_array(sprite_line   , (uint8_t)0);
+    n_sprite_line_sprites = 0;
+    sprite_line_dirty = false;
 }
 
 void reset_ppu() {
@@ -1143,12 +1407,16 @@ void reset_ppu() {
 
 template<bool calculating_size, bool is_save>
 void transfer_ppu_state(uint8_t *&buf) {
-    if (chr_is_ram) TRANSFER_P(chr_base, chr_8k_banks*0x2000);
+    if (chr_is_ram) {
+        TRANSFER_P(chr_base, chr_8k_banks*0x2000);
+        if (!calculating_size && !is_save)
+            update_all_chr_rows();
+    }
     TRANSFER_P(ciram, mirroring == FOUR_SCREEN ? 0x1000 : 0x800);
     TRANSFER(palettes)
     TRANSFER(oam) TRANSFER(sec_oam)
     TRANSFER(t) TRANSFER(v) TRANSFER(fine_x)
-    TRANSFER(pending_v_update)
+    TRANSFER(v_update_cycle)
 
     TRANSFER(v_inc)
     TRANSFER(sprite_pat_addr)
@@ -1182,7 +1450,17 @@ void transfer_ppu_state(uint8_t *&buf) {
 
     TRANSFER(nt_byte) TRANSFER(at_byte)
     TRANSFER(bg_byte_l) TRANSFER(bg_byte_h)
-    TRANSFER(bg_shift_l) TRANSFER(bg_shift_h)
+    {
+        //* Saved as the two 16-bit registers, like in the hardware
+        uint16_t bg_shift_l = compact_pattern_bits(bg_shift);
+        uint16_t bg_shift_h = compact_pattern_bits(bg_shift >> 1);
+        TRANSFER(bg_shift_l) TRANSFER(bg_shift_h)
+        if (!is_save)
+            bg_shift = (spread_pattern_bits(bg_shift_l >> 8) << 16) |
+                       spread_pattern_bits(bg_shift_l & 0xFF)        |
+                       (spread_pattern_bits(bg_shift_h >> 8) << 17) |
+                       (spread_pattern_bits(bg_shift_h & 0xFF) << 1);
+    }
     TRANSFER(at_shift_l) TRANSFER(at_shift_h)
     TRANSFER(at_latch_l) TRANSFER(at_latch_h)
 
@@ -1193,6 +1471,8 @@ void transfer_ppu_state(uint8_t *&buf) {
 
     TRANSFER(s0_on_next_scanline)
     TRANSFER(s0_on_cur_scanline)
+    if (!is_save)
+        sprite_line_dirty = true;
 
     TRANSFER(sprite_y) TRANSFER(sprite_index)
     TRANSFER(sprite_in_range)
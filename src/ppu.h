@@ -8,30 +8,37 @@
 
 //* Nametable memory of variable size, initialized when loading the ROM. 2 KB is
 //* built in, and the cart can provide an extra 2 KB (though this is rare).
-extern uint8_t *ciram;
+extern CONSOLE_LOCAL uint8_t *ciram;
 
 //* The number of the last line in the frame, at the end of the VBlank interval.
 //* Differs between PAL and NTSC.
-extern unsigned prerender_line;
+extern CONSOLE_LOCAL unsigned prerender_line;
 
 //* Optimization - always equals show_bg || show_sprites
-extern bool rendering_enabled;
+extern CONSOLE_LOCAL bool rendering_enabled;
 
 //* PPU cycles run so far. Used as a general-purpose timestamp.
-extern uint64_t ppu_cycle;
+extern CONSOLE_LOCAL uint64_t ppu_cycle;
 
 //* Current position within the frame
-extern unsigned dot, scanline;
+extern CONSOLE_LOCAL unsigned dot, scanline;
 
 //* VRAM address currently being output. Some mappers (e.g., MMC3) snoop on
 //* this.
-extern unsigned ppu_addr_bus;
+extern CONSOLE_LOCAL unsigned ppu_addr_bus;
 
 void init_ppu_for_rom();
 
-//* These use different timings corresponding to the TV standard
-void tick_ntsc_ppu();
-void tick_pal_ppu();
+//* Runs the PPU for 'n' ticks. Points to a version of the PPU loop specialized
+//* for the TV standard and the class of the mapper (see Mapper_class), picked
+//* by init_ppu_for_rom().
+extern CONSOLE_LOCAL void (*run_ppu)(unsigned n);
+
+//* Returns (a lower bound on) the number of ticks until the PPU next does
+//* something the CPU can see without accessing a PPU register: completing the
+//* frame or raising the NMI for VBlank. Used to decide how far the PPU can be
+//* allowed to fall behind the CPU.
+unsigned ppu_ticks_till_event();
 
 //* n = 0...7 corresponds to $2000-$2007
 uint8_t read_ppu_reg(unsigned n);
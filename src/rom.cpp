@@ -4,37 +4,38 @@
 #include "audio.h"
 #include "mapper.h"
 #include "md5.h"
+#include "movie.h"
 #include "ppu.h"
 #include "rom.h"
 #include "cpu.h"
 
 #include "save_states.h"
 #include "timing.h"
-#include "sdl_backend.h"
+#include "backend.h"
 
-uint8_t *prg_base;
-unsigned prg_16k_banks;
-uint8_t *chr_base;
-unsigned chr_8k_banks;
-uint8_t *wram_base;
-unsigned wram_8k_banks;
+CONSOLE_LOCAL uint8_t *prg_base;
+CONSOLE_LOCAL unsigned prg_16k_banks;
+CONSOLE_LOCAL uint8_t *chr_base;
+CONSOLE_LOCAL unsigned chr_8k_banks;
+CONSOLE_LOCAL uint8_t *wram_base;
+CONSOLE_LOCAL unsigned wram_8k_banks;
 
-bool is_pal;
-bool has_battery;
-bool has_trainer;
-bool is_vs_unisystem;
-bool is_playchoice_10;
-bool has_bus_conflicts;
-bool chr_is_ram;
-bool rom_loaded;
+CONSOLE_LOCAL bool is_pal;
+CONSOLE_LOCAL bool has_battery;
+CONSOLE_LOCAL bool has_trainer;
+CONSOLE_LOCAL bool is_vs_unisystem;
+CONSOLE_LOCAL bool is_playchoice_10;
+CONSOLE_LOCAL bool has_bus_conflicts;
+CONSOLE_LOCAL bool chr_is_ram;
+CONSOLE_LOCAL bool rom_loaded;
 
-Mapper_fns mapper_fns;
+CONSOLE_LOCAL Mapper_fns mapper_fns;
 
-uint8_t *rom_buf;
-const char* fname;
+CONSOLE_LOCAL uint8_t *rom_buf;
+CONSOLE_LOCAL const char* fname;
 
 //* SRAM savefile
-char *savename;
+CONSOLE_LOCAL char *savename;
 
 char const *const mirroring_to_str[N_MIRRORING_MODES] =
   { "horizontal",
@@ -43,7 +44,7 @@ char const *const mirroring_to_str[N_MIRRORING_MODES] =
     "one-screen, high",
     "four-screen" };
 
-ROMHeader LoadedROMHeader; 
+CONSOLE_LOCAL ROMHeader LoadedROMHeader; 
 
 static void do_rom_specific_overrides();
 
@@ -196,6 +197,9 @@ bool load_rom(const char *filename) {
         rom_loaded = false;
         return false;
     }
+    //* Point the nametable pages into CIRAM. Mappers can change this in init().
+    set_mirroring(mirroring);
+    nt_reads_via_mapper = false;
 
     if (mirroring == FOUR_SCREEN || mapper == 7){
         //* Assume no WRAM when four-screen, per
@@ -213,6 +217,7 @@ bool load_rom(const char *filename) {
             return false;
         }
     }
+    map_wram_6000_page();
 
 
     if ((chr_is_ram = (chr_8k_banks == 0))) {
@@ -227,6 +232,11 @@ bool load_rom(const char *filename) {
         chr_base = prg_base + 16*1024*prg_16k_banks;
     } 
 
+    if (!init_chr_rows()) {
+        rom_loaded = false;
+        return false;
+    }
+
 
     if(is_nes_2_0) {
         if (!bRunTests){
@@ -272,8 +282,11 @@ void unload_rom() {
     if(has_battery){
         write_SRAM();
     }
+    //* Write out a movie being recorded while the PRG ROM is still there to
+    //* identify it
+    end_movie();
     //* Flush any pending audio samples
-    end_audio_frame();
+    end_last_apu_frame();
 
     //* Clear Buffers
     free_array_set_null(rom_buf);
@@ -281,8 +294,10 @@ void unload_rom() {
     if (chr_is_ram){
         free_array_set_null(chr_base);
     }
+    deinit_chr_rows();
     free_array_set_null(wram_base);
 
+    deinit_apu_for_rom();
     deinit_audio_for_rom();
     deinit_save_states_for_rom();
 
@@ -317,8 +332,8 @@ static void set_pal() {
 }
 
 static void do_rom_specific_overrides() {
-    static MD5_CTX md5_ctx;
-    static unsigned char md5[16];
+    static CONSOLE_LOCAL MD5_CTX md5_ctx;
+    static CONSOLE_LOCAL unsigned char md5[16];
 
     MD5_Init(&md5_ctx);
     MD5_Update(&md5_ctx, (void*)prg_base, 16*1024*prg_16k_banks);
@@ -372,6 +387,7 @@ void read_SRAM(){
             printf("Loading SRAM from '%s'\n", savename);
         }
         wram_6000_page = get_file_buffer(savename,savesize);
+        map_wram_6000_page();
     }else{
         if (!bRunTests && bVerbose){
             printf("No SRAM found!\n");
@@ -10,11 +10,13 @@
 #include "rom.h"
 #include "save_states.h"
 #include "timing.h"
-#include "sdl_backend.h"
+#include "video.h"
+#include "backend.h"
+#include "benchmark.h"
 
 //* Buffer for the save state.
-static uint8_t *state;
-static size_t state_size;
+static CONSOLE_LOCAL uint8_t *state;
+static CONSOLE_LOCAL size_t state_size;
 
 template<bool calculating_size, bool is_save>
 static size_t transfer_system_state(uint8_t *buf) {
@@ -83,6 +85,559 @@ bool load_state(char const *statefile) {
 
 }
 
+size_t get_state_size() {
+    return state_size;
+}
+
+void save_state_to(uint8_t *buf) {
+    transfer_system_state<false, true>(buf);
+}
+
+void load_state_from(uint8_t *buf) {
+    transfer_system_state<false, false>(buf);
+}
+
+//*
+//* Rewinding
+//*
+//* A snapshot of the system state is recorded every rewind_interval frames into
+//* a ring buffer. The buffer and the index of the snapshots in it together take
+//* up rewind_budget bytes. Most snapshots are stored as the XOR
+//* of the state with the most recent keyframe (a complete snapshot). Little of
+//* the state changes over a few seconds, so that is mostly zero bytes, and the
+//* runs of zeros are then squeezed out (see encode_zero_runs()). When the buffer
+//* fills up, the oldest keyframe is dropped along with the snapshots that
+//* depend on it.
+
+size_t   rewind_budget   = default_rewind_budget;
+unsigned rewind_interval = default_rewind_interval;
+CONSOLE_LOCAL bool     rewind_pushed;
+
+//* Bytes of the budget per snapshot when sizing the index. Deltas can be
+//* smaller (down to around 35 bytes in a static scene), in which case the
+//* oldest snapshots are dropped early, but that still leaves over an hour of
+//* history with the default settings.
+static size_t const min_snapshot_size = 128;
+
+//* Record a keyframe after this many deltas. Deltas grow as the state drifts
+//* away from the keyframe, while keyframes are big - this is a compromise.
+static unsigned const keyframe_interval = 60;
+
+//* Holds the encoded snapshots. Null if rewinding is disabled.
+static CONSOLE_LOCAL uint8_t *rewind_buf;
+static CONSOLE_LOCAL size_t rewind_buf_size;
+//* Where the next snapshot goes, unless it doesn't fit before the end of
+//* rewind_buf, in which case it goes at the start
+static CONSOLE_LOCAL size_t rewind_buf_head;
+
+struct Snapshot {
+    uint32_t offset; //* Position in rewind_buf
+    uint32_t size;   //* Encoded size in bytes
+    bool is_keyframe;
+};
+
+//* The snapshots in rewind_buf, oldest first, in a circular array. Deltas only
+//* compress to a few dozen bytes in static scenes, so the number of snapshots
+//* is capped separately, with min_snapshot_size bytes of the budget per
+//* snapshot.
+static CONSOLE_LOCAL Snapshot *snapshots;
+static CONSOLE_LOCAL unsigned max_snapshots;
+static CONSOLE_LOCAL unsigned first_snapshot;
+static CONSOLE_LOCAL unsigned n_snapshots;
+
+//* The state for the newest keyframe. New deltas are against this.
+static CONSOLE_LOCAL uint8_t *keyframe_state;
+static CONSOLE_LOCAL unsigned deltas_since_keyframe;
+
+//* The XOR of the state and keyframe_state, and its encoding
+static CONSOLE_LOCAL uint8_t *delta_buf;
+static CONSOLE_LOCAL uint8_t *encode_buf;
+
+static CONSOLE_LOCAL unsigned frames_till_snapshot;
+
+//* Statistics for print_rewind_stats()
+static CONSOLE_LOCAL unsigned long n_keyframes_recorded, n_deltas_recorded;
+static CONSOLE_LOCAL uint64_t keyframe_bytes, delta_bytes;
+static CONSOLE_LOCAL uint64_t snapshot_ns;
+
+//* The encoding is a sequence of (zero run length, literal length, literal
+//* bytes) records, with the lengths as LEB128 varints. A trailing run of zeros
+//* is left out. Literals span short runs of zeros, since a new record costs at
+//* least two bytes.
+static unsigned const min_zero_run = 4;
+
+//* Worst case is a single literal record covering the whole state
+static size_t max_encoded_size(size_t len) { return len + 2*10; }
+
+static void write_varint(uint8_t *&dst, size_t n) {
+    for (; n >= 0x80; n >>= 7)
+        *dst++ = 0x80 | (n & 0x7F);
+    *dst++ = n;
+}
+
+static size_t read_varint(uint8_t const *&src) {
+    size_t n = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        uint8_t const b = *src++;
+        n |= size_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return n;
+    }
+}
+
+static bool zero_run_at(uint8_t const *src, size_t i, size_t len) {
+    for (size_t const end = min(i + min_zero_run, len); i < end; ++i)
+        if (src[i])
+            return false;
+    return true;
+}
+
+//* Encodes 'len' bytes from 'src' into 'dst' and returns the encoded size.
+//* Performance hotspot - runs on every snapshot, and zero bytes dominate.
+static size_t encode_zero_runs(uint8_t const *src, size_t len, uint8_t *dst) {
+    uint8_t *const start = dst;
+    size_t i = 0;
+    for (;;) {
+        size_t const zeros_start = i;
+        //* Skip eight zero bytes at a time where possible
+        for (uint64_t word; i + 8 <= len; i += 8) {
+            memcpy(&word, src + i, 8);
+            if (word)
+                break;
+        }
+        while (i < len && !src[i])
+            ++i;
+        if (i == len)
+            break;
+
+        size_t const literal_start = i;
+        for (;;) {
+            while (i < len && src[i])
+                ++i;
+            if (i == len || zero_run_at(src, i, len))
+                break;
+            ++i;
+        }
+
+        write_varint(dst, literal_start - zeros_start);
+        write_varint(dst, i - literal_start);
+        memcpy(dst, src + literal_start, i - literal_start);
+        dst += i - literal_start;
+    }
+    return dst - start;
+}
+
+//* XORs the data encoded in 'src' onto 'dst'
+static void decode_zero_runs_xor(uint8_t const *src, size_t size, uint8_t *dst) {
+    uint8_t const *const end = src + size;
+    while (src != end) {
+        dst += read_varint(src);
+        for (size_t n = read_varint(src); n != 0; --n)
+            *dst++ ^= *src++;
+    }
+}
+
+static Snapshot &nth_snapshot(unsigned n) {
+    return snapshots[(first_snapshot + n) % max_snapshots];
+}
+
+static Snapshot &newest_snapshot() {
+    return nth_snapshot(n_snapshots - 1);
+}
+
+static void drop_oldest_keyframe() {
+    //* The oldest snapshot is always a keyframe. Drop it and its deltas.
+    do {
+        first_snapshot = (first_snapshot + 1) % max_snapshots;
+        --n_snapshots;
+    } while (n_snapshots > 0 && !nth_snapshot(0).is_keyframe);
+}
+
+//* Makes room for a 'size'-byte snapshot at the head of rewind_buf by dropping
+//* the oldest snapshots as needed, and returns its offset. Snapshots are stored
+//* in order, so the ones in the way are always the oldest.
+static size_t make_room(size_t size) {
+    bool const wraps = rewind_buf_head + size > rewind_buf_size;
+    size_t const offset = wraps ? 0 : rewind_buf_head;
+
+    while (n_snapshots > 0) {
+        Snapshot const &oldest = nth_snapshot(0);
+        bool const overlaps = oldest.offset < offset + size &&
+                              oldest.offset + oldest.size > offset;
+        //* When wrapping around, the snapshots after the head are dropped too,
+        //* to keep the oldest snapshot first in the buffer
+        bool const past_head = wraps && oldest.offset >= rewind_buf_head;
+        if (!overlaps && !past_head && n_snapshots < max_snapshots)
+            break;
+        drop_oldest_keyframe();
+    }
+
+    rewind_buf_head = offset + size;
+    return offset;
+}
+
+static void record_snapshot() {
+    transfer_system_state<false, true>(state);
+
+    bool is_keyframe = n_snapshots == 0 ||
+                       deltas_since_keyframe == keyframe_interval;
+    size_t size;
+    size_t offset;
+    if (!is_keyframe) {
+        for (size_t i = 0; i < state_size; ++i)
+            delta_buf[i] = state[i] ^ keyframe_state[i];
+        size = encode_zero_runs(delta_buf, state_size, encode_buf);
+        offset = make_room(size);
+        //* If the buffer is so small that our own keyframe had to go, this
+        //* has to be a keyframe too
+        is_keyframe = n_snapshots == 0;
+    }
+    if (is_keyframe) {
+        size = encode_zero_runs(state, state_size, encode_buf);
+        offset = make_room(size);
+        memcpy(keyframe_state, state, state_size);
+        deltas_since_keyframe = 0;
+        ++n_keyframes_recorded;
+        keyframe_bytes += size;
+    }
+    else {
+        ++deltas_since_keyframe;
+        ++n_deltas_recorded;
+        delta_bytes += size;
+    }
+
+    memcpy(rewind_buf + offset, encode_buf, size);
+    Snapshot &snapshot = nth_snapshot(n_snapshots++);
+    snapshot.offset = offset;
+    snapshot.size = size;
+    snapshot.is_keyframe = is_keyframe;
+}
+
+//* Decodes snapshot 'n' into 'dst'. Deltas are decoded against
+//* keyframe_state.
+static void decode_snapshot(unsigned n, uint8_t *dst) {
+    Snapshot const &snapshot = nth_snapshot(n);
+    if (snapshot.is_keyframe)
+        memset(dst, 0, state_size);
+    else
+        memcpy(dst, keyframe_state, state_size);
+    decode_zero_runs_xor(rewind_buf + snapshot.offset, snapshot.size, dst);
+}
+
+//* Drops the newest snapshot, making keyframe_state the state of the previous
+//* keyframe if it was a keyframe
+static void drop_newest_snapshot() {
+    rewind_buf_head = newest_snapshot().offset;
+    bool const was_keyframe = newest_snapshot().is_keyframe;
+    --n_snapshots;
+
+    if (!was_keyframe) {
+        --deltas_since_keyframe;
+        return;
+    }
+
+    unsigned keyframe = n_snapshots - 1;
+    while (!nth_snapshot(keyframe).is_keyframe)
+        --keyframe;
+    deltas_since_keyframe = n_snapshots - 1 - keyframe;
+    decode_snapshot(keyframe, keyframe_state);
+}
+
+//* Loads a snapshot taken earlier in the session. The snapshot includes the
+//* controller state, but the buttons held right now should stay held.
+static void load_snapshot_keeping_buttons(uint8_t *buf) {
+    uint8_t const buttons[2] = { read_frontend_button_states(0),
+                                 read_frontend_button_states(1) };
+
+    transfer_system_state<false, false>(buf);
+
+    for (unsigned n = 0; n < 2; ++n)
+        for (unsigned i = 0; i < 8; ++i) {
+            if (NTH_BIT(buttons[n], i))
+                set_button_state(n, i);
+            else
+                clear_button_state(n, i);
+        }
+}
+
+//* Loads the newest snapshot, and drops it unless it's the only one left (so
+//* that rewinding stops there)
+static void rewind_one_snapshot() {
+    decode_snapshot(n_snapshots - 1, state);
+    load_snapshot_keeping_buttons(state);
+
+    if (n_snapshots > 1)
+        drop_newest_snapshot();
+}
+
+void handle_rewind(bool do_rewind) {
+    if (!rewind_buf)
+        return;
+
+    BENCH_SCOPE(BENCH_REWIND);
+
+    //* The PPU state needs to be complete
+    sync_ppu();
+
+    if (do_rewind) {
+        if (n_snapshots > 0) {
+            rewind_one_snapshot();
+            //* The PPU is somewhere else now. This works out the next sync
+            //* point again.
+            sync_ppu();
+        }
+        //* Pick up recording from the rewound-to state
+        frames_till_snapshot = 0;
+        return;
+    }
+
+    if (frames_till_snapshot > 0) {
+        --frames_till_snapshot;
+        return;
+    }
+    frames_till_snapshot = rewind_interval - 1;
+
+    uint64_t const start_time = get_host_time_ns();
+    record_snapshot();
+    snapshot_ns += get_host_time_ns() - start_time;
+}
+
+void print_rewind_stats() {
+    if (!rewind_buf) {
+        puts("Rewinding disabled");
+        return;
+    }
+
+    unsigned long const n_recorded = n_keyframes_recorded + n_deltas_recorded;
+    if (n_recorded == 0) {
+        puts("No rewind snapshots recorded");
+        return;
+    }
+
+    size_t used = 0;
+    for (unsigned i = 0; i < n_snapshots; ++i)
+        used += nth_snapshot(i).size;
+
+    printf("Rewind: %u snapshots every %u frames (%.1f secs of history) in %zu of %zu KB\n",
+           n_snapshots, rewind_interval, n_snapshots*rewind_interval/ppu_fps,
+           used/1024, rewind_buf_size/1024);
+    printf("  %zu-byte state, keyframes average %.0f bytes, deltas %.0f bytes\n",
+           state_size,
+           n_keyframes_recorded ? double(keyframe_bytes)/n_keyframes_recorded : 0.0,
+           n_deltas_recorded ? double(delta_bytes)/n_deltas_recorded : 0.0);
+    printf("  %.2f us per snapshot, %.2f us per emulated frame on average\n",
+           snapshot_ns/1e3/n_recorded, snapshot_ns/1e3/n_recorded/rewind_interval);
+}
+
+static void init_rewind() {
+    if (rewind_budget == 0 || bRunTests)
+        return;
+
+    if (rewind_interval == 0)
+        rewind_interval = 1;
+
+    //* The index comes out of the budget too
+    max_snapshots   = rewind_budget/(min_snapshot_size + sizeof(Snapshot));
+    rewind_buf_size = rewind_budget - max_snapshots*sizeof(Snapshot);
+
+    //* Must hold at least two keyframes for rewinding to go anywhere. The
+    //* offsets are 32-bit.
+    if (rewind_buf_size < 2*max_encoded_size(state_size) ||
+        rewind_buf_size > UINT32_MAX) {
+        printf("rewind buffer size of %zu bytes is out of range - rewinding disabled\n",
+               rewind_budget);
+        return;
+    }
+
+    if (!(rewind_buf     = new (std::nothrow) uint8_t[rewind_buf_size])          ||
+        !(snapshots      = new (std::nothrow) Snapshot[max_snapshots])           ||
+        !(keyframe_state = new (std::nothrow) uint8_t[state_size])               ||
+        !(delta_buf      = new (std::nothrow) uint8_t[state_size])               ||
+        !(encode_buf     = new (std::nothrow) uint8_t[max_encoded_size(state_size)])) {
+        printf("failed to allocate %zu-byte rewind buffer\n", rewind_budget);
+        exit(1);
+    }
+
+    rewind_buf_head = 0;
+    first_snapshot = n_snapshots = 0;
+    deltas_since_keyframe = 0;
+    frames_till_snapshot = 0;
+    n_keyframes_recorded = n_deltas_recorded = 0;
+    keyframe_bytes = delta_bytes = snapshot_ns = 0;
+
+    if (bVerbose)
+        printf("rewind buffer: %zu bytes, snapshot every %u frames\n",
+               rewind_budget, rewind_interval);
+}
+
+static void deinit_rewind() {
+    free_array_set_null(rewind_buf);
+    free_array_set_null(snapshots);
+    free_array_set_null(keyframe_state);
+    free_array_set_null(delta_buf);
+    free_array_set_null(encode_buf);
+}
+
+//*
+//* Run-ahead
+//*
+//* Hides input lag by showing frames from the future. After each real frame,
+//* the state is saved, run_ahead_frames frames are run with the current input,
+//* and the last of them is displayed. The saved state is then loaded to get
+//* back to the real timeline. The PPU only produces pixels for the displayed
+//* frame (see skip_frame in video.h), and the APU is muted while running
+//* ahead, so the audio comes from the real timeline.
+//*
+//* The snapshot goes to a buffer allocated when the ROM is loaded, so nothing
+//* is allocated or encoded per frame.
+
+unsigned run_ahead_frames;
+
+//* Holds the state of the real timeline while running ahead. Null if run-ahead
+//* is disabled.
+static CONSOLE_LOCAL uint8_t *run_ahead_state;
+//* Frames left to run ahead, including the current one. 0 on the real
+//* timeline.
+static CONSOLE_LOCAL unsigned run_ahead_frames_left;
+//* Whether the next displayed frame is skipped, as decided by the frontend
+//* (see end_output_frame())
+static CONSOLE_LOCAL bool skip_shown_frame;
+
+//* Statistics for print_run_ahead_stats(). Time is split into saving the
+//* state, running ahead (including displaying the last frame), loading the
+//* state, and running the real frame. run_ahead_mark_ns is the time of the
+//* last switch between these.
+static CONSOLE_LOCAL unsigned long n_run_aheads;
+static CONSOLE_LOCAL uint64_t run_ahead_save_ns, run_ahead_frames_ns,
+                              run_ahead_load_ns, real_frame_ns,
+                              run_ahead_mark_ns;
+
+bool running_ahead() {
+    return run_ahead_frames_left != 0;
+}
+
+bool frame_is_shown() {
+    return !run_ahead_state || run_ahead_frames_left == 1;
+}
+
+//* Loads the state of the real timeline
+static void end_run_ahead() {
+    run_ahead_frames_left = 0;
+    //* Catch up first, so that no PPU cycles from the run-ahead are left to be
+    //* run on the loaded state
+    sync_ppu();
+    unmute_apu();
+    load_snapshot_keeping_buttons(run_ahead_state);
+    //* The PPU is somewhere else now. This works out the next sync point again.
+    sync_ppu();
+    //* Real frames aren't displayed
+    skip_frame = true;
+}
+
+void handle_run_ahead() {
+    if (!run_ahead_state)
+        return;
+
+    BENCH_SCOPE(BENCH_RUN_AHEAD);
+
+    uint64_t const start_time = get_host_time_ns();
+
+    if (run_ahead_frames_left == 0) {
+        //* A real frame completed. Save it and start running ahead.
+        if (n_run_aheads > 0)
+            real_frame_ns += start_time - run_ahead_mark_ns;
+
+        //* The PPU state needs to be complete
+        sync_ppu();
+        transfer_system_state<false, true>(run_ahead_state);
+        mute_apu();
+        run_ahead_frames_left = run_ahead_frames;
+        skip_frame = run_ahead_frames_left > 1 || skip_shown_frame;
+
+        run_ahead_mark_ns = get_host_time_ns();
+        run_ahead_save_ns += run_ahead_mark_ns - start_time;
+        return;
+    }
+
+    if (--run_ahead_frames_left > 0) {
+        //* Only the last frame is displayed
+        skip_frame = run_ahead_frames_left > 1 || skip_shown_frame;
+        return;
+    }
+
+    //* The last frame has been displayed
+    run_ahead_frames_ns += start_time - run_ahead_mark_ns;
+    skip_shown_frame = skip_frame;
+    end_run_ahead();
+
+    run_ahead_mark_ns = get_host_time_ns();
+    run_ahead_load_ns += run_ahead_mark_ns - start_time;
+    ++n_run_aheads;
+}
+
+void cancel_run_ahead() {
+    if (!running_ahead())
+        return;
+
+    end_run_ahead();
+    //* The state was saved at the end of a frame
+    frame_offset = 0;
+}
+
+void print_run_ahead_stats() {
+    if (!run_ahead_state) {
+        puts("Run-ahead disabled");
+        return;
+    }
+
+    if (n_run_aheads < 2) {
+        puts("Run-ahead: too few frames to measure");
+        return;
+    }
+
+    //* real_frame_ns doesn't include the frame before the first run-ahead
+    double const real_us = real_frame_ns/1e3/(n_run_aheads - 1);
+    double const save_us = run_ahead_save_ns/1e3/n_run_aheads;
+    double const run_us  = run_ahead_frames_ns/1e3/n_run_aheads;
+    double const load_us = run_ahead_load_ns/1e3/n_run_aheads;
+
+    printf("Run-ahead: %u frames ahead, %lu real frames, %zu-byte state\n",
+           run_ahead_frames, n_run_aheads, state_size);
+    printf("  %.2f us saving, %.2f us running ahead, %.2f us loading per real frame\n",
+           save_us, run_us, load_us);
+    //* Real frames produce no pixels, so they're cheaper than normal frames.
+    //* What matters is whether the total fits in the frame time.
+    double const total_us = real_us + save_us + run_us + load_us;
+    printf("  %.2f us for the real frame, %.2f us in total, %.0f%% of the %.2f ms frame time\n",
+           real_us, total_us, 100*total_us/(1e6/ppu_fps), 1e3/ppu_fps);
+}
+
+static void init_run_ahead() {
+    run_ahead_frames_left = 0;
+    skip_shown_frame = false;
+    n_run_aheads = 0;
+    run_ahead_save_ns = run_ahead_frames_ns = run_ahead_load_ns = 0;
+    real_frame_ns = 0;
+
+    if (run_ahead_frames == 0 || bRunTests)
+        return;
+
+    if (!(run_ahead_state = new (std::nothrow) uint8_t[state_size])) {
+        printf("failed to allocate %zu-byte run-ahead buffer\n", state_size);
+        exit(1);
+    }
+
+    if (bVerbose)
+        printf("running ahead %u frames\n", run_ahead_frames);
+}
+
+static void deinit_run_ahead() {
+    if (bVerbose && run_ahead_state)
+        print_run_ahead_stats();
+
+    free_array_set_null(run_ahead_state);
+}
+
 void init_save_states_for_rom() {   
 
     state_size = transfer_system_state<true, false>(0);
@@ -94,9 +649,14 @@ void init_save_states_for_rom() {
     if(!(state = new (std::nothrow) uint8_t[state_size])) {
         printf("failed to allocate %zu-byte buffer for save state", state_size);
     }
+
+    init_rewind();
+    init_run_ahead();
 }
 
 void deinit_save_states_for_rom() {
 
+    deinit_run_ahead();
+    deinit_rewind();
     free_array_set_null(state);
 }
\ No newline at end of file
@@ -4,4 +4,53 @@ void init_save_states_for_rom();
 void deinit_save_states_for_rom();
 
 bool save_state(char const *statefile);
-bool load_state(char const *statefile);
\ No newline at end of file
+bool load_state(char const *statefile);
+
+//* Ditto for states kept in memory. The buffer must be get_state_size() bytes.
+size_t get_state_size();
+void save_state_to(uint8_t *buf);
+void load_state_from(uint8_t *buf);
+
+//* Rewinding. See save_states.cpp.
+
+size_t   const default_rewind_budget   = 16*1024*1024;
+unsigned const default_rewind_interval = 2;
+
+//* Memory for rewind snapshots in bytes (0 disables rewinding), and the number
+//* of frames between snapshots. Take effect when a ROM is loaded.
+extern size_t   rewind_budget;
+extern unsigned rewind_interval;
+
+//* Set by the frontend while the rewind button is held
+extern CONSOLE_LOCAL bool rewind_pushed;
+
+//* Called at the end of each frame. Records a snapshot when one is due, or
+//* steps back to the previous snapshot if 'do_rewind' is true.
+void handle_rewind(bool do_rewind);
+
+//* Prints the number and size of the snapshots and the time spent recording
+//* them, for judging the overhead of rewinding
+void print_rewind_stats();
+
+//* Run-ahead. See save_states.cpp.
+
+//* Number of frames to run ahead of the real timeline (0 disables run-ahead).
+//* Takes effect when a ROM is loaded.
+extern unsigned run_ahead_frames;
+
+//* True while running ahead of the real timeline
+bool running_ahead();
+//* True if the frame that just completed should be displayed. With run-ahead,
+//* only the last frame of each run-ahead is.
+bool frame_is_shown();
+//* Called at the end of each frame. Starts running ahead after a real frame,
+//* and goes back to the real timeline after the last run-ahead frame.
+void handle_run_ahead();
+//* Goes straight back to the real timeline if running ahead. Needed before
+//* anything that should act on the real timeline, like resets and states
+//* saved or loaded while paused.
+void cancel_run_ahead();
+
+//* Prints the time per real frame spent saving, running ahead and loading,
+//* for picking run_ahead_frames for a game
+void print_run_ahead_stats();
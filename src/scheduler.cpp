@@ -0,0 +1,56 @@
+#include "common.h"
+
+#include "apu.h"
+#include "cpu.h"
+#include "scheduler.h"
+
+CONSOLE_LOCAL uint64_t cpu_cycle;
+CONSOLE_LOCAL uint64_t next_event_cycle;
+CONSOLE_LOCAL uint64_t events_dispatched;
+
+//* Cycle of each event, or 'never' if it isn't scheduled
+static uint64_t const never = UINT64_MAX;
+static CONSOLE_LOCAL uint64_t event_cycles[N_EVENTS];
+
+static void (*const event_handlers[N_EVENTS])() = {
+    sync_ppu,            //* EVENT_PPU_SYNC
+    clock_frame_counter, //* EVENT_FRAME_COUNTER
+    do_test_reset,       //* EVENT_TEST_RESET
+    do_dmc_fetch };      //* EVENT_DMC_FETCH
+
+//* With this few events, scanning them all beats keeping a heap
+static void update_next_event_cycle() {
+    next_event_cycle = never;
+    for (unsigned i = 0; i < N_EVENTS; ++i)
+        next_event_cycle = min(next_event_cycle, event_cycles[i]);
+}
+
+void schedule_event(Event event, uint64_t cycle) {
+    event_cycles[event] = cycle;
+    update_next_event_cycle();
+}
+
+void cancel_event(Event event) {
+    schedule_event(event, never);
+}
+
+void run_due_events() {
+    //* Handlers usually schedule their next occurrence, so keep going until
+    //* nothing is due
+    while (next_event_cycle <= cpu_cycle) {
+        for (unsigned i = 0; i < N_EVENTS; ++i)
+            if (event_cycles[i] <= cpu_cycle) {
+                event_cycles[i] = never;
+                ++events_dispatched;
+                event_handlers[i]();
+            }
+        update_next_event_cycle();
+    }
+}
+
+void reset_events() {
+    cpu_cycle = 0;
+    for (unsigned i = 0; i < N_EVENTS; ++i)
+        event_cycles[i] = never;
+    next_event_cycle = never;
+}
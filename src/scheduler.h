@@ -0,0 +1,36 @@
+//* Timed hardware events
+//*
+//* Things that happen a known number of CPU cycles into the future are
+//* scheduled here instead of being counted down on every cycle. tick() only
+//* compares the cycle counter against the earliest deadline, and calls
+//* run_due_events() when it has been reached.
+
+enum Event {
+    //* Listed in the order in which events due on the same cycle run
+    EVENT_PPU_SYNC,      //* The PPU needs to catch up (see sync_ppu())
+    EVENT_FRAME_COUNTER, //* APU frame counter step or delayed reset
+    EVENT_TEST_RESET,    //* Reset requested by a test ROM
+    EVENT_DMC_FETCH,     //* DMC sample byte fetch. Last, as it runs further
+                         //* cycles.
+
+    N_EVENTS
+};
+
+//* CPU cycles since emulation was started with run(). Incremented by tick().
+extern CONSOLE_LOCAL uint64_t cpu_cycle;
+
+//* Cycle of the earliest scheduled event
+extern CONSOLE_LOCAL uint64_t next_event_cycle;
+
+//* Number of events dispatched. Only used for benchmark reports.
+extern CONSOLE_LOCAL uint64_t events_dispatched;
+
+//* Schedules 'event' to run on 'cycle', replacing any earlier scheduling of it
+void schedule_event(Event event, uint64_t cycle);
+void cancel_event(Event event);
+
+//* Runs the events that are due on the current cycle
+void run_due_events();
+
+//* Cancels all events and restarts the cycle count from zero
+void reset_events();
@@ -1,6 +1,9 @@
 #include <SDL2/SDL.h>
 
 #include "common.h"
+
+#include <atomic>
+
 #include "audio.h"
 #include "cpu.h"
 #include "input.h"
@@ -8,6 +11,8 @@
 #include "rom.h"
 #include "save_states.h"
 #include "test.h"
+#include "timing.h"
+#include "video.h"
 #include "sdl_backend.h"
 #include "sdl_frontend.h"
 
@@ -18,18 +23,37 @@ static SDL_Texture  *screen_tex;
 SDL_Texture *overlay_tex;
 
 //* Mutexs for the emulation thread.
-SDL_mutex *frame_lock;
 SDL_mutex *event_lock;
-static SDL_cond  *frame_available_cond;
 static SDL_AudioDeviceID audio_device_id;
 
-static bool ready_to_draw_new_frame;
-static bool frame_available;
-static bool pending_sdl_thread_exit;
-
-//* Our screen buffer
-Uint32 *back_buffer __attribute__((aligned(32)));
-Uint32 render_buffers[2][240*256] __attribute__((aligned(32)));
+//* Frames are handed from the emulation thread to the render thread with
+//* lock-free triple buffering. At any time, each of the three buffers is
+//* either being drawn into by the emulation thread (the back buffer), holding
+//* the latest completed frame (the ready buffer), or being displayed by the
+//* render thread. Completing a frame atomically swaps the back buffer with the
+//* ready buffer, and the render thread swaps the buffer it displays with the
+//* ready buffer when it holds a new frame. Neither thread ever waits for the
+//* other, and frames are never copied between buffers. Frames hold palette
+//* indices, which the render thread converts to RGB straight into the texture.
+static Frame frame_buffers[3];
+
+//* Only used by the emulation thread. The back buffer is output_frame.
+static unsigned back_index;
+//* Only used by the render thread
+static unsigned display_index;
+//* Index of the ready buffer, with new_frame_bit set if it holds a frame that
+//* hasn't been displayed yet
+static std::atomic<unsigned> ready_index;
+static unsigned const new_frame_bit = 4;
+
+//* Posted after each completed frame to wake up the render thread
+static SDL_sem *frame_available_sem;
+static std::atomic<bool> pending_sdl_thread_exit;
+
+//* Completed frames that were replaced by a newer frame before the render
+//* thread got to them, and frames the render thread presented again because
+//* there was no new one
+static std::atomic<unsigned long> frames_dropped, frames_duplicated;
 
 
 //* Configuration flags
@@ -41,11 +65,16 @@ bool bExtraVerbose = false;
 bool bRunTests = false;
 bool bForcePAL = false;
 bool bForceNTSC = false;
+bool bAPUThread = false;
+bool bAccurateAudio = false;
 
 //* Framerate control:
 const int FPS = 60;
 const int DELAY = 100.0f / FPS;
 
+//* How far the left trigger must be pulled to rewind (axis range 0-32767)
+const int rewind_trigger_threshold = 16384;
+
 //* Gamepad bits
 struct Controller_t
 {
@@ -67,29 +96,33 @@ void unlock_audio() { SDL_UnlockAudioDevice(audio_device_id); }
 void start_audio_playback() { SDL_PauseAudioDevice(audio_device_id, 0); }
 void stop_audio_playback() { SDL_PauseAudioDevice(audio_device_id, 1); }
 
-void put_pixel(unsigned x, unsigned y, uint32_t color) {
-    assert(x < 256);
-    assert(y < 240);
-    back_buffer[256*y + x] = color;
-}
-
 void draw_frame() {
 
     uint32_t frameStart, frameTime;
+
+    //* Tests are paced to the real frame rate
+    if(bRunTests){
+        sleep_till_end_of_frame();
+    }
     frameStart = SDL_GetTicks();
 
-    SDL_LockMutex(frame_lock);
+    //* Skipped frames are left in the back buffer, to be drawn over, and
+    //* don't wait, so that emulation can catch up
+    if (end_output_frame())
+        return;
 
-    if (ready_to_draw_new_frame) {
-        frame_available = true;
-        SDL_CondSignal(frame_available_cond);
-    } else {
-        //if (!bRunTests && bExtraVerbose){
-        //    puts("draw_frame(): dropping frame");
-        //}
-    }
+    //* Make the completed frame the ready one and continue drawing into the
+    //* previous ready buffer. The release half of the exchange publishes the
+    //* frame, and the acquire half makes sure the render thread is done with
+    //* the buffer we get back.
+    unsigned const prev_ready =
+      ready_index.exchange(back_index | new_frame_bit, std::memory_order_acq_rel);
+    if (prev_ready & new_frame_bit)
+        ++frames_dropped;
+    back_index   = prev_ready & ~new_frame_bit;
+    output_frame = &frame_buffers[back_index];
 
-    SDL_UnlockMutex(frame_lock);
+    SDL_SemPost(frame_available_sem);
 
     //* Wait to mantain framerate:
     frameTime = SDL_GetTicks() - frameStart;
@@ -101,6 +134,18 @@ void draw_frame() {
     }
 }
 
+//* Frontend hooks called from the emulation thread
+
+void frontend_idle() {
+    //* Show GUI when paused
+    GUI::process_inputs();
+    GUI::render();
+}
+
+void frontend_stop_emulation() { GUI::StopEmulation(); }
+void frontend_show_message(string const &msg) { GUI::ShowTextOverlay(msg); }
+void frontend_tests_finished() { bShowGUI = true; }
+
 static void audio_callback(void*, Uint8 *stream, int len) {
     assert(len >= 0);
     read_samples((int16_t*)stream , len/sizeof(int16_t));
@@ -305,6 +350,11 @@ extern void process_events() {
                         break;
                 }
                 break;
+            case SDL_CONTROLLERAXISMOTION:
+                //* Rewind while the left trigger is held down
+                if (event.caxis.axis == SDL_CONTROLLER_AXIS_TRIGGERLEFT)
+                    rewind_pushed = event.caxis.value > rewind_trigger_threshold;
+                break;
             case SDL_QUIT:
                 GUI::Shutdown();
                 break;
@@ -325,21 +375,19 @@ extern void process_events() {
 
 void sdl_thread() {
 
-    int pitch;
     if (bExtraVerbose){
         puts("Entering sdl_thread().");
     }
 
     for(;;) {
 
-        //* Wait for the emulation thread to signal that a frame has completed
-        SDL_LockMutex(frame_lock);
-        ready_to_draw_new_frame = true;
+        //* Wait for the emulation thread to signal that a frame has completed.
+        //* If several frames completed while we were busy, we only want the
+        //* newest one, so consume all the signals.
+        SDL_SemWait(frame_available_sem);
+        while (SDL_SemTryWait(frame_available_sem) == 0);
 
-        while (!frame_available && !pending_sdl_thread_exit)
-            SDL_CondWait(frame_available_cond, frame_lock);
         if (pending_sdl_thread_exit) {
-            SDL_UnlockMutex(frame_lock);
             pending_sdl_thread_exit = false;
             if (bExtraVerbose){
                 puts("quitting sdl_thread().");
@@ -347,8 +395,17 @@ void sdl_thread() {
             return;
         }
 
-        frame_available = ready_to_draw_new_frame = false;
-        SDL_UnlockMutex(frame_lock);
+        //* Take the newest frame, handing back the one we displayed. The
+        //* signal might have been for a frame we already took, in which case
+        //* the previous frame is presented again.
+        bool new_frame = false;
+        if (ready_index.load(std::memory_order_relaxed) & new_frame_bit) {
+            display_index = ready_index.exchange(display_index, std::memory_order_acq_rel) &
+                            ~new_frame_bit;
+            new_frame = true;
+        }
+        else
+            ++frames_duplicated;
 
         //* Check inputs.
         process_events();
@@ -361,11 +418,15 @@ void sdl_thread() {
             return;
         }
         
-        //* Draw the new frame
-        if(SDL_LockTexture(screen_tex, NULL, reinterpret_cast<void**>(&back_buffer), &pitch)){;
-            printf("failed to update screen texture: %s", SDL_GetError());
-            exit(1);
-        }else{
+        //* Convert the new frame to RGB, writing straight into the texture
+        if(new_frame){
+            void *pixels;
+            int pitch;
+            if(SDL_LockTexture(screen_tex, NULL, &pixels, &pitch)){
+                printf("failed to update screen texture: %s", SDL_GetError());
+                exit(1);
+            }
+            frame_to_rgb(frame_buffers[display_index], static_cast<Uint32*>(pixels), pitch/sizeof(Uint32));
             SDL_UnlockTexture(screen_tex);
         }
 
@@ -400,13 +461,13 @@ void exit_sdl_thread() {
     if (bExtraVerbose){
         puts("exit_sdl_thread() called.");
     }
-    //* Wait for the emulation thread to signal that a frame has completed
-    SDL_LockMutex(frame_lock);
     pending_sdl_thread_exit = true;
-    SDL_CondSignal(frame_available_cond);
-    SDL_UnlockMutex(frame_lock);
+    SDL_SemPost(frame_available_sem);
 }
 
+unsigned long get_frames_dropped() { return frames_dropped; }
+unsigned long get_frames_duplicated() { return frames_duplicated; }
+
 //* Initialization and de-initialization
 void init_sdl() {
 
@@ -419,11 +480,10 @@ void init_sdl() {
     SDL_ShowCursor(SDL_DISABLE);
 
     if (bVerbose){
-        #ifdef USE_BLIP_ADD_DELTA_FAST
-            puts("USE_BLIP_ADD_DELTA_FAST enabled!");
-        #else
-            puts("USE_BLIP_ADD_DELTA_FAST disabled.");
-        #endif 
+        if (bAccurateAudio)
+            puts("Band-limited audio synthesis enabled.");
+        else
+            puts("Fast audio synthesis enabled.");
     }
 
     if(SDL_GameControllerAddMappingsFromFile("res/gamecontrollerdb.txt") == -1){
@@ -480,7 +540,10 @@ void init_sdl() {
         exit(1);
     }
 
-    back_buffer  = render_buffers[0];
+    back_index    = 0;
+    output_frame  = &frame_buffers[back_index];
+    ready_index   = 1;
+    display_index = 2;
 
     //* Audio
     SDL_AudioSpec want;
@@ -508,12 +571,8 @@ void init_sdl() {
         printf("failed to create event mutex: %s", SDL_GetError());
         exit(1);
     }
-    if(!(frame_lock = SDL_CreateMutex())) {
-        printf("failed to create frame mutex: %s", SDL_GetError());
-        exit(1);
-    }
-    if(!(frame_available_cond = SDL_CreateCond())) {
-        printf("failed to create frame condition variable: %s", SDL_GetError());
+    if(!(frame_available_sem = SDL_CreateSemaphore(0))) {
+        printf("failed to create frame semaphore: %s", SDL_GetError());
         exit(1);
     }
     
@@ -525,6 +584,11 @@ void deinit_sdl() {
     if (bExtraVerbose){
         puts("Shutting down NESalizer!");
     }
+
+    if (bVerbose){
+        printf("frames dropped: %lu, duplicated: %lu, skipped: %lu\n",
+               get_frames_dropped(), get_frames_duplicated(), frames_skipped);
+    }
     
     //* ImGUI Rom Dialog
     ImGui_ImplSDLRenderer_Shutdown();
@@ -533,8 +597,7 @@ void deinit_sdl() {
 
     //* SDL Mutexs
     SDL_DestroyMutex(event_lock);
-    SDL_DestroyMutex(frame_lock);
-    SDL_DestroyCond(frame_available_cond);
+    SDL_DestroySemaphore(frame_available_sem);
 
     GUI::deinit();
 
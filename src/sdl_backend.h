@@ -3,20 +3,14 @@
 //* Video, audio, and input backend. Uses SDL2.
 #include <SDL2/SDL.h>
 
+#include "backend.h"
+
 //* Debuggin'
-#define USE_BLIP_ADD_DELTA_FAST
 //#define USE_VSYNC
 
 extern bool bUserQuits;
 extern bool exitFlag;
-extern bool bVerbose;
-extern bool bExtraVerbose;
-
-extern bool bRunTests;
-extern bool bForcePAL;
-extern bool bForceNTSC;
 
-extern SDL_mutex *frame_lock;
 extern SDL_mutex *event_lock;
 extern SDL_Texture *overlay_tex;
 
@@ -31,17 +25,12 @@ void deinit_sdl();
 void exit_sdl_thread();
 //* SDL rendering thread. Runs separately from the emulation thread.
 void sdl_thread();
+
+//* Number of completed frames that were never displayed because a newer frame
+//* replaced them first, and of frames presented twice because no new frame
+//* had completed
+unsigned long get_frames_dropped();
+unsigned long get_frames_duplicated();
 void RunEmulation();
-void put_pixel(unsigned x, unsigned y, uint32_t color);
-void draw_frame();
 
-int const sample_rate = 44100; 
 Uint16 const sdl_audio_buffer_size = 2048;
-
-//* Protect the audio buffer from concurrent access by the emulation thread and SDL
-void lock_audio();
-void unlock_audio();
-
-//* Stop and start audio playback in SDL
-void start_audio_playback();
-void stop_audio_playback();
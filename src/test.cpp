@@ -2,30 +2,35 @@
 #include "cpu.h"
 #include "mapper.h"
 #include "rom.h"
-#include "sdl_backend.h"
-#include "sdl_frontend.h"
+#include "test.h"
+#include "timing.h"
+#include "backend.h"
 
 #include <fstream>
 #include <stdio.h>
 
 #define BUF_SIZE 65536
 
-int TotalTests;
-int CurrentTestNum;
+CONSOLE_LOCAL int TotalTests;
+CONSOLE_LOCAL int CurrentTestNum;
 
-bool end_testing;
-char const *current_filename;
+CONSOLE_LOCAL bool end_testing;
+CONSOLE_LOCAL char const *current_filename;
 char const *testlist_filename;
 
-unsigned int StartAllTestTime = 0, currentTestTime;
+CONSOLE_LOCAL uint64_t StartAllTestTime = 0, currentTestTime;
+
+CONSOLE_LOCAL int last_test_status = -1;
+CONSOLE_LOCAL char const *last_test_output;
 
 void report_status_and_end_test(uint8_t status, char const *msg) {
 
-    unsigned int currentTime;
+    last_test_status = status;
+    last_test_output = msg;
+
     unsigned int TimeTaken;
 
-    currentTime = SDL_GetTicks(); 
-    TimeTaken = currentTime - currentTestTime;
+    TimeTaken = (get_host_time_ns() - currentTestTime)/1000000;
 
     if (status == 0){
         printf("%-60s OK\n", current_filename);
@@ -42,7 +47,7 @@ void report_status_and_end_test(uint8_t status, char const *msg) {
 static void run_test(char const *file) {
 
     //* Time the test
-    currentTestTime = SDL_GetTicks();
+    currentTestTime = get_host_time_ns();
     current_filename = file;
 
     //* Show Overlay UI
@@ -51,7 +56,7 @@ static void run_test(char const *file) {
     tmpstr += " '";
     tmpstr += file;
     tmpstr += "'";
-    GUI::ShowTextOverlay(tmpstr);
+    frontend_show_message(tmpstr);
 
     //* Run Test
     load_rom(file);
@@ -81,8 +86,8 @@ void run_tests() {
 
     printf("Running NES tests from: %s\n", testlist_filename);
 
-    unsigned int currentTime, TimeTaken;
-    StartAllTestTime = SDL_GetTicks();
+    unsigned int TimeTaken;
+    StartAllTestTime = get_host_time_ns();
 
     //* Read the ROM list one line at a time.
     std::ifstream file(testlist_filename);
@@ -98,15 +103,14 @@ void run_tests() {
     }
 
     //* Log Output
-    currentTime = SDL_GetTicks();
-    TimeTaken = currentTime - StartAllTestTime;
-    GUI::ShowTextOverlay("NES Tests Complete!");
+    TimeTaken = (get_host_time_ns() - StartAllTestTime)/1000000;
+    frontend_show_message("NES Tests Complete!");
     printf("NES Tests Complete in %d secs.\n", TimeTaken / 1000);
 
     //* End of Testing
-    GUI::StopEmulation();
+    frontend_stop_emulation();
     bRunTests = false;
-    bShowGUI = true;
+    frontend_tests_finished();
     return;
 
     #undef RUN_TEST
@@ -162,6 +166,5 @@ void setup_tests(char const *testlist){
     
     end_testing = false;
     bRunTests=true;
-    bShowGUI=false;
 
 }
\ No newline at end of file
@@ -6,7 +6,13 @@ void report_status_and_end_test(uint8_t status, char const *msg);
 int CountTestList();
 
 extern char const *testlist_filename;
-extern bool end_testing;
+extern CONSOLE_LOCAL bool end_testing;
 
-extern int TotalTests;
-extern int CurrentTestNum;
\ No newline at end of file
+//* Status code and output text from the last call to
+//* report_status_and_end_test(). The status is -1 until then. The text is in
+//* WRAM, so it is only valid while the ROM is loaded.
+extern CONSOLE_LOCAL int last_test_status;
+extern CONSOLE_LOCAL char const *last_test_output;
+
+extern CONSOLE_LOCAL int TotalTests;
+extern CONSOLE_LOCAL int CurrentTestNum;
\ No newline at end of file
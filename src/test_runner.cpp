@@ -0,0 +1,348 @@
+#include "common.h"
+
+#include "mapper.h"
+#include "rom.h"
+#include "scheduler.h"
+#include "test.h"
+#include "timing.h"
+#include "backend.h"
+#include "headless_backend.h"
+#include "test_runner.h"
+
+#include <fstream>
+#include <vector>
+#include <sys/wait.h>
+
+enum Test_result {
+    TEST_PASSED,
+    TEST_FAILED,     //* Reported a non-zero status
+    TEST_TIMED_OUT,
+    TEST_NO_STATUS,  //* Emulation ended without a status (e.g. the CPU hung)
+    TEST_LOAD_ERROR,
+    TEST_CRASHED,    //* The test process died
+
+    N_TEST_RESULTS
+};
+
+//* For the printed results
+static char const *const result_names[N_TEST_RESULTS] = {
+    "OK", "FAILED", "TIMED OUT", "NO STATUS", "LOAD ERROR", "CRASHED" };
+//* For the results file
+static char const *const result_ids[N_TEST_RESULTS] = {
+    "passed", "failed", "timed_out", "no_status", "load_error", "crashed" };
+
+//* Sent from a test process to the runner through a pipe once the test is
+//* done. Smaller than PIPE_BUF, so it arrives in one piece.
+struct Test_report {
+    Test_result   result;
+    int           status; //* -1 if the test didn't report one
+    unsigned long frames;
+    uint64_t      cpu_cycles;
+    uint64_t      host_ns;
+    char          output[1024];
+};
+
+struct Test {
+    string      rom;
+    Test_report report;
+
+    //* While running
+    pid_t       pid;
+    int         fd;
+    uint64_t    start_time;
+};
+
+//* Runs in the forked process
+static void run_test_process(char const *rom, unsigned long frame_timeout,
+                             int fd) {
+    Test_report report;
+    memset(&report, 0, sizeof report);
+    report.status = -1;
+
+    //* Messages from the emulator (e.g. about a hung CPU) would get mixed up
+    //* with the runner's. Everything that matters goes into the report.
+    if (!freopen("/dev/null", "w", stdout))
+        _exit(1);
+
+    uint64_t const start_time = get_host_time_ns();
+
+    //* get_file_buffer() exits on errors, which would look like a crash
+    if (access(rom, R_OK) < 0) {
+        report.result = TEST_LOAD_ERROR;
+        snprintf(report.output, sizeof report.output, "can't read '%s': %s",
+                 rom, strerror(errno));
+    }
+    else if (!load_rom(rom))
+        report.result = TEST_LOAD_ERROR;
+    else {
+        uint64_t const start_cycle = cpu_cycle;
+        run_headless_quietly(frame_timeout);
+        report.frames     = headless_frames_run;
+        report.cpu_cycles = cpu_cycle - start_cycle;
+
+        if (last_test_status >= 0) {
+            report.result = last_test_status == 0 ? TEST_PASSED : TEST_FAILED;
+            report.status = last_test_status;
+            strncpy(report.output, last_test_output, sizeof report.output - 1);
+        }
+        else
+            report.result = headless_frames_run == frame_timeout ?
+                              TEST_TIMED_OUT : TEST_NO_STATUS;
+
+        unload_rom();
+    }
+
+    report.host_ns = get_host_time_ns() - start_time;
+
+    if (write(fd, &report, sizeof report) != sizeof report)
+        _exit(1);
+}
+
+static void start_test(Test &test, unsigned long frame_timeout) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        printf("failed to create pipe for test process: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    test.start_time = get_host_time_ns();
+
+    pid_t const pid = fork();
+    if (pid < 0) {
+        printf("failed to start test process: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run_test_process(test.rom.c_str(), frame_timeout, fds[1]);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    test.pid = pid;
+    test.fd  = fds[0];
+}
+
+//* Picks up the report of a test whose process has exited with 'wstatus'
+static void finish_test(Test &test, int wstatus) {
+    ssize_t const len = read(test.fd, &test.report, sizeof test.report);
+    close(test.fd);
+
+    if (len == sizeof test.report && WIFEXITED(wstatus) &&
+        WEXITSTATUS(wstatus) == 0)
+        return;
+
+    memset(&test.report, 0, sizeof test.report);
+    test.report.result  = TEST_CRASHED;
+    test.report.status  = -1;
+    test.report.host_ns = get_host_time_ns() - test.start_time;
+    if (WIFSIGNALED(wstatus))
+        snprintf(test.report.output, sizeof test.report.output,
+                 "killed by signal %d (%s)",
+                 WTERMSIG(wstatus), strsignal(WTERMSIG(wstatus)));
+    else
+        snprintf(test.report.output, sizeof test.report.output,
+                 "exited with status %d", WEXITSTATUS(wstatus));
+}
+
+static void print_result(Test const &test, size_t n, size_t n_tests) {
+    Test_report const &r = test.report;
+    printf("[%zu/%zu] %-60s %s (%lu frames, %.0f ms)\n",
+           n, n_tests, test.rom.c_str(), result_names[r.result], r.frames,
+           r.host_ns/1e6);
+    if (r.result != TEST_PASSED && r.output[0])
+        printf("vvv TEST OUTPUT START vvv\n%s\n^^^ TEST OUTPUT END ^^^\n",
+               r.output);
+}
+
+//*
+//* Results files
+//*
+
+static void write_json_string(FILE *f, char const *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char const c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", f);
+        //* The test output isn't necessarily valid UTF-8, so escape anything
+        //* outside printable ASCII
+        else if (c < 0x20 || c >= 0x7F)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void write_json_results(FILE *f, std::vector<Test> const &tests,
+                               unsigned long const counts[N_TEST_RESULTS],
+                               unsigned workers, unsigned long frame_timeout,
+                               uint64_t host_ns) {
+    fputs("{\n  \"testlist\": ", f);
+    write_json_string(f, testlist_filename);
+    fprintf(f, ",\n  \"workers\": %u,\n  \"frame_timeout\": %lu,\n"
+               "  \"host_ms\": %.3f,\n  \"summary\": {",
+            workers, frame_timeout, host_ns/1e6);
+    for (unsigned i = 0; i < N_TEST_RESULTS; ++i)
+        fprintf(f, "%s\"%s\": %lu", i ? ", " : " ", result_ids[i], counts[i]);
+    fputs(" },\n  \"tests\": [", f);
+
+    for (size_t i = 0; i < tests.size(); ++i) {
+        Test_report const &r = tests[i].report;
+        fputs(i ? ",\n    { \"rom\": " : "\n    { \"rom\": ", f);
+        write_json_string(f, tests[i].rom.c_str());
+        fprintf(f, ", \"result\": \"%s\", \"status\": %d, \"frames\": %lu, "
+                   "\"cpu_cycles\": %" PRIu64 ", \"host_ms\": %.3f, \"output\": ",
+                result_ids[r.result], r.status, r.frames, r.cpu_cycles,
+                r.host_ns/1e6);
+        write_json_string(f, r.output);
+        fputs(" }", f);
+    }
+
+    fputs("\n  ]\n}\n", f);
+}
+
+static void write_xml_string(FILE *f, char const *s) {
+    for (; *s; ++s) {
+        unsigned char const c = *s;
+        switch (c) {
+        case '&': fputs("&amp;", f);  break;
+        case '<': fputs("&lt;", f);   break;
+        case '>': fputs("&gt;", f);   break;
+        case '"': fputs("&quot;", f); break;
+        default:
+            //* Most control characters aren't allowed in XML, and the test
+            //* output isn't necessarily valid UTF-8
+            fputc((c < 0x20 && c != '\n' && c != '\t') || c >= 0x7F ? '?' : c, f);
+        }
+    }
+}
+
+static void write_junit_results(FILE *f, std::vector<Test> const &tests,
+                                unsigned long const counts[N_TEST_RESULTS],
+                                unsigned long frame_timeout, uint64_t host_ns) {
+    unsigned long const n_errors = tests.size() - counts[TEST_PASSED] -
+                                   counts[TEST_FAILED];
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<testsuite name=\"");
+    write_xml_string(f, testlist_filename);
+    fprintf(f, "\" tests=\"%zu\" failures=\"%lu\" errors=\"%lu\" time=\"%.3f\">\n",
+            tests.size(), counts[TEST_FAILED], n_errors, host_ns/1e9);
+
+    for (size_t i = 0; i < tests.size(); ++i) {
+        Test_report const &r = tests[i].report;
+        fputs("  <testcase classname=\"nesalizer\" name=\"", f);
+        write_xml_string(f, tests[i].rom.c_str());
+        fprintf(f, "\" time=\"%.3f\">\n", r.host_ns/1e9);
+
+        switch (r.result) {
+        case TEST_PASSED:
+            break;
+        case TEST_FAILED:
+            fprintf(f, "    <failure message=\"status %d\">", r.status);
+            write_xml_string(f, r.output);
+            fputs("</failure>\n", f);
+            break;
+        case TEST_TIMED_OUT:
+            fprintf(f, "    <error message=\"timed out after %lu frames\"/>\n",
+                    frame_timeout);
+            break;
+        default:
+            fprintf(f, "    <error message=\"%s\">", result_ids[r.result]);
+            write_xml_string(f, r.output);
+            fputs("</error>\n", f);
+        }
+
+        fprintf(f, "    <system-out>frames: %lu, cpu_cycles: %" PRIu64
+                   "</system-out>\n  </testcase>\n",
+                r.frames, r.cpu_cycles);
+    }
+
+    fputs("</testsuite>\n", f);
+}
+
+static bool ends_with(string const &s, char const *suffix) {
+    size_t const len = strlen(suffix);
+    return s.size() >= len && !s.compare(s.size() - len, len, suffix);
+}
+
+bool run_tests_in_parallel(char const *testlist, unsigned workers,
+                           unsigned long frame_timeout,
+                           char const *results_file) {
+    std::vector<Test> tests;
+
+    std::ifstream file(testlist);
+    if (!file.is_open()) {
+        printf("failed to open test list '%s'\n", testlist);
+        return false;
+    }
+    string line;
+    while (std::getline(file, line))
+        if (!line.empty()) {
+            tests.push_back(Test());
+            tests.back().rom = line;
+        }
+    file.close();
+
+    if (workers == 0)
+        workers = max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+    //* Makes the CPU watch for status writes (see write_mem() in cpu.cpp)
+    bRunTests = true;
+    testlist_filename = testlist;
+
+    printf("Running %zu NES tests from %s with %u workers\n",
+           tests.size(), testlist, workers);
+
+    uint64_t const start_time = get_host_time_ns();
+
+    unsigned long counts[N_TEST_RESULTS] = {};
+    size_t n_started = 0, n_done = 0;
+    while (n_done < tests.size()) {
+        while (n_started - n_done < workers && n_started < tests.size())
+            start_test(tests[n_started++], frame_timeout);
+
+        int wstatus;
+        pid_t const pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            printf("failed to wait for test process: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for (size_t i = 0; i < n_started; ++i)
+            if (tests[i].pid == pid) {
+                finish_test(tests[i], wstatus);
+                ++counts[tests[i].report.result];
+                print_result(tests[i], ++n_done, tests.size());
+                tests[i].pid = 0;
+                break;
+            }
+    }
+
+    uint64_t const elapsed = get_host_time_ns() - start_time;
+
+    printf("%lu passed, %lu failed, %lu timed out, %lu with errors in %.1f secs.\n",
+           counts[TEST_PASSED], counts[TEST_FAILED], counts[TEST_TIMED_OUT],
+           counts[TEST_NO_STATUS] + counts[TEST_LOAD_ERROR] + counts[TEST_CRASHED],
+           elapsed/1e9);
+
+    if (results_file) {
+        FILE *const f = fopen(results_file, "w");
+        if (!f) {
+            printf("failed to open '%s' for writing: %s\n", results_file,
+                   strerror(errno));
+            return false;
+        }
+        if (ends_with(results_file, ".xml"))
+            write_junit_results(f, tests, counts, frame_timeout, elapsed);
+        else
+            write_json_results(f, tests, counts, workers, frame_timeout, elapsed);
+        fclose(f);
+    }
+
+    return counts[TEST_PASSED] == tests.size();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+//* Parallel test ROM runner for the headless build
+//*
+//* Runs each ROM in the test list in a process of its own, forked from this
+//* one, with up to 'workers' of them running at once. A test passes or fails
+//* when it reports its status (see report_status_and_end_test()), and times out
+//* after 'frame_timeout' emulated frames. A test that crashes only takes its own
+//* process down. There is no frame pacing in the headless build, so tests run
+//* as fast as the host allows.
+//*
+//* Results are printed as tests finish, followed by a summary. If
+//* 'results_file' is given, they are also written to it as JSON, or as JUnit
+//* XML if the name ends in ".xml", including the emulated frames and CPU cycles
+//* and the host time for each test.
+
+unsigned long const default_test_frame_timeout = 7200; //* Two minutes (NTSC)
+
+//* 'workers' is the number of tests run at once, with 0 meaning one per core.
+//* Returns true if all tests passed.
+bool run_tests_in_parallel(char const *testlist, unsigned workers,
+                           unsigned long frame_timeout,
+                           char const *results_file);
@@ -4,12 +4,12 @@
 #include "rom.h"
 #include "timing.h"
 
-double cpu_clock_rate;
-double ppu_clock_rate;
-double ppu_fps;
+CONSOLE_LOCAL double cpu_clock_rate;
+CONSOLE_LOCAL double ppu_clock_rate;
+CONSOLE_LOCAL double ppu_fps;
 
 // Used for main loop synchronization
-static timespec clock_previous;
+static CONSOLE_LOCAL timespec clock_previous;
 
 void init_timing_for_rom() {
     if (is_pal) {
@@ -49,4 +49,13 @@ again:
     if(clock_gettime(CLOCK_MONOTONIC, &clock_previous) == -1){
         puts("failed to fetch synchronization timestamp from clock_gettime()");
     }
-}
\ No newline at end of file
+}
+
+uint64_t get_host_time_ns() {
+    timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now) == -1){
+        puts("failed to fetch timestamp from clock_gettime()");
+        return 0;
+    }
+    return (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+}
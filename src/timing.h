@@ -1,10 +1,13 @@
-extern double cpu_clock_rate;
-extern double ppu_clock_rate;
-extern double ppu_fps;
+extern CONSOLE_LOCAL double cpu_clock_rate;
+extern CONSOLE_LOCAL double ppu_clock_rate;
+extern CONSOLE_LOCAL double ppu_fps;
 
 void init_timing_for_rom();
 void init_timing();
 void sleep_till_end_of_frame();
 
+//* Monotonic host time in nanoseconds. Used for timing tests and benchmarks.
+uint64_t get_host_time_ns();
+
 //* Hack to get a C++03 compile-time constant
 unsigned const pal_milliframes_per_second = 50007;
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "common.h"
+
+#include "audio.h"
+#include "video.h"
+
+#include "palette.inc"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define VIDEO_NEON
+#elif defined(__SSSE3__)
+#  include <tmmintrin.h>
+#  define VIDEO_SSSE3
+#endif
+
+#ifdef MULTI_CONSOLE
+//* A thread-local pointer can't be initialized to the address of a
+//* thread-local variable. The headless frontend, which is the only one with
+//* this build, sets output_frame before running anything.
+CONSOLE_LOCAL Frame *output_frame;
+#else
+//* Output goes here until the frontend points output_frame elsewhere, so that
+//* the PPU always has a frame to write to (loading a ROM touches the PPU state
+//* before any frontend buffers need to exist)
+static Frame default_frame;
+Frame *output_frame = &default_frame;
+#endif
+
+unsigned frameskip;
+bool auto_frameskip;
+CONSOLE_LOCAL bool skip_frame;
+CONSOLE_LOCAL unsigned long frames_skipped;
+
+//* With auto_frameskip, still display at least every this many frames, so
+//* that the picture doesn't freeze if the host can't keep up at all
+static unsigned const max_auto_frameskip = 4;
+
+//* Frames skipped in a row
+static CONSOLE_LOCAL unsigned cur_frameskip;
+
+bool parse_frameskip(char const *arg) {
+    if (!strcmp(arg, "auto")) {
+        auto_frameskip = true;
+        return true;
+    }
+
+    char *end;
+    unsigned long const n = strtoul(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || n > 59)
+        return false;
+    frameskip = n;
+    return true;
+}
+
+bool end_output_frame() {
+    bool const skipped = skip_frame;
+    if (skipped) {
+        ++frames_skipped;
+        ++cur_frameskip;
+    }
+    else
+        cur_frameskip = 0;
+
+    if (auto_frameskip)
+        skip_frame = cur_frameskip < max_auto_frameskip && audio_running_behind();
+    else
+        skip_frame = cur_frameskip < frameskip;
+
+    return skipped;
+}
+
+//* The vectorized versions look up each color channel separately in a 64-byte
+//* table. This is the RGB palette for each tint split up like that, with the
+//* blue, green and red bytes of color n in rgb_planes[tint][0..2][n].
+static CONSOLE_LOCAL uint8_t rgb_planes[8][3][64] __attribute__((aligned(16)));
+
+static void init_rgb_planes() {
+    for (unsigned tint = 0; tint < 8; ++tint)
+        for (unsigned channel = 0; channel < 3; ++channel)
+            for (unsigned color = 0; color < 64; ++color)
+                rgb_planes[tint][channel][color] =
+                  nes_to_rgb[tint][color] >> 8*channel;
+}
+
+//* Converts 'n' pixels from 'src' using the palette for 'tint'.
+//* Performance hotspot - runs for every pixel of every displayed frame.
+
+#if defined(VIDEO_NEON)
+
+//* Eight pixels at a time. VTBL can only index a 32-byte table, so each channel
+//* is looked up in two halves. VTBX leaves lanes with out-of-range indices
+//* alone, and subtracting 32 wraps indices in the first half around to
+//* out-of-range values.
+static void convert_span(uint8_t const *src, uint32_t *dst, unsigned n, unsigned tint) {
+    uint8x8x4_t lo[3], hi[3];
+    for (unsigned c = 0; c < 3; ++c)
+        for (unsigned i = 0; i < 4; ++i) {
+            lo[c].val[i] = vld1_u8(rgb_planes[tint][c] + 8*i);
+            hi[c].val[i] = vld1_u8(rgb_planes[tint][c] + 32 + 8*i);
+        }
+
+    uint8x8_t const k32 = vdup_n_u8(32);
+    //* B, G, R, and a zero top byte, interleaved into pixels by VST4
+    uint8x8x4_t out;
+    out.val[3] = vdup_n_u8(0);
+
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8_t const idx    = vld1_u8(src + i);
+        uint8x8_t const idx_hi = vsub_u8(idx, k32);
+        for (unsigned c = 0; c < 3; ++c)
+            out.val[c] = vtbx4_u8(vtbl4_u8(lo[c], idx), hi[c], idx_hi);
+        vst4_u8(reinterpret_cast<uint8_t*>(dst + i), out);
+    }
+    for (; i < n; ++i)
+        dst[i] = nes_to_rgb[tint][src[i]];
+}
+
+#elif defined(VIDEO_SSSE3)
+
+//* Sixteen pixels at a time. PSHUFB indexes a 16-byte table using the low four
+//* bits of the index, so each channel is looked up in four quarters, keeping
+//* the lanes whose upper index bits select the quarter.
+static void convert_span(uint8_t const *src, uint32_t *dst, unsigned n, unsigned tint) {
+    __m128i tables[3][4];
+    for (unsigned c = 0; c < 3; ++c)
+        for (unsigned q = 0; q < 4; ++q)
+            tables[c][q] = _mm_load_si128(
+              reinterpret_cast<__m128i const*>(rgb_planes[tint][c] + 16*q));
+
+    __m128i const low_nibbles = _mm_set1_epi8(0x0F);
+    __m128i const zero        = _mm_setzero_si128();
+
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i const idx =
+          _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+        __m128i const quarter = _mm_and_si128(_mm_srli_epi16(idx, 4), low_nibbles);
+
+        __m128i chan[3];
+        for (unsigned c = 0; c < 3; ++c) {
+            chan[c] = zero;
+            for (unsigned q = 0; q < 4; ++q)
+                chan[c] = _mm_or_si128(chan[c],
+                  _mm_and_si128(_mm_shuffle_epi8(tables[c][q], idx),
+                                _mm_cmpeq_epi8(quarter, _mm_set1_epi8(q))));
+        }
+
+        //* Interleave into B, G, R, 0 bytes
+        __m128i const bg_lo = _mm_unpacklo_epi8(chan[0], chan[1]);
+        __m128i const bg_hi = _mm_unpackhi_epi8(chan[0], chan[1]);
+        __m128i const r_lo  = _mm_unpacklo_epi8(chan[2], zero);
+        __m128i const r_hi  = _mm_unpackhi_epi8(chan[2], zero);
+        __m128i *const out = reinterpret_cast<__m128i*>(dst + i);
+        _mm_storeu_si128(out    , _mm_unpacklo_epi16(bg_lo, r_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, r_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, r_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, r_hi));
+    }
+    for (; i < n; ++i)
+        dst[i] = nes_to_rgb[tint][src[i]];
+}
+
+#else
+
+static void convert_span(uint8_t const *src, uint32_t *dst, unsigned n, unsigned tint) {
+    uint32_t const *const pal_to_rgb = nes_to_rgb[tint];
+    for (unsigned i = 0; i < n; ++i)
+        dst[i] = pal_to_rgb[src[i]];
+}
+
+#endif
+
+void frame_to_rgb(Frame const &frame, uint32_t *dst, unsigned pitch) {
+    static CONSOLE_LOCAL bool rgb_planes_initialized;
+    if (!rgb_planes_initialized) {
+        init_rgb_planes();
+        rgb_planes_initialized = true;
+    }
+
+    unsigned tint = frame.start_tint;
+    unsigned change_i = 0;
+
+    for (unsigned y = 0; y < 240; ++y) {
+        uint8_t const *const src_row = frame.pixels + 256*y;
+        uint32_t *const dst_row = dst + pitch*y;
+
+        //* Split the row up into spans with the same tint
+        unsigned x = 0;
+        while (x < 256) {
+            while (change_i < frame.n_tint_changes &&
+                   frame.tint_changes[change_i].pixel <= 256*y + x)
+                tint = frame.tint_changes[change_i++].tint;
+
+            unsigned end = 256;
+            if (change_i < frame.n_tint_changes &&
+                frame.tint_changes[change_i].pixel < 256*(y + 1))
+                end = frame.tint_changes[change_i].pixel - 256*y;
+
+            convert_span(src_row + x, dst_row + x, end - x, tint);
+            x = end;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+//* Video frames as output by the PPU, and conversion to RGB
+
+//* Room for this many tint changes per frame. More than that is pathological;
+//* see add_tint_change().
+unsigned const max_tint_changes = 1024;
+
+//* A frame of video. To keep the PPU's output small, pixels are stored as NES
+//* color indices (the six-bit values from palette RAM, with grayscale applied)
+//* rather than RGB. The color emphasis ("tint") bits from $2001 affect the RGB
+//* value too, but rarely change within a frame, so they're stored as a list of
+//* changes. Converting to RGB is left to the frontend (see frame_to_rgb()),
+//* which only needs to do it for frames that get displayed.
+struct Frame {
+    uint8_t pixels[240*256] __attribute__((aligned(32)));
+
+    //* Tint bits in effect at the start of the frame
+    uint8_t start_tint;
+    //* Changes to the tint bits during the frame, in order. Each one applies
+    //* from pixels[pixel] onwards.
+    unsigned n_tint_changes;
+    struct Tint_change {
+        uint16_t pixel;
+        uint8_t  tint;
+    } tint_changes[max_tint_changes];
+};
+
+//* The frame the PPU is outputting to. Points to a dummy frame initially. The
+//* frontend points it to its own frame before emulation starts, and may point
+//* it to a different frame in draw_frame().
+extern CONSOLE_LOCAL Frame *output_frame;
+
+//* Frame skipping, for when the host can't keep up and dropping frames is
+//* preferable to audio underruns. On a skipped frame, the PPU still does
+//* everything the CPU can observe (fetches, sprite evaluation, sprite zero
+//* hits and sprite overflow), but doesn't produce any pixels, and the frontend
+//* doesn't display the frame.
+
+//* Skip this many frames after each displayed frame
+extern unsigned frameskip;
+//* Skip frames while the audio buffer is running low instead (see
+//* audio_running_behind())
+extern bool auto_frameskip;
+//* Set while the PPU is producing a frame that will be skipped
+extern CONSOLE_LOCAL bool skip_frame;
+//* Number of frames skipped so far
+extern CONSOLE_LOCAL unsigned long frames_skipped;
+
+//* Sets frameskip or auto_frameskip from a command-line argument: a number of
+//* frames, or "auto". Returns false if the argument is invalid.
+bool parse_frameskip(char const *arg);
+
+//* Called by the frontend from draw_frame(). Returns true if the frame that
+//* just completed was skipped (and so shouldn't be displayed), and decides
+//* whether to skip the next one.
+bool end_output_frame();
+
+inline void begin_frame(Frame &frame, uint8_t tint) {
+    frame.start_tint     = tint;
+    frame.n_tint_changes = 0;
+}
+
+//* If the frame has more tint changes than there's room for, the last entry is
+//* reused, which gives slightly wrong colors for part of that frame
+inline void add_tint_change(Frame &frame, unsigned pixel, uint8_t tint) {
+    if (frame.n_tint_changes == max_tint_changes)
+        --frame.n_tint_changes;
+    frame.tint_changes[frame.n_tint_changes].pixel = pixel;
+    frame.tint_changes[frame.n_tint_changes].tint  = tint;
+    ++frame.n_tint_changes;
+}
+
+//* Converts 'frame' to 0x00RRGGBB pixels in 'dst', which has 'pitch' pixels
+//* per row. Uses NEON or SSSE3 when compiled for it.
+void frame_to_rgb(Frame const &frame, uint32_t *dst, unsigned pitch = 256);